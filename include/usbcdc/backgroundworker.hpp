@@ -0,0 +1,77 @@
+#ifndef USBCDC_BACKGROUNDWORKER_HPP
+#define USBCDC_BACKGROUNDWORKER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace usbcdc {
+
+class BackgroundWorker {
+    // Runs jobs one at a time, in the order posted, on a thread of its own which starts with the
+    // first job. Destroying the worker does not join the thread: it finishes the jobs already
+    // posted, then exits. Jobs must therefore be bounded, and must not refer to the worker's owner.
+public:
+    BackgroundWorker () : mState(std::make_shared<State>()) {}
+
+    ~BackgroundWorker () {
+        {
+            std::lock_guard<std::mutex> lock{mState->mutex};
+            mState->orphaned = true;
+        }
+        mState->cv.notify_one();
+    }
+
+    BackgroundWorker (const BackgroundWorker&) = delete;
+    BackgroundWorker& operator= (const BackgroundWorker&) = delete;
+
+    void post (std::function<void()> job) {
+        auto start = false;
+        {
+            std::lock_guard<std::mutex> lock{mState->mutex};
+            mState->jobs.push_back(std::move(job));
+            start = !mState->started;
+            mState->started = true;
+        }
+        if (start) {
+            std::thread{[state = mState] { run(*state); }}.detach();
+        }
+        else {
+            mState->cv.notify_one();
+        }
+    }
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::function<void()>> jobs;
+        bool started = false;
+        bool orphaned = false;
+    };
+
+    static void run (State& state) {
+        for (;;) {
+            auto job = std::function<void()>{};
+            {
+                std::unique_lock<std::mutex> lock{state.mutex};
+                state.cv.wait(lock, [&] { return state.orphaned || state.jobs.size(); });
+                if (state.jobs.empty()) {
+                    return;
+                }
+                job = std::move(state.jobs.front());
+                state.jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::shared_ptr<State> mState;
+};
+
+} // namespace usbcdc
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef USBCDC_COROUTINE_HPP
+#define USBCDC_COROUTINE_HPP
+
+// Support for `co_await`ing monitor operations. Available when usbcdc and its users are compiled
+// as C++20 with a standard library that provides <coroutine>; `USBCDC_HAS_COROUTINES` says which.
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define USBCDC_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifndef USBCDC_HAS_COROUTINES
+#define USBCDC_HAS_COROUTINES 0
+#endif
+
+#if USBCDC_HAS_COROUTINES
+
+#include <boost/asio/detail/throw_error.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <coroutine>
+#include <functional>
+#include <utility>
+
+namespace usbcdc {
+
+template <class Result>
+class CompletionAwaiter {
+    // Awaits an operation which reports `void(error_code, Result)` to a completion handler,
+    // resuming the awaiting coroutine from that handler. `co_await` yields the result, or throws
+    // `boost::system::system_error` if the operation failed.
+public:
+    using Initiation = std::function<void(std::function<void(boost::system::error_code, Result)>)>;
+
+    explicit CompletionAwaiter (Initiation initiate)
+        : mInitiate(std::move(initiate))
+    {}
+
+    bool await_ready () const noexcept { return false; }
+
+    void await_suspend (std::coroutine_handle<> h) {
+        mInitiate([this, h](boost::system::error_code ec, Result result) {
+            mEc = ec;
+            mResult = std::move(result);
+            h.resume();
+        });
+    }
+
+    Result await_resume () {
+        boost::asio::detail::throw_error(mEc, "co_await");
+        return std::move(mResult);
+    }
+
+private:
+    Initiation mInitiate;
+    boost::system::error_code mEc;
+    Result mResult;
+};
+
+} // usbcdc
+
+#endif
+
+#endif
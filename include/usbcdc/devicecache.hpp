@@ -0,0 +1,69 @@
+#ifndef USBCDC_DEVICECACHE_HPP
+#define USBCDC_DEVICECACHE_HPP
+
+#include <usbcdc/devices.hpp>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace usbcdc {
+
+class DeviceCache {
+    // An index of the devices a monitor has reported, keyed by the kernel's device path (e.g.,
+    // `/devices/pci0000:00/.../tty/ttyACM0`), with secondary keys for the device node (e.g.,
+    // `/dev/ttyACM0`) and the device number. By the time a REMOVE arrives the device's sysfs
+    // attributes are gone, but a lookup here still yields the fully populated `Device` which was
+    // reported on ADD.
+public:
+    void insert (const std::string& sysPath, const Device& device, uint64_t devNum = 0);
+    // Insert or replace the device at `sysPath`. A `devNum` of 0 means unknown.
+
+    bool erase (const std::string& sysPath, Device& device);
+    // Remove the device at `sysPath`, storing it in `device`. Return false if no such device is
+    // cached.
+
+    bool move (const std::string& oldSysPath, const std::string& newSysPath);
+    // Re-key the device at `oldSysPath` to `newSysPath`, as on a kernel `move` uevent, and update
+    // its USB port path to match. Return false if no such device is cached.
+
+    const Device* findBySysPath (const std::string& sysPath) const;
+    const Device* findByDevNode (const std::string& devNode) const;
+    const Device* findByDevNum (uint64_t devNum) const;
+    // Return nullptr if no such device is cached.
+
+    template <class Predicate>
+    const Device* findIf (Predicate&& predicate) const {
+        for (const auto& kv: mBySysPath) {
+            if (predicate(kv.second.device)) {
+                return &kv.second.device;
+            }
+        }
+        return nullptr;
+    }
+
+    void clear ();
+    size_t size () const { return mBySysPath.size(); }
+
+    static uint64_t makeDevNum (uint32_t major, uint32_t minor) {
+        return (uint64_t(major) << 32) | minor;
+    }
+
+private:
+    struct Entry {
+        Device device;
+        uint64_t devNum;
+    };
+
+    void eraseSecondaryKeys (const std::string& sysPath, const Entry& entry);
+    // Drop the node and number keys of the entry at `sysPath`, unless a later insert has already
+    // given them to another device.
+
+    std::unordered_map<std::string, Entry> mBySysPath;
+    std::unordered_map<std::string, std::string> mSysPathByDevNode;
+    std::unordered_map<uint64_t, std::string> mSysPathByDevNum;
+};
+
+} // namespace usbcdc
+
+#endif
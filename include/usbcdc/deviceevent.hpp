@@ -0,0 +1,51 @@
+#ifndef USBCDC_DEVICEEVENT_HPP
+#define USBCDC_DEVICEEVENT_HPP
+
+#include <usbcdc/devices.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace usbcdc {
+
+class SerialStream;
+
+struct DeviceEvent {
+    enum {
+        ADD,
+        REMOVE,
+        RECONNECT,
+        // A device with the same stable identity as one recently removed has reappeared, at
+        // `device.path()`. It was previously at `previousPath`. Only reported on Linux: elsewhere
+        // devices carry no serial number or port path, so they have no stable identity, and a
+        // device which comes back is reported as a REMOVE followed by an ADD.
+        RESYNC
+        // Events were discarded because the monitor's event queue overflowed. `device` is empty.
+        // Call `asyncDevices()` again to learn the current state.
+    } type;
+    Device device;
+    std::string previousPath;
+    std::shared_ptr<SerialStream> stream;
+    // Set on ADD and RECONNECT events from a monitor with port pre-opening enabled: the device's
+    // port, already open, configured, and holding whatever the device sent since. Null otherwise,
+    // or if the monitor could not open the port.
+    std::chrono::steady_clock::time_point detected;
+    // When the monitor learned of the event, for measuring how long it took to deliver.
+};
+
+inline std::ostream& operator<<(std::ostream& os, const DeviceEvent& event) {
+    switch (event.type) {
+        case DeviceEvent::ADD: return os << "ADD " << event.device;
+        case DeviceEvent::REMOVE: return os << "REMOVE " << event.device;
+        case DeviceEvent::RECONNECT:
+            return os << "RECONNECT " << event.device << " (was " << event.previousPath << ")";
+        case DeviceEvent::RESYNC: return os << "RESYNC";
+    }
+    return os;
+}
+
+} // usbcdc
+
+#endif
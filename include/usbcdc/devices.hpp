@@ -2,9 +2,14 @@
 #define USBCDC_DEVICES_HPP
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 namespace usbcdc {
 
@@ -16,11 +21,27 @@ public:
     {}
     void path (const std::string& p) { mPath = p; }
     void productString (const std::string& ps) { mProductString = ps; }
+    void portPath (const std::string& pp) { mPortPath = pp; }
+    void serialNumber (const std::string& sn) { mSerialNumber = sn; }
+    void vendorId (uint16_t vid) { mVendorId = vid; }
+    void productId (uint16_t pid) { mProductId = pid; }
     const std::string& path () const { return mPath; }
     const std::string& productString () const { return mProductString; }
+    const std::string& portPath () const { return mPortPath; }
+    // The USB port path of the device, in the kernel's bus-port.port.port form (e.g., `1-1.4.2`),
+    // or empty if unknown. Currently only recorded on Linux.
+    const std::string& serialNumber () const { return mSerialNumber; }
+    uint16_t vendorId () const { return mVendorId; }
+    uint16_t productId () const { return mProductId; }
+    // The USB serial number string and VID/PID, or empty/zero if unknown. Currently only recorded
+    // on Linux.
 private:
     std::string mPath;
     std::string mProductString;
+    std::string mPortPath;
+    std::string mSerialNumber;
+    uint16_t mVendorId = 0;
+    uint16_t mProductId = 0;
 };
 
 std::ostream& operator<< (std::ostream& os, const Device& d);
@@ -29,6 +50,36 @@ bool operator< (const Device& a, const Device& b);
 using DeviceSet = std::set<Device>;
 DeviceSet devices ();
 
+class CancellationToken {
+    // A flag shared by copies: cancelling any copy cancels the operations given any other.
+public:
+    void cancel () { mCancelled->store(true); }
+    bool cancelled () const { return mCancelled->load(); }
+private:
+    std::shared_ptr<std::atomic<bool>> mCancelled = std::make_shared<std::atomic<bool>>(false);
+};
+
+struct PartialDeviceSet {
+    DeviceSet devices;
+    // The devices resolved in time.
+    std::vector<std::string> timedOut;
+    // The devices which were found but not resolved, because reading their attributes took too
+    // long, the deadline passed, or the enumeration was cancelled. On Linux these are sysfs paths
+    // of ttys. Where the platform only enumerates all devices at once, the single entry
+    // "devices()" means the whole enumeration did not finish.
+    bool cancelled = false;
+};
+
+constexpr std::chrono::milliseconds kDeviceResolveTimeout{250};
+
+PartialDeviceSet devices (std::chrono::steady_clock::time_point deadline,
+        const CancellationToken& cancel = {});
+// Enumerate devices without blocking past `deadline`, or for long after `cancel` is cancelled,
+// however long the system takes to answer. Attributes are read on a worker thread, which is
+// abandoned if it wedges. On Linux each device is given at most `kDeviceResolveTimeout` of the
+// time left, so that one misbehaving device does not cost the others theirs. Throws like
+// `devices()` if the system has no device tree at all.
+
 struct DeviceSetDifferences {
     DeviceSet added;
     DeviceSet removed;
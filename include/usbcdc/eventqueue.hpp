@@ -0,0 +1,75 @@
+#ifndef USBCDC_EVENTQUEUE_HPP
+#define USBCDC_EVENTQUEUE_HPP
+
+#include <usbcdc/deviceevent.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace usbcdc {
+
+class EventQueue {
+    // A fixed-capacity FIFO of device events with an explicit policy for what happens when the
+    // producer outruns the consumer. Storage is allocated once, when the capacity is set, so a
+    // monitor's memory use stays predictable however slowly its events are consumed.
+public:
+    enum class Policy {
+        BLOCK,
+        // Refuse new events while full. The monitor stops producing (stops parsing `udevadm`
+        // output, or stops polling) until the consumer catches up, so no event is lost.
+        DROP_OLDEST,
+        // Discard the oldest queued event to make room for each new one.
+        RESYNC
+        // Discard every queued event and queue a single RESYNC marker in their place. Further
+        // events are discarded until the marker has been received.
+    };
+
+    struct Statistics {
+        size_t highWaterMark = 0;
+        uint64_t pushed = 0;
+        uint64_t dropped = 0;
+        uint64_t resyncs = 0;
+    };
+
+    static constexpr size_t kDefaultCapacity = 256;
+    static constexpr size_t kMinimumCapacity = 2;
+    // One record can produce two events, a rename's REMOVE and ADD, which must fit together.
+
+    explicit EventQueue (size_t capacity = kDefaultCapacity, Policy policy = Policy::BLOCK);
+
+    void capacity (size_t c);
+    size_t capacity () const { return mSlots.size(); }
+    void policy (Policy p) { mPolicy = p; }
+    Policy policy () const { return mPolicy; }
+
+    bool wouldBlock (size_t n = 1) const {
+        return mPolicy == Policy::BLOCK && mSize + n > mSlots.size();
+    }
+    // True if `push()` would currently refuse one of `n` more events.
+
+    bool push (DeviceEvent&& event);
+    // Queue `event`, applying the overflow policy if the queue is full. Return false if the event
+    // was refused (BLOCK) or discarded (RESYNC).
+
+    DeviceEvent& front () { return mSlots[mHead]; }
+    void pop ();
+
+    bool empty () const { return !mSize; }
+    bool full () const { return mSize == mSlots.size(); }
+    size_t size () const { return mSize; }
+
+    const Statistics& statistics () const { return mStatistics; }
+
+private:
+    bool resyncPending () const;
+
+    std::vector<DeviceEvent> mSlots;
+    size_t mHead = 0;
+    size_t mSize = 0;
+    Policy mPolicy;
+    Statistics mStatistics;
+};
+
+} // namespace usbcdc
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef USBCDC_FRAMEDECODER_HPP
+#define USBCDC_FRAMEDECODER_HPP
+
+#include <boost/asio/buffer.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace usbcdc {
+
+class FrameDecoder {
+    // Splits a CDC byte stream into delimiter-terminated frames, as used by COBS (delimiter 0x00)
+    // and SLIP (delimiter 0xC0) links. Read buffers are scanned in place with `memchr()`, which
+    // the C library vectorizes. A frame lying entirely within one buffer is handed out as a view
+    // into that buffer, with no copy. Only a frame which straddles two reads is assembled in an
+    // internal buffer, allocated once at construction.
+public:
+    struct Statistics {
+        uint64_t frames = 0;
+        uint64_t assembledFrames = 0;
+        // Frames which straddled buffers and had to be copied.
+        uint64_t oversizedFrames = 0;
+        // Frames longer than the maximum, which were discarded.
+    };
+
+    explicit FrameDecoder (uint8_t delimiter = 0x00, size_t maxFrameSize = 4096)
+        : mDelimiter(delimiter)
+        , mMaxFrameSize(maxFrameSize)
+    {
+        mPartial.reserve(maxFrameSize);
+    }
+
+    template <class ConstBufferSequence, class FrameHandler>
+    void decode (const ConstBufferSequence& buffers, FrameHandler&& onFrame);
+    // Scan `buffers` and call `onFrame(boost::asio::const_buffer)` for each complete frame, not
+    // including its delimiter. Empty frames are skipped. The frame buffer is only valid during
+    // the call. Bytes after the last delimiter are kept until the next call.
+
+    void reset () {
+        mPartial.clear();
+        mDiscarding = false;
+    }
+
+    const Statistics& statistics () const { return mStatistics; }
+
+private:
+    template <class FrameHandler>
+    void decodeOne (const uint8_t* data, size_t size, FrameHandler& onFrame);
+
+    bool appendPartial (const uint8_t* data, size_t size);
+
+    uint8_t mDelimiter;
+    size_t mMaxFrameSize;
+    std::vector<uint8_t> mPartial;
+    bool mDiscarding = false;
+    Statistics mStatistics;
+};
+
+template <class ConstBufferSequence, class FrameHandler>
+inline void FrameDecoder::decode (const ConstBufferSequence& buffers, FrameHandler&& onFrame) {
+    using boost::asio::buffer_sequence_begin;
+    using boost::asio::buffer_sequence_end;
+    for (auto iter = buffer_sequence_begin(buffers); iter != buffer_sequence_end(buffers); ++iter) {
+        boost::asio::const_buffer b = *iter;
+        decodeOne(static_cast<const uint8_t*>(b.data()), b.size(), onFrame);
+    }
+}
+
+template <class FrameHandler>
+inline void FrameDecoder::decodeOne (const uint8_t* data, size_t size, FrameHandler& onFrame) {
+    auto end = data + size;
+    while (data != end) {
+        auto delim = static_cast<const uint8_t*>(std::memchr(data, mDelimiter, size_t(end - data)));
+        if (!delim) {
+            // The rest of this buffer is the beginning of a frame.
+            if (!appendPartial(data, size_t(end - data))) {
+                mDiscarding = true;
+            }
+            return;
+        }
+
+        if (mDiscarding) {
+            mDiscarding = false;
+            mPartial.clear();
+        }
+        else if (mPartial.size()) {
+            if (appendPartial(data, size_t(delim - data))) {
+                ++mStatistics.frames;
+                ++mStatistics.assembledFrames;
+                onFrame(boost::asio::const_buffer(mPartial.data(), mPartial.size()));
+            }
+            mPartial.clear();
+        }
+        else if (delim != data) {
+            if (size_t(delim - data) <= mMaxFrameSize) {
+                ++mStatistics.frames;
+                onFrame(boost::asio::const_buffer(data, size_t(delim - data)));
+            }
+            else {
+                ++mStatistics.oversizedFrames;
+            }
+        }
+        data = delim + 1;
+    }
+}
+
+inline bool FrameDecoder::appendPartial (const uint8_t* data, size_t size) {
+    if (mDiscarding) {
+        return false;
+    }
+    if (mPartial.size() + size > mMaxFrameSize) {
+        ++mStatistics.oversizedFrames;
+        mPartial.clear();
+        return false;
+    }
+    mPartial.insert(mPartial.end(), data, data + size);
+    return true;
+}
+
+} // namespace usbcdc
+
+#endif
@@ -1,7 +1,18 @@
 #ifndef USBCDC_GENERIC_MONITOR_HPP
 #define USBCDC_GENERIC_MONITOR_HPP
 
+#include <usbcdc/backgroundworker.hpp>
+#include <usbcdc/coroutine.hpp>
+#include <usbcdc/deviceevent.hpp>
 #include <usbcdc/devices.hpp>
+#include <usbcdc/eventqueue.hpp>
+#include <usbcdc/handlermemory.hpp>
+#include <usbcdc/identity.hpp>
+#include <usbcdc/iocontext.hpp>
+#include <usbcdc/monitorbackend.hpp>
+#include <usbcdc/pollschedule.hpp>
+#include <usbcdc/serialstream.hpp>
+#include <usbcdc/trace.hpp>
 
 #include <util/log.hpp>
 #include <util/producerconsumerqueue.hpp>
@@ -10,9 +21,17 @@
 
 #include <beast/core/handler_alloc.hpp>
 
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/detail/bind_handler.hpp>
+#include <boost/asio/handler_alloc_hook.hpp>
+#include <boost/asio/handler_continuation_hook.hpp>
 #include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <exception>
+#include <functional>
 #include <future>
 #include <memory>
 
@@ -23,25 +42,36 @@ namespace usbcdc {
 class Monitor {
 public:
     explicit Monitor(boost::asio::io_service& c)
-        : timer(c)
+        : strand(c)
+        , timer(c)
+        , waitTimer(c)
     {}
 
     ~Monitor() {
         boost::system::error_code ec;
-        close(ec);
+        closeTimers(ec);
     }
 
     boost::asio::io_service& get_io_service();
 
     void close(boost::system::error_code& ec);
+    // Safe to call from any thread, concurrently with outstanding operations. Outstanding
+    // operations, and any started afterwards, fail with `operation_aborted`.
+
+    // The asynchronous operations may be started from any thread; their steps and `close()`'s
+    // cleanup are serialized on an internal strand. The configuration below is not synchronized,
+    // and should be set before the first operation starts.
 
 private:
     template <class Handler = void(boost::system::error_code, DeviceSet)>
     struct DevicesOp;
 
-    template <class Handler = void(boost::system::error_code, DeviceEvent)>
+    template <class Handler>
     struct ReceiveDeviceEventOp;
 
+    template <class Handler = void(boost::system::error_code, Device)>
+    struct WaitForDeviceOp;
+
 public:
     template <class Token>
     auto asyncDevices(Token&& token) {
@@ -50,25 +80,207 @@ public:
         return composed::operation<DevicesOp<>>{}(*this, std::forward<Token>(token));
     }
 
+    template <class Token>
+    auto asyncDevicesUntil(std::chrono::steady_clock::time_point deadline,
+            CancellationToken cancel, Token&& token) {
+        // Enumerate devices as `devices(deadline, cancel)` does, on a worker thread, and complete
+        // with `(boost::system::error_code, PartialDeviceSet)`. Unlike `asyncDevices()`, this
+        // neither needs nor primes the monitor's event stream, so it suits health checks which
+        // must not hang. The monitor has one worker, so concurrent calls are served in turn, each
+        // after the previous one's deadline at the latest.
+        boost::asio::async_completion<Token, void(boost::system::error_code, PartialDeviceSet)>
+            init{token};
+        using Handler = typename decltype(init)::completion_handler_type;
+        auto& context = get_io_service();
+        // The job is a std::function, so the handler is held by a shared_ptr.
+        auto handler = std::make_shared<Handler>(std::move(init.completion_handler));
+        enumerationWorker.post([&context, work = boost::asio::io_service::work(context), deadline,
+                cancel, handler] {
+            auto ec = boost::system::error_code{};
+            auto result = PartialDeviceSet{};
+            try {
+                result = devices(deadline, cancel);
+            }
+            catch (const boost::system::system_error& e) {
+                ec = e.code();
+            }
+            catch (const std::exception&) {
+                ec = boost::asio::error::network_down;
+            }
+            context.post(
+                boost::asio::detail::bind_handler(std::move(*handler), ec, std::move(result)));
+        });
+        return init.result.get();
+    }
+
     template <class Token>
     auto asyncReceiveDeviceEvent(Token&& token) {
         // Wait for the monitor to detect the arrival or removal of a device in the system. Should
         // only be called after `asyncDevices()`.
-        return composed::operation<ReceiveDeviceEventOp<>>{}(*this, std::forward<Token>(token));
+        boost::asio::async_completion<Token, void(boost::system::error_code, DeviceEvent)>
+            init{token};
+        using Handler = typename decltype(init)::completion_handler_type;
+        strand.dispatch(ReceiveDeviceEventOp<Handler>{*this, std::move(init.completion_handler)});
+        return init.result.get();
     }
 
+    template <class Predicate, class Token>
+    auto asyncWaitForDevice(Predicate&& predicate, std::chrono::steady_clock::duration timeout,
+            Token&& token) {
+        // Wait until a device for which `predicate(device)` returns true is present, or until
+        // `timeout` elapses, in which case the operation fails with `timed_out`. Devices already
+        // present are checked first. Queued events are left for `asyncReceiveDeviceEvent()`.
+        // Should only be called after `asyncDevices()`. `close()` cancels the wait.
+        return composed::operation<WaitForDeviceOp<>>{}(*this,
+            std::function<bool(const Device&)>(std::forward<Predicate>(predicate)), timeout,
+            std::forward<Token>(token));
+    }
+
+    // `asyncReceiveDeviceEvent()`, `asyncWaitForDevice()` and `awaitDeviceEvent()` all poll and
+    // advance the same device set, so only one of them may be outstanding at a time. One started
+    // while another is outstanding fails with `in_progress`, and leaves the other undisturbed.
+
+    MonitorBackend backend() const { return MonitorBackend::POLLING; }
+    // The generic monitor always polls the platform's device enumeration.
+
+    void pollIntervals(std::chrono::steady_clock::duration minimum,
+            std::chrono::steady_clock::duration maximum) {
+        schedule.minimum(minimum);
+        schedule.maximum(maximum);
+    }
+    void pollFastWindow(std::chrono::steady_clock::duration w) { schedule.fastWindow(w); }
+    void pollBackoff(double factor) { schedule.backoff(factor); }
+    const PollSchedule::Statistics& pollStatistics() const { return schedule.statistics(); }
+    // The monitor polls every `minimum` for the fast window after it sees a change, and after
+    // `asyncWaitForDevice()` starts. Otherwise each quiet poll multiplies the interval by the
+    // backoff factor, up to `maximum`. See `PollSchedule` for the defaults.
+
+    void reconnectWindow(std::chrono::steady_clock::duration w) { identities.window(w); }
+    // How long after a REMOVE a device with the same stable identity is reported as a RECONNECT
+    // instead of an ADD. This platform's enumeration reports no serial numbers or port paths, so
+    // for now no device has a stable identity, and this monitor never reports a RECONNECT.
+
+    void eventQueueCapacity(size_t c) { eventQueue.capacity(c); }
+    void eventQueuePolicy(EventQueue::Policy p) { eventQueue.policy(p); }
+    const EventQueue::Statistics& eventQueueStatistics() const { return eventQueue.statistics(); }
+    // Bound the number of events held for `asyncReceiveDeviceEvent()`, and choose what happens
+    // when the bound is reached. With the default BLOCK policy, polling stops while the queue is
+    // full, and the next poll after the consumer catches up reports the net difference.
+
+    void preopenPorts(const SerialProfile& profile,
+            size_t prebufferSize = SerialStream::kDefaultPrebufferSize) {
+        preopenEnabled = true;
+        preopenProfile = profile;
+        preopenBufferSize = prebufferSize;
+    }
+    // Open every port that appears as soon as it is detected, and attach it to the ADD or
+    // RECONNECT event as `event.stream`. Up to `prebufferSize` bytes the device sends before the
+    // stream is first read are kept for that read.
+
+#if USBCDC_HAS_COROUTINES
+    CompletionAwaiter<DeviceSet> awaitDevices() {
+        return CompletionAwaiter<DeviceSet>{[this](auto h) { asyncDevices(std::move(h)); }};
+    }
+    CompletionAwaiter<DeviceEvent> awaitDeviceEvent() {
+        return CompletionAwaiter<DeviceEvent>{
+            [this](auto h) { asyncReceiveDeviceEvent(std::move(h)); }};
+    }
+    // `co_await`able equivalents of `asyncDevices()` and `asyncReceiveDeviceEvent()`, which throw
+    // `boost::system::system_error` on failure. A polling monitor has no descriptor to suspend
+    // on, so these resume from the completion handlers of the regular operations.
+#endif
+
 private:
+    void closeTimers(boost::system::error_code& ec);
+
+    void poll();
+    // Enumerate devices, queue events for any differences from `lastDevices`, and update
+    // `lastDevices` to match the events actually queued.
+
+    bool enqueue(DeviceEvent event, std::chrono::steady_clock::time_point now);
+
     DeviceSet lastDevices;
-    std::chrono::time_point<std::chrono::steady_clock> lastDevicesTime;
+    PollSchedule schedule;
+    boost::asio::io_service::strand strand;
+    // Every handler which touches the monitor's state runs on this strand.
     boost::asio::steady_timer timer;
-    std::queue<DeviceEvent> eventQueue;
-
-    static constexpr const std::chrono::milliseconds kPollInterval{500};
+    boost::asio::steady_timer waitTimer;
+    EventQueue eventQueue;
+    IdentityTracker identities;
+    bool receiving = false;
+    // Set while a receive, wait, or await is outstanding.
+    bool closed = false;
+    // Set on the strand by `close()`. Checked by every operation step, since a timer wait which
+    // had already completed when the timers were canceled still reports success.
+    HandlerMemory receiveMemory;
+    // Storage for `ReceiveDeviceEventOp`'s timer waits and posts, reused from one event to the
+    // next.
+    bool preopenEnabled = false;
+    SerialProfile preopenProfile;
+    size_t preopenBufferSize = 0;
+    BackgroundWorker enumerationWorker;
+    // Runs `asyncDevicesUntil()`'s enumerations.
+    std::shared_ptr<char> lifetime = std::make_shared<char>();
+    // Lets `close()`'s strand handler tell whether the monitor still exists.
 };
 
-inline boost::asio::io_service& Monitor::get_io_service() { return timer.get_io_service(); }
+inline boost::asio::io_service& Monitor::get_io_service() { return ioContext(timer); }
 inline void Monitor::close(boost::system::error_code& ec) {
-    timer.expires_at(decltype(timer)::clock_type::time_point::max(), ec);
+    strand.dispatch([this, weak = std::weak_ptr<char>(lifetime)] {
+        if (!weak.expired()) {
+            boost::system::error_code ec;
+            closed = true;
+            closeTimers(ec);
+        }
+    });
+    ec = {};
+}
+
+inline void Monitor::closeTimers(boost::system::error_code& ec) {
+    timer.cancel(ec);
+    waitTimer.cancel(ec);
+}
+
+inline void Monitor::poll() {
+    USBCDC_TRACE_SCOPE("Monitor::poll");
+    auto now = std::chrono::steady_clock::now();
+    if (eventQueue.wouldBlock()) {
+        schedule.polled(now, false);
+        return;
+    }
+
+    auto diff = deviceSetDifferences(lastDevices, devices());
+    schedule.polled(now, diff.removed.size() || diff.added.size());
+    // Removals go first, so that a device which came back under a new path within one poll
+    // interval is reported as a RECONNECT. `lastDevices` only advances past the events the queue
+    // accepted, so anything refused is picked up again by the next poll.
+    for (auto& d: diff.removed) {
+        if (!enqueue(DeviceEvent{DeviceEvent::REMOVE, d}, now)) {
+            return;
+        }
+        lastDevices.erase(d);
+    }
+    for (auto& d: diff.added) {
+        if (!enqueue(DeviceEvent{DeviceEvent::ADD, d}, now)) {
+            return;
+        }
+        lastDevices.insert(d);
+    }
+}
+
+inline bool Monitor::enqueue(DeviceEvent event, std::chrono::steady_clock::time_point now) {
+    if (eventQueue.wouldBlock()) {
+        return false;
+    }
+    event.detected = now;
+    identities.process(event, now);
+    if (preopenEnabled
+            && (event.type == DeviceEvent::ADD || event.type == DeviceEvent::RECONNECT)) {
+        event.stream = preopen(get_io_service(), event.device, preopenProfile, preopenBufferSize);
+    }
+    eventQueue.push(std::move(event));
+    // Under the lossy policies the event counts as delivered even if it was discarded.
+    return true;
 }
 
 // =======================================================================================
@@ -95,11 +307,14 @@ struct Monitor::DevicesOp: boost::asio::coroutine {
 template <class Handler>
 void Monitor::DevicesOp<Handler>::operator()(composed::op<DevicesOp>& op) {
     if (!ec) reenter(this) {
-        yield return self.timer.get_io_service().post(op());
+        yield return self.strand.post(op());
 
         try {
             self.lastDevices = devices();
-            self.lastDevicesTime = std::chrono::steady_clock::now();
+            // Applications usually look for a device right after enumerating, so start fast.
+            auto now = std::chrono::steady_clock::now();
+            self.schedule.wake(now);
+            self.schedule.polled(now, false);
             // FIXME FIXME FIXME :(
             // We should really generate events and put them on the event queue here. The way it's
             // written, you must call `asyncDevices()` before `asyncReceiveDeviceEvent()`.
@@ -120,61 +335,176 @@ void Monitor::DevicesOp<Handler>::operator()(composed::op<DevicesOp>& op) {
 // ReceiveDeviceEvent operation
 
 template <class Handler>
-struct Monitor::ReceiveDeviceEventOp: boost::asio::coroutine {
+struct Monitor::ReceiveDeviceEventOp {
+    // Written by hand rather than as a composed operation so that it can be its own completion
+    // handler: every allocation asio makes on its behalf comes from `receiveMemory`, and the event
+    // is moved straight from the queue into the caller's handler. All of its steps run on the
+    // monitor's strand.
+    Monitor& self;
+    Handler handler;
+    boost::system::error_code ec;
+    bool started = false;
+    bool busy = false;
+    // Another operation was outstanding, so this one fails without touching the timer.
+
+    void start() {
+        started = true;
+        if (self.receiving) {
+            busy = true;
+            ec = boost::asio::error::in_progress;
+            return self.strand.post(std::move(*this));
+        }
+        self.receiving = true;
+        wait();
+    }
+
+    void wait() {
+        if (self.eventQueue.size()) {
+            return self.strand.post(std::move(*this));
+        }
+        if (self.closed) {
+            ec = boost::asio::error::operation_aborted;
+            return self.strand.post(std::move(*this));
+        }
+        self.timer.expires_at(self.schedule.next());
+        self.timer.async_wait(self.strand.wrap(std::move(*this)));
+    }
+
+    void operator()(boost::system::error_code e) {
+        ec = self.closed ? boost::asio::error::operation_aborted : e;
+        if (!ec) {
+            self.poll();
+            if (self.eventQueue.empty()) {
+                return wait();
+            }
+        }
+        complete();
+    }
+
+    void operator()() {
+        if (!started) {
+            start();
+        }
+        else {
+            complete();
+        }
+    }
+
+    void complete() {
+        if (!busy) {
+            self.receiving = false;
+        }
+        auto event = DeviceEvent{};
+        if (!ec) {
+            event = std::move(self.eventQueue.front());
+            self.eventQueue.pop();
+        }
+        handler(ec, std::move(event));
+    }
+
+    void* allocate(size_t size) { return self.receiveMemory.allocate(size); }
+    void deallocate(void* p) { self.receiveMemory.deallocate(p); }
+
+    friend void* asio_handler_allocate(size_t size, ReceiveDeviceEventOp* op) {
+        return op->allocate(size);
+    }
+
+    friend void asio_handler_deallocate(void* p, size_t, ReceiveDeviceEventOp* op) {
+        op->deallocate(p);
+    }
+
+    friend bool asio_handler_is_continuation(ReceiveDeviceEventOp* op) {
+        using boost::asio::asio_handler_is_continuation;
+        return op->started || asio_handler_is_continuation(std::addressof(op->handler));
+    }
+    // No invocation hook: the steps must run on the monitor's strand, not wherever `handler`
+    // would run.
+};
+
+// =======================================================================================
+// WaitForDevice operation
+
+template <class Handler>
+struct Monitor::WaitForDeviceOp: boost::asio::coroutine {
     using handler_type = Handler;
     using allocator_type = beast::handler_alloc<char, handler_type>;
 
     Monitor& self;
+    std::function<bool(const Device&)> predicate;
+    std::chrono::steady_clock::time_point deadline;
 
-    DeviceEvent event;
-    // With some refactoring we could avoid storing this, using self.eventQueue.front() as the op's
-    // result, requiring the op to pop the queue on entry. Sounds annoying.
+    Device device;
+    bool found = false;
+    bool claimed = false;
+    // Whether this wait is the outstanding operation, and so must release the monitor.
 
     composed::associated_logger_t<handler_type> lg;
     boost::system::error_code ec;
 
-    ReceiveDeviceEventOp(handler_type& h, Monitor& m)
+    WaitForDeviceOp(handler_type& h, Monitor& m, std::function<bool(const Device&)> p,
+            std::chrono::steady_clock::duration timeout)
         : self(m)
+        , predicate(std::move(p))
+        , deadline(std::chrono::steady_clock::now() + timeout)
         , lg(composed::get_associated_logger(h))
     {}
 
-    void operator()(composed::op<ReceiveDeviceEventOp>&);
+    void findDevice() {
+        // `lastDevices` already reflects every event still sitting in the queue, so checking it
+        // covers both the current state and pending ADDs without copying anything.
+        auto iter = std::find_if(self.lastDevices.begin(), self.lastDevices.end(),
+            std::cref(predicate));
+        if (iter != self.lastDevices.end()) {
+            device = *iter;
+            found = true;
+        }
+    }
+
+    void operator()(composed::op<WaitForDeviceOp>&);
 };
 
 template <class Handler>
-void Monitor::ReceiveDeviceEventOp<Handler>::operator()(composed::op<ReceiveDeviceEventOp>& op) {
+void Monitor::WaitForDeviceOp<Handler>::operator()(composed::op<WaitForDeviceOp>& op) {
     if (!ec) reenter(this) {
-        while (true) {
-            if (self.eventQueue.size()) {
-                event = self.eventQueue.front();
-                self.eventQueue.pop();
-                yield return self.timer.get_io_service().post(op());
-                yield break;
-            }
+        yield return self.strand.post(op());
+        if (self.closed) {
+            ec = boost::asio::error::operation_aborted;
+            yield break;
+        }
+        if (self.receiving) {
+            ec = boost::asio::error::in_progress;
+            yield break;
+        }
+        self.receiving = claimed = true;
+        self.schedule.wake(std::chrono::steady_clock::now());
+        findDevice();
 
-            if (self.timer.expires_at() == decltype(self.timer)::clock_type::time_point::min()) {
+        while (!found) {
+            self.waitTimer.expires_at(std::min(deadline, self.schedule.next()));
+            yield return self.waitTimer.async_wait(self.strand.wrap(op(ec)));
+
+            if (self.closed) {
                 ec = boost::asio::error::operation_aborted;
-                yield return self.timer.get_io_service().post(op());
+                yield break;
             }
-            self.timer.expires_at(self.lastDevicesTime + self.kPollInterval);
-            yield return self.timer.async_wait(op(ec));
-
-            {
-                auto newDevices = devices();
-                auto diff = deviceSetDifferences(self.lastDevices, newDevices);
-                for (auto d: diff.added) {
-                    self.eventQueue.push({DeviceEvent::ADD, d});
-                }
-                for (auto d: diff.removed) {
-                    self.eventQueue.push({DeviceEvent::REMOVE, d});
-                }
-
-                self.lastDevices = newDevices;
-                self.lastDevicesTime = std::chrono::steady_clock::now();
+            if (std::chrono::steady_clock::now() >= deadline) {
+                ec = boost::asio::error::timed_out;
+                yield break;
+            }
+            if (self.eventQueue.wouldBlock()) {
+                // The device set cannot advance until the consumer receives some events.
+                ec = boost::asio::error::no_buffer_space;
+                yield break;
             }
+
+            self.poll();
+            findDevice();
         }
     }
-    op.complete(ec, event);
+    if (claimed) {
+        self.receiving = false;
+    }
+    op.complete(ec, device);
 };
 
 } // usbcdc
@@ -0,0 +1,44 @@
+#ifndef USBCDC_HANDLERMEMORY_HPP
+#define USBCDC_HANDLERMEMORY_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+namespace usbcdc {
+
+class HandlerMemory {
+    // One reusable block of memory for an I/O object's asynchronous operation state. An object
+    // which never has more than one operation of a given kind outstanding can route that
+    // operation's allocations here, so that repeated operations do not touch the heap. Requests
+    // which are too large, or which arrive while the block is in use, fall back to the heap.
+public:
+    HandlerMemory () = default;
+    HandlerMemory (const HandlerMemory&) = delete;
+    HandlerMemory& operator= (const HandlerMemory&) = delete;
+
+    void* allocate (size_t size) {
+        if (!mInUse && size <= sizeof(mStorage)) {
+            mInUse = true;
+            return &mStorage;
+        }
+        return ::operator new(size);
+    }
+
+    void deallocate (void* p) {
+        if (p == &mStorage) {
+            mInUse = false;
+        }
+        else {
+            ::operator delete(p);
+        }
+    }
+
+private:
+    std::aligned_storage_t<256> mStorage;
+    bool mInUse = false;
+};
+
+} // usbcdc
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef USBCDC_IDENTITY_HPP
+#define USBCDC_IDENTITY_HPP
+
+#include <usbcdc/devices.hpp>
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace usbcdc {
+
+struct DeviceEvent;
+
+std::string stableId (const Device& device);
+// An identity for `device` which survives re-enumeration under a different path: its VID/PID and
+// USB serial number if it has one, otherwise its VID/PID and USB port path. Return an empty string
+// if the device has neither.
+
+class IdentityTracker {
+    // Remembers the stable identities of recently removed devices, so that a device which comes
+    // back, possibly as a different `/dev/ttyACMn`, can be reported as a RECONNECT rather than as
+    // an unrelated ADD.
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void window (Clock::duration w) { mWindow = w; }
+    Clock::duration window () const { return mWindow; }
+    // How long after a REMOVE an ADD of the same identity is still reported as a RECONNECT.
+
+    void process (DeviceEvent& event, Clock::time_point now = Clock::now());
+    // Record REMOVEs, and rewrite an ADD into a RECONNECT, with `previousPath` set, if the same
+    // identity was removed within the window.
+
+private:
+    void expire (Clock::time_point now);
+
+    struct Departure {
+        std::string path;
+        Clock::time_point time;
+    };
+
+    std::unordered_map<std::string, Departure> mDepartures;
+    std::deque<std::pair<Clock::time_point, std::string>> mExpiry;
+    // Departures in the order they were recorded, so that expiring them only looks at the ones
+    // which are due. An entry whose identity has since been re-added or removed again is skipped.
+    Clock::duration mWindow = std::chrono::seconds{30};
+};
+
+} // namespace usbcdc
+
+#endif
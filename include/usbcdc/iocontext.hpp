@@ -0,0 +1,35 @@
+#ifndef USBCDC_IOCONTEXT_HPP
+#define USBCDC_IOCONTEXT_HPP
+
+// Boost 1.70 removed the I/O objects' `get_io_service()`, and made their executors type-erased,
+// so that the io_service an object runs on is only reachable through its executor; Boost 1.74
+// then replaced the executor's `context()` with a property query. `ioContext()` hides which of
+// the three a given Boost offers.
+
+#include <boost/asio/io_service.hpp>
+#include <boost/version.hpp>
+
+#if BOOST_VERSION >= 107400
+#include <boost/asio/execution/context.hpp>
+#include <boost/asio/query.hpp>
+#endif
+
+namespace usbcdc {
+
+template <class IoObject>
+inline boost::asio::io_service& ioContext (IoObject& object) {
+    // The io_service `object` was constructed with. Every I/O object in usbcdc is constructed
+    // from an io_service, so the downcast from the executor's execution context is safe.
+#if BOOST_VERSION < 107000
+    return object.get_io_service();
+#elif BOOST_VERSION < 107400
+    return static_cast<boost::asio::io_service&>(object.get_executor().context());
+#else
+    return static_cast<boost::asio::io_service&>(
+        boost::asio::query(object.get_executor(), boost::asio::execution::context));
+#endif
+}
+
+} // usbcdc
+
+#endif
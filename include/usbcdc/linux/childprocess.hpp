@@ -0,0 +1,48 @@
+#ifndef USBCDC_LINUX_CHILDPROCESS_HPP
+#define USBCDC_LINUX_CHILDPROCESS_HPP
+
+#include <cstddef>
+
+#include <sys/types.h>
+
+namespace usbcdc {
+
+class ChildProcess {
+    // Owns a helper process, e.g. `udevadm`. Releasing it sends it SIGTERM and hands it to the
+    // process-wide reaper, so that it never lingers as a zombie, without waiting for it to exit.
+public:
+    ChildProcess () = default;
+    explicit ChildProcess (pid_t pid) : mPid(pid) {}
+    ~ChildProcess () { release(); }
+
+    ChildProcess (ChildProcess&& other) noexcept : mPid(other.mPid) { other.mPid = 0; }
+    ChildProcess& operator= (ChildProcess&& other) noexcept {
+        if (this != &other) {
+            release();
+            mPid = other.mPid;
+            other.mPid = 0;
+        }
+        return *this;
+    }
+
+    pid_t pid () const { return mPid; }
+    explicit operator bool () const { return mPid > 0; }
+
+    void release ();
+    // Terminate and reap the child, if any. Returns at once; safe to call on a child which has
+    // already exited.
+
+private:
+    pid_t mPid = 0;
+};
+
+void reapChild (pid_t pid);
+// Wait for `pid` to exit on the process-wide reaper thread, which is started on first use.
+// Returns at once.
+
+size_t unreapedChildren ();
+// How many children handed to `reapChild()` have not yet been reaped.
+
+} // usbcdc
+
+#endif
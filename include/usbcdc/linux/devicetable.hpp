@@ -0,0 +1,90 @@
+#ifndef USBCDC_LINUX_DEVICETABLE_HPP
+#define USBCDC_LINUX_DEVICETABLE_HPP
+
+#include <usbcdc/devices.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace usbcdc {
+
+struct DeviceTableEntry {
+    // One device, in fixed-size fields so that the table can live in shared memory. Longer strings
+    // are truncated.
+    char path[64];
+    char productString[128];
+    char portPath[32];
+    char serialNumber[64];
+    uint16_t vendorId;
+    uint16_t productId;
+};
+
+struct DeviceTableLayout {
+    // The contents of the shared-memory segment. `sequence` is a seqlock: odd while the writer is
+    // updating the table, and advanced by two for each update, so a reader which sees the same
+    // even value before and after copying the table has a consistent snapshot. `generation` counts
+    // updates, and may be polled on its own to detect change.
+    static constexpr uint32_t kMagic = 0x75736263;
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kCapacity = 256;
+
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> generation;
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> truncated;
+    // Nonzero if there were more than `kCapacity` devices, in which case only the first
+    // `kCapacity` are in the table.
+    DeviceTableEntry entries[kCapacity];
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the device table needs lock-free 64-bit atomics");
+
+class DeviceTableWriter {
+    // Creates a POSIX shared-memory segment named `name` (e.g., `/usbcdcd`) holding a device
+    // table, and publishes device sets to it. Removes the segment when destroyed.
+public:
+    explicit DeviceTableWriter (const std::string& name);
+    ~DeviceTableWriter ();
+
+    DeviceTableWriter (const DeviceTableWriter&) = delete;
+    DeviceTableWriter& operator= (const DeviceTableWriter&) = delete;
+
+    uint64_t publish (const DeviceSet& devices);
+    // Replace the table's contents with `devices`, and return the new generation.
+
+    uint64_t generation () const { return mTable->generation.load(std::memory_order_acquire); }
+
+private:
+    std::string mName;
+    DeviceTableLayout* mTable;
+};
+
+class DeviceTableReader {
+    // Maps an existing device table read-only. Reading it makes no system calls.
+public:
+    explicit DeviceTableReader (const std::string& name);
+    ~DeviceTableReader ();
+
+    DeviceTableReader (const DeviceTableReader&) = delete;
+    DeviceTableReader& operator= (const DeviceTableReader&) = delete;
+
+    uint64_t generation () const { return mTable->generation.load(std::memory_order_acquire); }
+
+    uint64_t read (DeviceSet& devices);
+    // Copy a consistent snapshot of the table into `devices`, and return its generation. Retries
+    // while the writer is updating the table.
+
+private:
+    const DeviceTableLayout* mTable;
+    std::vector<DeviceTableEntry> mScratch;
+};
+
+} // usbcdc
+
+#endif
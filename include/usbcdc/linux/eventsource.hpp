@@ -0,0 +1,119 @@
+#ifndef USBCDC_LINUX_EVENTSOURCE_HPP
+#define USBCDC_LINUX_EVENTSOURCE_HPP
+
+#include <usbcdc/devices.hpp>
+#include <usbcdc/monitorbackend.hpp>
+
+#include <boost/asio/streambuf.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace usbcdc {
+
+struct UdevRecord {
+    // The properties of one `udevadm` record which the monitor cares about. Absent properties are
+    // left empty.
+    std::string action;
+    std::string devPath;
+    std::string devPathOld;
+    std::string devName;
+    std::string usbDriver;
+    std::string modelEnc;
+    std::string serialNumber;
+    uint16_t vendorId = 0;
+    uint16_t productId = 0;
+    uint64_t devNum = 0;
+};
+
+class UdevadmParser {
+    // Parses `udevadm info` and `udevadm monitor --property` records. The grammar is built once,
+    // and property values are copied straight into the record's strings, so that parsing into
+    // the same record over and over allocates nothing once its strings have grown to fit.
+public:
+    UdevadmParser ();
+    ~UdevadmParser ();
+
+    UdevadmParser (UdevadmParser&&) noexcept;
+    UdevadmParser& operator= (UdevadmParser&&) noexcept;
+
+    bool parse (boost::asio::streambuf& buf, size_t n, UdevRecord& record);
+    // Parse one record, the first `n` bytes of `buf`'s input sequence, without filtering on
+    // driver or action. Return false on parse failure, leaving `record` unspecified.
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> mImpl;
+};
+
+class EventSource {
+    // Where a Linux monitor's events come from. Every backend produces the same thing: records in
+    // `udevadm monitor --property` format. The monitor waits for `descriptor()` to become readable,
+    // reads raw bytes from it into its buffer, and hands them to `commit()` to be turned into
+    // records.
+public:
+    explicit EventSource (int descriptor) : mDescriptor(descriptor) {}
+    virtual ~EventSource () = default;
+
+    EventSource (const EventSource&) = delete;
+    EventSource& operator= (const EventSource&) = delete;
+
+    int descriptor () const { return mDescriptor; }
+    // The monitor takes ownership of this descriptor.
+
+    virtual MonitorBackend backend () const = 0;
+
+    virtual void commit (boost::asio::streambuf& buf, size_t n) = 0;
+    // `n` raw bytes were just read from the descriptor into `buf.prepare()`. Append the records
+    // they describe, if any, to `buf`'s input sequence.
+
+    virtual void start () {}
+    // Start any helper process which writes to the descriptor. The monitor calls this before it
+    // first needs events, so that a monitor which is never used costs no process. May be called
+    // from any thread, more than once. A helper which fails to start leaves the descriptor at EOF.
+
+    virtual void terminate () {}
+    // Stop any helper process. May be called from any thread, more than once.
+
+private:
+    int mDescriptor;
+};
+
+class RecordEventSource : public EventSource {
+    // Reads `udevadm monitor --property` records from a descriptor as-is, e.g. recorded or
+    // synthetic events.
+public:
+    using EventSource::EventSource;
+
+    MonitorBackend backend () const override { return MonitorBackend::UDEVADM; }
+    void commit (boost::asio::streambuf& buf, size_t n) override { buf.commit(n); }
+};
+
+std::unique_ptr<EventSource> openSysfsEventSource (MonitorBackend backend,
+        boost::system::error_code& ec);
+// Open a NETLINK, INOTIFY, or POLLING event source. These read device properties from sysfs
+// (`$SYSFS_PATH`, or /sys), so they need neither udev nor any helper program.
+
+std::unique_ptr<EventSource> ueventEventSource (int descriptor);
+// Read uevents in the kernel's netlink format, one per datagram, from `descriptor`, e.g. one end
+// of a socketpair fed by a load generator. Events which already carry udev's `ID_*` properties
+// are taken as they are; others are completed from sysfs, as for the NETLINK backend.
+
+std::vector<UdevRecord> sysfsRecords (boost::system::error_code& ec);
+// Describe every CDC-ACM tty in sysfs as `udevadm info` would, for enumerating devices without
+// udev.
+
+std::vector<UdevRecord> sysfsRecords (std::chrono::steady_clock::time_point deadline,
+        const CancellationToken& cancel, PartialDeviceSet& partial, boost::system::error_code& ec);
+// As above, but read each tty's attributes on a worker thread, and give up on any tty which takes
+// longer than `kDeviceResolveTimeout`, or is still unresolved at `deadline` or on cancellation.
+// Those ttys' sysfs paths are added to `partial.timedOut`, and `partial.cancelled` is set if
+// `cancel` was cancelled.
+
+} // usbcdc
+
+#endif
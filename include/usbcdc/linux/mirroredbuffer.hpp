@@ -0,0 +1,116 @@
+#ifndef USBCDC_LINUX_MIRROREDBUFFER_HPP
+#define USBCDC_LINUX_MIRROREDBUFFER_HPP
+
+#include <util/asio/asynccompletion.hpp>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+
+#include <usbcdc/coroutine.hpp>
+#include <usbcdc/iocontext.hpp>
+
+#include <boost/asio/yield.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <tuple>
+#include <utility>
+
+namespace usbcdc {
+
+class MirroredBuffer {
+    // A ring buffer whose pages are mapped twice, back to back, so that the readable bytes and the
+    // free space are each one contiguous span however they wrap: a read goes straight into
+    // `prepare()`, and a parser sees everything received in `data()`, with no fragment to stitch
+    // and no compaction. Has the shape of asio's streambuf (`prepare()`, `commit()`, `data()`,
+    // `consume()`), but its capacity is fixed, and rounded up to whole pages.
+public:
+    using const_buffers_type = boost::asio::const_buffers_1;
+    using mutable_buffers_type = boost::asio::mutable_buffers_1;
+
+    static constexpr size_t kDefaultCapacity = 64 * 1024;
+
+    explicit MirroredBuffer (size_t capacity = kDefaultCapacity);
+    // Throw `boost::system::system_error` if the mapping cannot be made.
+    ~MirroredBuffer ();
+
+    MirroredBuffer (MirroredBuffer&& other) noexcept;
+    MirroredBuffer& operator= (MirroredBuffer&& other) noexcept;
+
+    MirroredBuffer (const MirroredBuffer&) = delete;
+    MirroredBuffer& operator= (const MirroredBuffer&) = delete;
+
+    size_t size () const { return mSize; }
+    size_t capacity () const { return mCapacity; }
+    size_t max_size () const { return mCapacity; }
+    size_t space () const { return mCapacity - mSize; }
+    // The number of readable bytes, of bytes in all, and of bytes which may be prepared.
+
+    const_buffers_type data () const {
+        return const_buffers_type{mData + mBegin, mSize};
+    }
+
+    mutable_buffers_type prepare (size_t n);
+    // Return `n` bytes of free space after the readable bytes. Throw `std::length_error` if `n`
+    // is more than `space()`.
+
+    mutable_buffers_type prepare () { return prepare(space()); }
+
+    void commit (size_t n) { mSize += std::min(n, space()); }
+    // Make `n` prepared bytes readable.
+
+    void consume (size_t n);
+    // Discard the first `n` readable bytes.
+
+private:
+    void unmap ();
+
+    char* mData = nullptr;
+    // The first of the two views of the buffer. Byte `i` is also at `mData + mCapacity + i`.
+    size_t mCapacity = 0;
+    size_t mBegin = 0;
+    size_t mSize = 0;
+};
+
+template <class AsyncReadStream, class CompletionToken>
+auto asyncReadSome (AsyncReadStream& stream, MirroredBuffer& buffer, CompletionToken&& token);
+// Read whatever `stream` has straight into `buffer`'s free space, make it readable, and complete
+// with `(boost::system::error_code, size_t)`. Fails with `boost::asio::error::no_buffer_space`
+// if `buffer` is full.
+
+// =======================================================================================
+// Inline implementation
+
+template <class AsyncReadStream, class CompletionToken>
+inline auto asyncReadSome (AsyncReadStream& stream, MirroredBuffer& buffer,
+        CompletionToken&& token) {
+    auto coroutine =
+    [ &stream
+    , &buffer
+    ](auto&& op, boost::system::error_code ec = {}, size_t n = 0) mutable {
+        reenter (op) {
+            if (!buffer.space()) {
+                yield ioContext(stream).post(std::move(op));
+                op.complete(make_error_code(boost::asio::error::no_buffer_space), size_t(0));
+            }
+            else {
+                yield stream.async_read_some(buffer.prepare(), std::move(op));
+                buffer.commit(n);
+                op.complete(ec, n);
+            }
+        }
+    };
+
+    return util::asio::asyncDispatch(
+        ioContext(stream),
+        std::make_tuple(make_error_code(boost::asio::error::operation_aborted), size_t(0)),
+        std::move(coroutine),
+        std::forward<CompletionToken>(token)
+    );
+}
+
+} // usbcdc
+
+#include <boost/asio/unyield.hpp>
+
+#endif
@@ -10,57 +10,260 @@
 
 #include <boost/iostreams/device/file_descriptor.hpp>
 
+#include <boost/asio/async_result.hpp>
 #include <boost/asio/completion_condition.hpp>
 #include <boost/asio/buffer.hpp>
+#include <boost/asio/handler_alloc_hook.hpp>
+#include <boost/asio/handler_continuation_hook.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/streambuf.hpp>
 
+#include <usbcdc/backgroundworker.hpp>
+#include <usbcdc/coroutine.hpp>
+#include <usbcdc/devicecache.hpp>
+#include <usbcdc/deviceevent.hpp>
 #include <usbcdc/devices.hpp>
+#include <usbcdc/eventqueue.hpp>
+#include <usbcdc/handlermemory.hpp>
+#include <usbcdc/identity.hpp>
+#include <usbcdc/monitorbackend.hpp>
+#include <usbcdc/serialstream.hpp>
+#include <usbcdc/topology.hpp>
+#include <usbcdc/trace.hpp>
+#include <usbcdc/linux/childprocess.hpp>
+#include <usbcdc/linux/eventsource.hpp>
+
+#include <util/log.hpp>
 
 #include <boost/asio/yield.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
+#include <unistd.h>
+
 namespace usbcdc {
 
 class MonitorImpl {
 public:
     explicit MonitorImpl (boost::asio::io_service& context);
+    // Use `udevadm` if it is installed, and otherwise the first of NETLINK, INOTIFY, and POLLING
+    // which works on this host, or the backend named by the `USBCDC_MONITOR_BACKEND` environment
+    // variable (`netlink`, `udevadm`, `inotify`, or `polling`). Throw
+    // `boost::system::system_error` if none works.
+
+    MonitorImpl (boost::asio::io_service& context, MonitorBackend backend);
+    // Use `backend`, throwing `boost::system::system_error` if it does not work on this host.
+
+    MonitorImpl (boost::asio::io_service& context, int recordFd);
+    // Read `udevadm monitor --property` records from `recordFd`, which the monitor takes ownership
+    // of, instead of running `udevadm monitor`. Useful to replay recorded or synthetic events.
+
+    MonitorImpl (boost::asio::io_service& context, std::unique_ptr<EventSource> source);
+    // Read events from `source`, e.g. `ueventEventSource()` to inject synthetic uevents.
+
+    // Constructing a monitor starts no process: a UDEVADM monitor runs `udevadm monitor` once it
+    // is first asked to enumerate or to wait for an event.
+
+    MonitorBackend backend () const { return mSource->backend(); }
+    // Which backend the monitor chose. INOTIFY and POLLING are degraded modes.
 
     void close (boost::system::error_code& ec);
+    // Safe to call from any thread, concurrently with outstanding operations.
 
     template <class CompletionToken>
     auto asyncDevices (CompletionToken&& token);
 
+    template <class CompletionToken>
+    auto asyncDevicesUntil (std::chrono::steady_clock::time_point deadline,
+            CancellationToken cancel, CompletionToken&& token);
+    // Enumerate devices as `devices(deadline, cancel)` does, on a worker thread, and complete
+    // with `(boost::system::error_code, PartialDeviceSet)`. Unlike `asyncDevices()`, this neither
+    // needs nor primes the monitor's event stream, so it suits health checks which must not hang.
+    // The monitor has one worker, so concurrent calls are served in turn, each after the
+    // previous one's deadline at the latest.
+
     template <class CompletionToken>
     auto asyncReceiveDeviceEvent (CompletionToken&& token);
 
+    template <class Predicate, class CompletionToken>
+    auto asyncWaitForDevice (Predicate&& predicate, std::chrono::steady_clock::duration timeout,
+            CompletionToken&& token);
+    // Wait until a device for which `predicate(device)` returns true is present, or until
+    // `timeout` elapses, in which case the operation fails with `timed_out`. Devices already
+    // present are checked first. Queued events are left for `asyncReceiveDeviceEvent()`.
+
+    // `asyncReceiveDeviceEvent()`, `asyncWaitForDevice()` and `awaitDeviceEvent()` all read the
+    // event source into one buffer, so only one of them may be outstanding at a time. One started
+    // while another is outstanding fails with `in_progress`, and leaves the other undisturbed.
+
+    // The asynchronous operations may be started from any thread; their steps and `close()`'s
+    // cleanup are serialized on an internal strand. The configuration below is not synchronized,
+    // and should be set before the first operation starts.
+
+    void reconnectWindow (std::chrono::steady_clock::duration w) { mIdentities.window(w); }
+    std::chrono::steady_clock::duration reconnectWindow () const { return mIdentities.window(); }
+
+    void eventQueueCapacity (size_t c) { mEvents.capacity(c); }
+    void eventQueuePolicy (EventQueue::Policy p) { mEvents.policy(p); }
+    const EventQueue::Statistics& eventQueueStatistics () const { return mEvents.statistics(); }
+
+    void preopenPorts (const SerialProfile& profile, size_t prebufferSize) {
+        mPreopen = true;
+        mPreopenProfile = profile;
+        mPrebufferSize = prebufferSize;
+    }
+
+#if USBCDC_HAS_COROUTINES
+    class DeviceEventAwaiter;
+
+    CompletionAwaiter<DeviceSet> awaitDevices ();
+    DeviceEventAwaiter awaitDeviceEvent ();
+#endif
+
 private:
+    template <class CompletionToken>
+    auto asyncSysfsDevices (CompletionToken&& token);
+    // `asyncDevices()` for the backends which do not rely on udev.
+
+    template <class Handler>
+    struct ReceiveOp;
+
+    void commit (size_t n);
+    // Hand `n` bytes just read from the event source into `mBuf.prepare()` to the source, to be
+    // turned into records. Events parsed from them are stamped with the time of the read.
+
+    bool parseEvents ();
+    // Parse every complete event record in `mBuf`, queue the resulting events in `mEvents`, and
+    // apply them to `mDevices`. Under the BLOCK policy, parsing stops while the queue has no room
+    // for the next record's events, the remaining records stay in `mBuf`, and this returns
+    // false.
+
+    void applyRecord (UdevRecord& record);
+    // Turn one parsed `udevadm monitor` record into zero or more events, resolving removals and
+    // renames through `mDevices`.
+
+    void preopenPort (DeviceEvent& event);
+
+    bool tryReceiveDeviceEvent (DeviceEvent& event);
+    // Parse what is already buffered, and pop the next event into `event` if there is one.
+
+#if USBCDC_HAS_COROUTINES
+    struct ReadableHandler;
+
+    void awaitReadable (DeviceEventAwaiter& awaiter);
+    void startAwait (DeviceEventAwaiter& awaiter);
+    void onReadable (boost::system::error_code ec);
+#endif
+
     boost::asio::io_service& mContext;
 
-    boost::process::pipe mPipe;
+    boost::asio::io_service::strand mStrand;
+    // Every handler which touches the monitor's state runs on this strand, so that the monitor
+    // may be driven from an io_service run by many threads.
+
+    std::unique_ptr<EventSource> mSource;
     boost::process::pipe_end mChildStdout;
-    boost::process::child mChildProcess;
+    // The event source's descriptor: a pipe from `udevadm`, a netlink socket, an inotify
+    // instance, or a timer.
+
+    boost::asio::streambuf mBuf;
+    // Records which have been read but not yet parsed. Reused across operations so that no record
+    // is lost when a read returns more than one record.
+
+    EventQueue mEvents;
+    // Parsed events not yet delivered by `asyncReceiveDeviceEvent()`. Since `udevadm` output is
+    // only read while an operation is pending, the pipe itself provides backpressure beyond this
+    // queue, and the overflow policy applies to whatever one read delivers.
+
+    DeviceCache mDevices;
+    // The devices present in the system, as of the last `asyncDevices()` plus every event parsed
+    // since, indexed by kernel device path.
+
+    UdevadmParser mParser;
+    UdevRecord mRecord;
+    // Reused for every record, so that parsing does not allocate once the record's strings have
+    // grown to fit.
+    std::chrono::steady_clock::time_point mReadTime;
+
+    IdentityTracker mIdentities;
+
+    bool mReceiving = false;
+    // Set while a receive, wait, or await is outstanding.
+
+    boost::asio::steady_timer mWaitTimer;
+    unsigned mWaitGeneration = 0;
+    // The outstanding wait's deadline. The generation counter keeps a timer which expired just as
+    // a wait completed from canceling a later operation's read.
+
+    BackgroundWorker mEnumerationWorker;
+    // Runs `asyncDevicesUntil()`'s enumerations.
+
+    bool mPreopen = false;
+    SerialProfile mPreopenProfile;
+    size_t mPrebufferSize = 0;
+
+#if USBCDC_HAS_COROUTINES
+    DeviceEventAwaiter* mAwaiter = nullptr;
+    // The coroutine suspended in `awaitDeviceEvent()`, if any.
+#endif
+
+    HandlerMemory mReceiveMemory;
+    // Storage for the asynchronous operations behind `asyncReceiveDeviceEvent()` and
+    // `awaitDeviceEvent()`. Only one receive is outstanding at a time, and asio frees each
+    // operation before invoking its handler, so a steady stream of events reuses this block.
+
+    std::shared_ptr<char> mLifetime = std::make_shared<char>();
+    // `close()`'s strand handler holds a weak reference, so that it can tell whether the monitor
+    // still exists when it runs.
+
+    static constexpr size_t kReadSize = 4096;
 };
 
+struct ToolPaths {
+    // The helper programs the UDEVADM backend runs, looked up in `PATH` once per process rather
+    // than on every spawn. Empty if not found.
+    std::string stdbuf;
+    std::string udevadm;
+    std::string sh;
+};
+
+inline const ToolPaths& toolPaths () {
+    static const ToolPaths paths{
+        boost::process::search_path("stdbuf"),
+        boost::process::search_path("udevadm"),
+        boost::process::search_path("sh")
+    };
+    return paths;
+}
+
 template <class Args>
-static inline auto executeProcess (boost::asio::io_service& context,
+static inline ChildProcess executeProcess (boost::asio::io_service& context,
         decltype(boost::process::pipe::sink) fd, Args&& args) {
     using namespace boost::process::initializers;
     boost::iostreams::file_descriptor_sink sink { fd, boost::iostreams::close_handle };
-    return boost::process::execute(
+    return ChildProcess{boost::process::execute(
         set_args(std::forward<Args>(args)),
         bind_stdout(sink),
         close_stdin(),
         close_stderr(),
         throw_on_error(),
         notify_io_service(context)
-    );
+    ).pid};
 }
 
-static inline auto executeUdevadmMonitor (boost::asio::io_service& context,
+static inline ChildProcess executeUdevadmMonitor (boost::asio::io_service& context,
         decltype(boost::process::pipe::sink) fd) {
     return executeProcess(context, fd, std::vector<std::string>{
-        boost::process::search_path("stdbuf"),
+        toolPaths().stdbuf,
         "-oL",
         // When run in a terminal, `udevadm` has line-buffered output. That is, as soon
         // as `udevadm` emits a newline, its output buffer is flushed. When run in a pipeline,
@@ -68,36 +271,170 @@ static inline auto executeUdevadmMonitor (boost::asio::io_service& context,
         // frequently. Since `udevadm` demarcates its event records with newlines, we must
         // force its stdout pipe to be line-buffered to have any hope of receiving events in
         // real-time. `stdout -oL <cmd...>` is an easy way of doing this.
-        boost::process::search_path("udevadm"),
+        toolPaths().udevadm,
         "monitor",
         "--udev",  // Only receive post-processed udev events
         "--property",  // Dump some metadata that includes the encoded product string
         "--subsystem-match=tty"
+        // Hubs' `usb` events are not needed: each tty beneath a hub gets its own event.
     });
 }
 
-static inline auto executeUdevadmInfo (boost::asio::io_service& context,
+static inline ChildProcess executeUdevadmInfo (boost::asio::io_service& context,
         decltype(boost::process::pipe::sink) fd) {
     return executeProcess(context, fd, std::vector<std::string>{
-        boost::process::search_path("sh"),
+        toolPaths().sh,
         "-c",
         "find /sys/class/tty -print0 | xargs -0 -L1 udevadm info | cut -d' ' -f2"
     });
 }
 
+class UdevadmEventSource : public EventSource {
+    // `udevadm monitor` run as a child process, which writes its records to a pipe. The child is
+    // only spawned by `start()`; until then the source holds nothing but the pipe.
+public:
+    UdevadmEventSource (boost::asio::io_service& context, boost::process::pipe pipe)
+        : EventSource(pipe.source)
+        , mContext(context)
+        , mSink(pipe.sink)
+    {}
+
+    ~UdevadmEventSource () { terminate(); }
+
+    MonitorBackend backend () const override { return MonitorBackend::UDEVADM; }
+    void commit (boost::asio::streambuf& buf, size_t n) override { buf.commit(n); }
+
+    void start () override {
+        if (mStarted.load(std::memory_order_acquire)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock{mMutex};
+        if (mStarted.load(std::memory_order_relaxed)) {
+            return;
+        }
+        auto sink = mSink;
+        mSink = -1;
+        // The sink is closed when the child is started, or fails to. Either way, the pipe reads
+        // EOF once no child holds it.
+        try {
+            mChildProcess = executeUdevadmMonitor(mContext, sink);
+        }
+        catch (boost::system::system_error& e) {
+            util::log::Logger lg;
+            BOOST_LOG(lg) << "Could not start udevadm monitor: " << e.what();
+        }
+        mStarted.store(true, std::memory_order_release);
+    }
+
+    void terminate () override {
+        std::lock_guard<std::mutex> lock{mMutex};
+        mStarted.store(true, std::memory_order_release);
+        if (mSink >= 0) {
+            ::close(mSink);
+            mSink = -1;
+        }
+        mChildProcess.release();
+    }
+
+private:
+    boost::asio::io_service& mContext;
+    int mSink;
+    // The pipe's write end, handed to the child when it is started.
+
+    std::mutex mMutex;
+    std::atomic<bool> mStarted{false};
+    // Set once the child has been started, or once it no longer may be.
+    ChildProcess mChildProcess;
+};
+
+inline std::unique_ptr<EventSource> openEventSource (boost::asio::io_service& context,
+        MonitorBackend backend, boost::system::error_code& ec) {
+    if (backend != MonitorBackend::UDEVADM) {
+        return openSysfsEventSource(backend, ec);
+    }
+    if (toolPaths().udevadm.empty() || toolPaths().stdbuf.empty()) {
+        ec = make_error_code(boost::system::errc::no_such_file_or_directory);
+        return nullptr;
+    }
+    ec = {};
+    return std::make_unique<UdevadmEventSource>(context, boost::process::create_pipe());
+}
+
+inline std::unique_ptr<EventSource> openEventSource (boost::asio::io_service& context,
+        MonitorBackend backend) {
+    auto ec = boost::system::error_code{};
+    auto source = openEventSource(context, backend, ec);
+    boost::asio::detail::throw_error(ec, monitorBackendName(backend));
+    return source;
+}
+
+inline std::unique_ptr<EventSource> openEventSource (boost::asio::io_service& context) {
+    // Prefer udev, whose events arrive once rules and permissions have been applied, so that a
+    // port can be opened as soon as its ADD arrives. Without udev, raw kernel uevents are next
+    // best, and then the backends which only notice changes in /dev or poll.
+    util::log::Logger lg;
+    auto backend = MonitorBackend{};
+    auto name = std::getenv("USBCDC_MONITOR_BACKEND");
+    if (name && parseMonitorBackend(name, backend)) {
+        return openEventSource(context, backend);
+    }
+    if (name) {
+        BOOST_LOG(lg) << "Ignoring unknown USBCDC_MONITOR_BACKEND: " << name;
+    }
+
+    auto ec = boost::system::error_code{};
+    for (auto b: {MonitorBackend::UDEVADM, MonitorBackend::NETLINK,
+            MonitorBackend::INOTIFY, MonitorBackend::POLLING}) {
+        auto source = openEventSource(context, b, ec);
+        if (source) {
+            return source;
+        }
+        BOOST_LOG(lg) << "Monitor backend " << b << " is unavailable: " << ec.message();
+    }
+    boost::asio::detail::throw_error(ec, "openEventSource");
+    return nullptr;
+}
+
 inline MonitorImpl::MonitorImpl (boost::asio::io_service& context)
-    : mContext(context)
-    , mPipe(boost::process::create_pipe())
-    , mChildStdout(mContext, mPipe.source)
-    , mChildProcess(executeUdevadmMonitor(context, mPipe.sink))
+    : MonitorImpl(context, openEventSource(context))
+{}
+
+inline MonitorImpl::MonitorImpl (boost::asio::io_service& context, MonitorBackend backend)
+    : MonitorImpl(context, openEventSource(context, backend))
+{}
+
+inline MonitorImpl::MonitorImpl (boost::asio::io_service& context, int recordFd)
+    : MonitorImpl(context, std::make_unique<RecordEventSource>(recordFd))
 {}
 
+inline MonitorImpl::MonitorImpl (boost::asio::io_service& context,
+        std::unique_ptr<EventSource> source)
+    : mContext(context)
+    , mStrand(context)
+    , mSource(std::move(source))
+    , mChildStdout(mContext, mSource->descriptor())
+    , mWaitTimer(context)
+{
+    boost::system::error_code ec;
+    mChildStdout.non_blocking(true, ec);
+    // Only affects synchronous reads, which only the coroutine interface uses: it reads what a
+    // readiness notification announced without risking a block.
+}
+
 inline void MonitorImpl::close (boost::system::error_code& ec) {
-    boost::process::terminate(mChildProcess);
-    // Calling `terminate()` is not recommended by Boost.Process docs, but they also document that
-    // it is implemented on Linux using SIGTERM, which is what we would probably do anyway.
+    // May be called from any thread. Any helper process is terminated at once and reaped in the
+    // background, and the event source's descriptor and the timer are closed on the strand, after
+    // which pending operations complete with an error.
+    mSource->terminate();
 
-    mChildStdout.close(ec);
+    mStrand.dispatch([this, lifetime = std::weak_ptr<char>(mLifetime)] {
+        if (!lifetime.expired()) {
+            boost::system::error_code ec;
+            mWaitTimer.cancel(ec);
+            mChildStdout.close(ec);
+        }
+    });
+    ec = {};
 }
 
 bool parseUdevadm (boost::asio::streambuf& buf, size_t n, Device& event);
@@ -106,8 +443,210 @@ bool parseUdevadm (boost::asio::streambuf& buf, size_t n, Device& event);
 bool parseUdevadm (boost::asio::streambuf& buf, size_t n, DeviceEvent& event);
 // Parse the output of `udevadm monitor --property`, returning false on parse failure.
 
+bool parseUdevadm (boost::asio::streambuf& buf, size_t n, UdevRecord& record);
+// Parse one record of either `udevadm info` or `udevadm monitor --property` output without
+// filtering on driver or action, returning false on parse failure. Builds a new `UdevadmParser`
+// on every call; keep one instead to parse many records.
+
+std::string decodeProductString (std::string input);
+// Decode the `\xhh` escape sequences udev uses in properties such as `ID_MODEL_ENC`.
+
+inline Device toDevice (UdevRecord& record) {
+    // Build the `Device` described by a `udevadm` record, consuming its strings.
+    auto device = Device{record.devName, decodeProductString(std::move(record.modelEnc))};
+    device.portPath(usbPortPath(record.devPath));
+    device.serialNumber(std::move(record.serialNumber));
+    device.vendorId(record.vendorId);
+    device.productId(record.productId);
+    return device;
+}
+
+inline void MonitorImpl::applyRecord (UdevRecord& record) {
+    USBCDC_TRACE_SCOPE("applyRecord");
+    auto event = DeviceEvent{};
+    event.detected = mReadTime;
+    if (record.action == "add") {
+        if (record.usbDriver != "cdc_acm") {
+            return;
+        }
+        event.type = DeviceEvent::ADD;
+        event.device = toDevice(record);
+        mDevices.insert(record.devPath, event.device, record.devNum);
+    }
+    else if (record.action == "remove") {
+        event.type = DeviceEvent::REMOVE;
+        if (!mDevices.erase(record.devPath, event.device)) {
+            // We never saw this device arrive, e.g. it arrived between the `udevadm info`
+            // enumeration and the start of the monitor. Fall back to the udev database's copy of
+            // its properties.
+            if (record.usbDriver != "cdc_acm") {
+                return;
+            }
+            event.device = toDevice(record);
+        }
+    }
+    else if (record.action == "move") {
+        auto device = mDevices.findBySysPath(record.devPathOld);
+        if (!device) {
+            return;
+        }
+        if (record.devName.empty() || record.devName == device->path()) {
+            // Only the device's place in the USB topology changed.
+            mDevices.move(record.devPathOld, record.devPath);
+            return;
+        }
+        // The device node was renamed, so clients must see it as a different device.
+        event.type = DeviceEvent::REMOVE;
+        mDevices.erase(record.devPathOld, event.device);
+        mIdentities.process(event);
+        mEvents.push(DeviceEvent(event));
+        event.type = DeviceEvent::ADD;
+        event.device.path(record.devName);
+        event.device.portPath(usbPortPath(record.devPath));
+        mDevices.insert(record.devPath, event.device, record.devNum);
+    }
+    else {
+        // `change` and other actions do not alter the device's identity.
+        return;
+    }
+    mIdentities.process(event);
+    preopenPort(event);
+    mEvents.push(std::move(event));
+}
+
+inline void MonitorImpl::preopenPort (DeviceEvent& event) {
+    // The port is opened as the record is parsed, not when the event is delivered, so the
+    // prebuffer starts filling as soon as the monitor learns of the device. The open is
+    // synchronous: events queued behind this one wait for it. Opening a cdc_acm tty does not
+    // touch the device, so this normally costs tens of microseconds; deferring it would instead
+    // lose whatever the device sends before the deferred open ran.
+    if (mPreopen && (event.type == DeviceEvent::ADD || event.type == DeviceEvent::RECONNECT)) {
+        event.stream = preopen(mContext, event.device, mPreopenProfile, mPrebufferSize);
+    }
+}
+
+inline bool MonitorImpl::tryReceiveDeviceEvent (DeviceEvent& event) {
+    parseEvents();
+    if (mEvents.empty()) {
+        return false;
+    }
+    event = std::move(mEvents.front());
+    mEvents.pop();
+    return true;
+}
+
+inline void MonitorImpl::commit (size_t n) {
+    if (n) {
+        USBCDC_TRACE_SCOPE("EventSource::commit");
+        mReadTime = std::chrono::steady_clock::now();
+        mSource->commit(mBuf, n);
+    }
+}
+
+inline bool MonitorImpl::parseEvents () {
+    USBCDC_TRACE_SCOPE("parseEvents");
+    static const char kDelimiter[] = "\n\n";
+    for (;;) {
+        if (mEvents.wouldBlock()) {
+            return false;
+        }
+        auto begin = boost::asio::buffers_begin(mBuf.data());
+        auto end = boost::asio::buffers_end(mBuf.data());
+        auto iter = std::search(begin, end, kDelimiter, kDelimiter + 2);
+        if (iter == end) {
+            return true;
+        }
+        auto n = size_t(iter - begin) + 2;
+        if (mParser.parse(mBuf, n, mRecord)) {
+            if (mRecord.action == "move" && mEvents.wouldBlock(2)) {
+                // A rename queues a REMOVE and an ADD, so the record waits until both fit.
+                return false;
+            }
+            applyRecord(mRecord);
+        }
+        mBuf.consume(n);
+    }
+}
+
+template <class CompletionToken>
+inline auto MonitorImpl::asyncSysfsDevices (CompletionToken&& token) {
+    auto coroutine =
+    [ this
+    , devices = DeviceSet{}
+    ](auto&& op, boost::system::error_code ec = {}, size_t = 0) mutable {
+        reenter (op) {
+            yield mStrand.post(std::move(op));
+            {
+                auto cache = DeviceCache{};
+                for (auto& record: sysfsRecords(ec)) {
+                    auto device = toDevice(record);
+                    cache.insert(record.devPath, device, record.devNum);
+                    devices.insert(std::move(device));
+                }
+                if (!ec) { mDevices = std::move(cache); }
+            }
+            op.complete(ec, devices);
+        }
+    };
+
+    return util::asio::asyncDispatch(
+        mContext,
+        std::make_tuple(make_error_code(boost::asio::error::operation_aborted), DeviceSet{}),
+        std::move(coroutine),
+        std::forward<CompletionToken>(token)
+    );
+}
+
+template <class CompletionToken>
+inline auto MonitorImpl::asyncDevicesUntil (std::chrono::steady_clock::time_point deadline,
+        CancellationToken cancel, CompletionToken&& token) {
+    auto coroutine =
+    [ &context = mContext
+    , &worker = mEnumerationWorker
+    , deadline
+    , cancel
+    , result = std::make_shared<std::pair<boost::system::error_code, PartialDeviceSet>>()
+    ](auto&& op, boost::system::error_code = {}, size_t = 0) mutable {
+        reenter (op) {
+            yield {
+                // The worker, not the context's threads, is what waits out a wedged device. Copy
+                // what it needs before `op`, which owns these captures, is moved into it; the job
+                // is a std::function, so `op` is held by a shared_ptr.
+                auto d = deadline;
+                auto c = cancel;
+                auto r = result;
+                auto o = std::make_shared<std::decay_t<decltype(op)>>(std::move(op));
+                worker.post([&context, work = boost::asio::io_service::work(context), d, c, r, o] {
+                    try {
+                        r->second = devices(d, c);
+                    }
+                    catch (const boost::system::system_error& e) {
+                        r->first = e.code();
+                    }
+                    context.post(std::move(*o));
+                });
+            }
+            op.complete(result->first, std::move(result->second));
+        }
+    };
+
+    return util::asio::asyncDispatch(
+        mContext,
+        std::make_tuple(make_error_code(boost::asio::error::operation_aborted), PartialDeviceSet{}),
+        std::move(coroutine),
+        std::forward<CompletionToken>(token)
+    );
+}
+
 template <class CompletionToken>
 inline auto MonitorImpl::asyncDevices (CompletionToken&& token) {
+    // Enumeration primes the event stream, so the event source starts here, before the devices are
+    // listed: an event in between is then delivered rather than lost.
+    mSource->start();
+    if (mSource->backend() != MonitorBackend::UDEVADM) {
+        return asyncSysfsDevices(std::forward<CompletionToken>(token));
+    }
+
     auto p = boost::process::create_pipe();
 
     auto coroutine =
@@ -115,20 +654,27 @@ inline auto MonitorImpl::asyncDevices (CompletionToken&& token) {
     , childStdout = boost::process::pipe_end(mContext, p.source)
     , childProcess = executeUdevadmInfo(mContext, p.sink)
     , buf = std::make_unique<boost::asio::streambuf>()
-    , device = Device{}
+    , parser = UdevadmParser{}
+    , record = UdevRecord{}
+    , cache = DeviceCache{}
     , devices = DeviceSet{}
     ](auto&& op, boost::system::error_code ec = {}, size_t n = 0) mutable {
         reenter (op) {
-            yield boost::asio::async_read_until(childStdout, *buf, "\n\n", std::move(op));
+            yield boost::asio::async_read_until(childStdout, *buf, "\n\n",
+                mStrand.wrap(std::move(op)));
             while (n && !ec) {
-                if (parseUdevadm(*buf, n, device)) {
-                    devices.insert(device);
+                if (parser.parse(*buf, n, record) && record.usbDriver == "cdc_acm") {
+                    auto device = toDevice(record);
+                    cache.insert(record.devPath, device, record.devNum);
+                    devices.insert(std::move(device));
                 }
                 buf->consume(n);
-                yield boost::asio::async_read_until(childStdout, *buf, "\n\n", std::move(op));
+                yield boost::asio::async_read_until(childStdout, *buf, "\n\n",
+                    mStrand.wrap(std::move(op)));
             }
 
             if (!n) { ec = {}; }  // 0-length read means we got an EOF, which means we're done
+            if (!ec) { mDevices = std::move(cache); }
             op.complete(ec, devices);
         }
     };
@@ -140,31 +686,305 @@ inline auto MonitorImpl::asyncDevices (CompletionToken&& token) {
         std::forward<CompletionToken>(token)
     );
 }
+template <class Handler>
+struct MonitorImpl::ReceiveOp {
+    // Receives one event for `asyncReceiveDeviceEvent()`. The operation is its own completion
+    // handler for the strand dispatch, the pipe reads and the final post, so every allocation asio
+    // makes on its behalf comes from `mReceiveMemory`, and the event is moved straight from the
+    // queue into the caller's handler. All of its steps run on the strand.
+    MonitorImpl* self;
+    Handler handler;
+    bool started = false;
+    bool busy = false;
+    // Another operation was outstanding, so this one fails without touching the event source.
+
+    void start () {
+        started = true;
+        if (self->mReceiving) {
+            busy = true;
+            self->mStrand.post(std::move(*this));
+            return;
+        }
+        self->mReceiving = true;
+        self->mSource->start();
+        self->parseEvents();
+        if (self->mEvents.size()) {
+            self->mStrand.post(std::move(*this));
+        }
+        else {
+            read();
+        }
+    }
+
+    void read () {
+        self->mChildStdout.async_read_some(self->mBuf.prepare(kReadSize),
+            self->mStrand.wrap(std::move(*this)));
+    }
+
+    void operator() (boost::system::error_code ec, size_t n) {
+        self->commit(n);
+        if (!ec) {
+            self->parseEvents();
+            if (self->mEvents.empty()) {
+                read();
+                return;
+            }
+        }
+        complete(ec);
+    }
+
+    void operator() () {
+        if (!started) {
+            start();
+        }
+        else if (busy) {
+            complete(boost::asio::error::in_progress);
+        }
+        else {
+            complete({});
+        }
+    }
+
+    void complete (boost::system::error_code ec) {
+        if (!busy) {
+            self->mReceiving = false;
+        }
+        auto event = DeviceEvent{};
+        if (!ec) {
+            event = std::move(self->mEvents.front());
+            self->mEvents.pop();
+        }
+        handler(ec, std::move(event));
+    }
+
+    void* allocate (size_t size) { return self->mReceiveMemory.allocate(size); }
+    void deallocate (void* p) { self->mReceiveMemory.deallocate(p); }
+
+    friend void* asio_handler_allocate (size_t size, ReceiveOp* op) {
+        return op->allocate(size);
+    }
+
+    friend void asio_handler_deallocate (void* p, size_t, ReceiveOp* op) {
+        op->deallocate(p);
+    }
+
+    friend bool asio_handler_is_continuation (ReceiveOp* op) {
+        using boost::asio::asio_handler_is_continuation;
+        return op->started || asio_handler_is_continuation(std::addressof(op->handler));
+    }
+    // There is deliberately no invocation hook forwarding to `handler`'s: the operation's steps
+    // must run on the monitor's strand, not wherever `handler` would run. A strand-wrapped
+    // `handler` still dispatches itself to its own strand when called.
+};
+
 template <class CompletionToken>
 inline auto MonitorImpl::asyncReceiveDeviceEvent (CompletionToken&& token) {
+    boost::asio::async_completion<CompletionToken, void(boost::system::error_code, DeviceEvent)>
+        init{token};
+    using Handler = typename decltype(init)::completion_handler_type;
+    mStrand.dispatch(ReceiveOp<Handler>{this, std::move(init.completion_handler)});
+    return init.result.get();
+}
+
+template <class Predicate, class CompletionToken>
+inline auto MonitorImpl::asyncWaitForDevice (Predicate&& predicate,
+        std::chrono::steady_clock::duration timeout, CompletionToken&& token) {
+    // The deadline is enforced by canceling the pending read on the event source, which no other
+    // operation shares. The operation first hops onto the strand, and arms the timer from there.
     auto coroutine =
     [ this
-    , buf = std::make_unique<boost::asio::streambuf>()
-    , event = DeviceEvent{}
-    , paragraph = std::string{}
+    , timeout
+    , generation = 0u
+    , predicate = std::forward<Predicate>(predicate)
+    , device = Device{}
+    , found = false
+    , busy = false
+    , stalled = false
     ](auto&& op, boost::system::error_code ec = {}, size_t n = 0) mutable {
         reenter (op) {
-            do {
-                buf->consume(n);
-                yield boost::asio::async_read_until(mChildStdout, *buf, "\n\n", std::move(op));
-            } while (!ec && !parseUdevadm(*buf, n, event));
-            op.complete(ec, event);
+            yield mStrand.post(std::move(op));
+            busy = mReceiving;
+            if (busy) {
+                ec = boost::asio::error::in_progress;
+            }
+            else {
+                mReceiving = true;
+                mSource->start();
+                generation = ++mWaitGeneration;
+                mWaitTimer.expires_from_now(timeout);
+                mWaitTimer.async_wait(mStrand.wrap([this, generation](boost::system::error_code ec) {
+                    if (!ec && generation == mWaitGeneration) {
+                        mChildStdout.cancel(ec);
+                    }
+                }));
+
+                {
+                    // `mDevices` reflects every queued event, so this covers both the current
+                    // state and pending ADDs.
+                    stalled = !parseEvents();
+                    auto d = mDevices.findIf(predicate);
+                    if (d) {
+                        device = *d;
+                        found = true;
+                    }
+                }
+                while (!ec && !found) {
+                    if (stalled) {
+                        // The device set cannot advance until the consumer receives some events.
+                        ec = boost::asio::error::no_buffer_space;
+                        break;
+                    }
+                    yield mChildStdout.async_read_some(mBuf.prepare(kReadSize),
+                        mStrand.wrap(std::move(op)));
+                    commit(n);
+                    stalled = !parseEvents();
+                    {
+                        auto d = mDevices.findIf(predicate);
+                        if (d) {
+                            device = *d;
+                            found = true;
+                        }
+                    }
+                }
+                if (ec == boost::asio::error::operation_aborted && generation == mWaitGeneration
+                        && mWaitTimer.expires_from_now().count() <= 0) {
+                    ec = boost::asio::error::timed_out;
+                }
+                ++mWaitGeneration;
+                boost::system::error_code ignored;
+                mWaitTimer.cancel(ignored);
+                mReceiving = false;
+            }
+            op.complete(ec, device);
         }
     };
 
     return util::asio::asyncDispatch(
         mContext,
-        std::make_tuple(make_error_code(boost::asio::error::operation_aborted), DeviceEvent{}),
+        std::make_tuple(make_error_code(boost::asio::error::operation_aborted), Device{}),
         std::move(coroutine),
         std::forward<CompletionToken>(token)
     );
 }
 
+#if USBCDC_HAS_COROUTINES
+
+// =======================================================================================
+// Coroutine interface
+
+class MonitorImpl::DeviceEventAwaiter {
+    // If an event is already queued, `co_await` takes it without suspending. Otherwise the
+    // coroutine suspends directly on readability of the `udevadm` pipe, and is resumed once a read
+    // completes an event record. The coroutine is resumed on the monitor's strand, so only the
+    // first `co_await` from elsewhere needs to hop onto it.
+public:
+    explicit DeviceEventAwaiter (MonitorImpl& self) : mSelf(self) {}
+
+    bool await_ready () {
+        return mSelf.mStrand.running_in_this_thread() && !mSelf.mReceiving
+            && mSelf.tryReceiveDeviceEvent(mEvent);
+    }
+
+    void await_suspend (std::coroutine_handle<> h) {
+        mHandle = h;
+        mSelf.awaitReadable(*this);
+    }
+
+    DeviceEvent await_resume () {
+        boost::asio::detail::throw_error(mEc, "awaitDeviceEvent");
+        return std::move(mEvent);
+    }
+
+private:
+    friend class MonitorImpl;
+
+    MonitorImpl& mSelf;
+    std::coroutine_handle<> mHandle;
+    boost::system::error_code mEc;
+    DeviceEvent mEvent;
+};
+
+struct MonitorImpl::ReadableHandler {
+    // Completion handler for the readiness wait, and for the post onto the strand when a coroutine
+    // first awaits from outside it, allocated from `mReceiveMemory`.
+    MonitorImpl* self;
+    DeviceEventAwaiter* awaiter;
+    // Only set for the post.
+
+    void operator() (boost::system::error_code ec, size_t) { self->onReadable(ec); }
+    void operator() () { self->startAwait(*awaiter); }
+
+    void* allocate (size_t size) { return self->mReceiveMemory.allocate(size); }
+    void deallocate (void* p) { self->mReceiveMemory.deallocate(p); }
+
+    friend void* asio_handler_allocate (size_t size, ReadableHandler* h) {
+        return h->allocate(size);
+    }
+
+    friend void asio_handler_deallocate (void* p, size_t, ReadableHandler* h) {
+        h->deallocate(p);
+    }
+};
+
+inline CompletionAwaiter<DeviceSet> MonitorImpl::awaitDevices () {
+    // Enumeration runs once per monitor, so it simply resumes from `asyncDevices()`'s handler.
+    return CompletionAwaiter<DeviceSet>{[this](auto handler) { asyncDevices(std::move(handler)); }};
+}
+
+inline MonitorImpl::DeviceEventAwaiter MonitorImpl::awaitDeviceEvent () {
+    return DeviceEventAwaiter{*this};
+}
+
+inline void MonitorImpl::awaitReadable (DeviceEventAwaiter& awaiter) {
+    if (mStrand.running_in_this_thread() && !mReceiving) {
+        mReceiving = true;
+        mSource->start();
+        mAwaiter = &awaiter;
+        mChildStdout.async_read_some(boost::asio::null_buffers(),
+            mStrand.wrap(ReadableHandler{this, nullptr}));
+    }
+    else {
+        // Off the strand, or with another operation outstanding, `startAwait()` decides on it.
+        mStrand.post(ReadableHandler{this, &awaiter});
+    }
+}
+
+inline void MonitorImpl::startAwait (DeviceEventAwaiter& awaiter) {
+    if (mReceiving) {
+        awaiter.mEc = boost::asio::error::in_progress;
+        awaiter.mHandle.resume();
+        return;
+    }
+    mReceiving = true;
+    mSource->start();
+    mAwaiter = &awaiter;
+    // `onReadable()` tries a non-blocking read first, which also covers events that were already
+    // queued when the coroutine suspended.
+    onReadable({});
+}
+
+inline void MonitorImpl::onReadable (boost::system::error_code ec) {
+    auto& awaiter = *mAwaiter;
+    if (!ec) {
+        auto n = mChildStdout.read_some(mBuf.prepare(kReadSize), ec);
+        commit(n);
+        if (ec == boost::asio::error::would_block) {
+            ec = {};
+        }
+        if (!ec && !tryReceiveDeviceEvent(awaiter.mEvent)) {
+            mChildStdout.async_read_some(boost::asio::null_buffers(),
+                mStrand.wrap(ReadableHandler{this, nullptr}));
+            return;
+        }
+    }
+    mAwaiter = nullptr;
+    mReceiving = false;
+    awaiter.mEc = ec;
+    awaiter.mHandle.resume();
+}
+
+#endif
+
 class Monitor : public util::asio::TransparentIoObject<MonitorImpl> {
 public:
     explicit Monitor (boost::asio::io_service& context)
@@ -172,7 +992,46 @@ public:
     {}
 
     UTIL_ASIO_DECL_ASYNC_METHOD(asyncDevices)
+    UTIL_ASIO_DECL_ASYNC_METHOD(asyncDevicesUntil)
     UTIL_ASIO_DECL_ASYNC_METHOD(asyncReceiveDeviceEvent)
+    UTIL_ASIO_DECL_ASYNC_METHOD(asyncWaitForDevice)
+
+    MonitorBackend backend () const { return this->get_implementation()->backend(); }
+    // Which backend the monitor chose: UDEVADM if udev is installed, otherwise the first which
+    // works on this host, unless the `USBCDC_MONITOR_BACKEND` environment variable names another.
+    // INOTIFY and POLLING are degraded modes.
+
+    void reconnectWindow (std::chrono::steady_clock::duration w) {
+        // How long after a REMOVE a device with the same stable identity is reported as a
+        // RECONNECT instead of an ADD.
+        this->get_implementation()->reconnectWindow(w);
+    }
+
+    void eventQueueCapacity (size_t c) { this->get_implementation()->eventQueueCapacity(c); }
+    void eventQueuePolicy (EventQueue::Policy p) { this->get_implementation()->eventQueuePolicy(p); }
+    EventQueue::Statistics eventQueueStatistics () const {
+        return this->get_implementation()->eventQueueStatistics();
+    }
+    // Bound the number of events held for `asyncReceiveDeviceEvent()`, and choose what happens
+    // when the bound is reached.
+
+    void preopenPorts (const SerialProfile& profile,
+            size_t prebufferSize = SerialStream::kDefaultPrebufferSize) {
+        // Open every port that appears as soon as it is detected, and attach it to the ADD or
+        // RECONNECT event as `event.stream`. Up to `prebufferSize` bytes the device sends before
+        // the stream is first read are kept for that read. Ports are opened synchronously while
+        // event records are parsed, so a slow open delays the events queued behind it.
+        this->get_implementation()->preopenPorts(profile, prebufferSize);
+    }
+
+#if USBCDC_HAS_COROUTINES
+    auto awaitDevices () { return this->get_implementation()->awaitDevices(); }
+    auto awaitDeviceEvent () { return this->get_implementation()->awaitDeviceEvent(); }
+    // `co_await`able equivalents of `asyncDevices()` and `asyncReceiveDeviceEvent()`, which throw
+    // `boost::system::system_error` on failure. Waiting for an event suspends on the `udevadm`
+    // pipe itself, without allocating an operation or posting a completion per event. The same
+    // ordering rules apply: enumerate first, and have only one receive outstanding at a time.
+#endif
 };
 
 } // usbcdc
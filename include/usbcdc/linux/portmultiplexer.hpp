@@ -0,0 +1,195 @@
+#ifndef USBCDC_LINUX_PORTMULTIPLEXER_HPP
+#define USBCDC_LINUX_PORTMULTIPLEXER_HPP
+
+#include <usbcdc/deviceevent.hpp>
+#include <usbcdc/devices.hpp>
+#include <usbcdc/iocontext.hpp>
+#include <usbcdc/portstatistics.hpp>
+#include <usbcdc/serialstream.hpp>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+
+namespace usbcdc {
+
+class PortMultiplexer {
+    // Owns many opened CDC-ACM ports on a single epoll set, itself registered with one asio
+    // reactor descriptor. Each wake-up drains every ready port into that port's preallocated
+    // receive buffer and hands all of the data to the read handler in one batch, so hundreds of
+    // ports cost one thread and one reactor wake-up per burst rather than one of each per port.
+public:
+    struct PortData {
+        const Device& device;
+        boost::asio::const_buffer data;
+    };
+
+    using ReadHandler = std::function<void(const std::vector<PortData>&)>;
+    // Called once per wake-up with the data read from every port which had any. The buffers are
+    // only valid for the duration of the call.
+
+    using CloseHandler = std::function<void(const Device&, boost::system::error_code)>;
+    // Called when a port is closed because of an error or hangup, e.g. the device was unplugged,
+    // or when `follow()` fails to open a port. Whatever the port sent before the hangup is handed
+    // to the read handler first.
+
+    static constexpr size_t kDefaultBufferSize = 16 * 1024;
+
+    explicit PortMultiplexer (boost::asio::io_service& context,
+            size_t bufferSize = kDefaultBufferSize);
+    ~PortMultiplexer ();
+
+    PortMultiplexer (const PortMultiplexer&) = delete;
+    PortMultiplexer& operator= (const PortMultiplexer&) = delete;
+
+    void onRead (ReadHandler handler) { mReadHandler = std::move(handler); }
+    void onClose (CloseHandler handler) { mCloseHandler = std::move(handler); }
+
+    void add (const Device& device, const SerialProfile& profile, boost::system::error_code& ec);
+    void add (const Device& device, boost::system::error_code& ec) { add(device, {}, ec); }
+    // Open `device` in raw mode and start reading from it.
+
+    void adopt (const Device& device, SerialStream& stream, boost::system::error_code& ec);
+    // Take over `stream`, an open port to `device`, e.g. one which a monitor pre-opened, and
+    // start reading from it. Whatever `stream` prebuffered is handed to the read handler, in a
+    // batch of its own, before anything read later. `stream` is left closed.
+
+    void remove (const std::string& path);
+    // Close the port at `path`, if open. Safe to call from within a handler.
+
+    size_t write (const std::string& path, boost::asio::const_buffer data,
+            boost::system::error_code& ec);
+    // Write as much of `data` to the port at `path` as the tty accepts without blocking.
+
+    size_t size () const { return mPorts.size(); }
+
+    std::shared_ptr<const PortStatistics> statistics (const std::string& path) const;
+    // The I/O counters of the port at `path`, or null if it is not open. Any thread may read
+    // them; they outlive the port. `handlerLatency` runs from the wake-up which found the port
+    // readable to the read handler's call.
+
+    void start ();
+    // Begin waiting for readiness. Call once; the multiplexer keeps itself armed until `close()`.
+
+    void close ();
+
+    template <class Monitor>
+    void follow (Monitor& monitor, std::function<bool(const Device&)> filter = {},
+            SerialProfile profile = {});
+    // Keep the set of open ports in sync with `monitor`: open devices for which `filter` returns
+    // true (or all, if no filter is given) as they are added, and close them as they are removed.
+    // Ports which the monitor pre-opened are adopted rather than opened again. After a RESYNC,
+    // the open ports are reconciled with the monitor's `asyncDevices()`. Call after the monitor's
+    // `asyncDevices()` has completed. Ports for devices already present must be added separately.
+    // Following stops when the monitor fails, or the multiplexer is destroyed.
+
+    void handleEvent (const DeviceEvent& event, const std::function<bool(const Device&)>& filter,
+            const SerialProfile& profile);
+    // Apply one monitor event, as `follow()` does, except that a RESYNC is reconciled with
+    // `devices()`, which blocks while the system is enumerated, and throws as it does.
+
+    void reconcile (const DeviceSet& present, const std::function<bool(const Device&)>& filter,
+            const SerialProfile& profile);
+    // Close the ports whose devices are not in `present`, including any added by hand, and open
+    // those devices in `present` which `filter` accepts and which are not open yet.
+
+private:
+    struct Port {
+        Device device;
+        int fd;
+        std::vector<char> buffer;
+        size_t filled;
+        bool closed;
+        std::shared_ptr<PortStatistics> statistics;
+        boost::system::error_code hangup;
+        // Set when a read hit EOF or an error, to close the port once its data is delivered.
+    };
+
+    template <class Monitor>
+    void resync (Monitor& monitor, std::function<bool(const Device&)> filter,
+            SerialProfile profile);
+
+    void open (const Device& device, const std::function<bool(const Device&)>& filter,
+            const SerialProfile& profile, SerialStream* stream);
+    // Add, or adopt `stream` if it is not null, if `filter` accepts `device`. Failures go to the
+    // close handler.
+
+    void insert (const Device& device, int fd, std::vector<char> pending,
+            boost::system::error_code& ec);
+    // Start reading from `fd`, with `pending` already read. Takes ownership of `fd`.
+
+    void deliverPending (const std::string& path, PortStatistics::Clock::time_point adopted);
+
+    void arm ();
+    void onReady (boost::system::error_code ec);
+    void drain (Port& port, PortStatistics::Clock::time_point now);
+    void closePort (Port& port, boost::system::error_code ec);
+
+    boost::asio::posix::stream_descriptor mEpoll;
+    size_t mBufferSize;
+
+    std::unordered_map<std::string, std::unique_ptr<Port>> mPorts;
+    std::vector<std::unique_ptr<Port>> mGraveyard;
+    // Ports closed during a wake-up. The epoll events already fetched may still point to them, so
+    // they are only destroyed once the wake-up is finished.
+
+    std::vector<epoll_event> mEvents;
+    std::vector<Port*> mReady;
+    std::vector<PortData> mBatch;
+
+    ReadHandler mReadHandler;
+    CloseHandler mCloseHandler;
+    bool mArmed = false;
+    std::shared_ptr<char> mLifetime = std::make_shared<char>();
+    // The pending readiness handler, and `follow()`'s, hold a weak reference, so that they can
+    // tell whether the multiplexer was destroyed before they ran.
+};
+
+template <class Monitor>
+inline void PortMultiplexer::follow (Monitor& monitor, std::function<bool(const Device&)> filter,
+        SerialProfile profile) {
+    monitor.asyncReceiveDeviceEvent(
+        [this, lifetime = std::weak_ptr<char>(mLifetime), &monitor, filter = std::move(filter),
+            profile]
+        (boost::system::error_code ec, const DeviceEvent& event) mutable {
+            if (ec || lifetime.expired()) {
+                return;
+            }
+            if (event.type == DeviceEvent::RESYNC) {
+                resync(monitor, std::move(filter), profile);
+                return;
+            }
+            handleEvent(event, filter, profile);
+            follow(monitor, std::move(filter), profile);
+        });
+}
+
+template <class Monitor>
+inline void PortMultiplexer::resync (Monitor& monitor, std::function<bool(const Device&)> filter,
+        SerialProfile profile) {
+    // Events were lost, so catch up with what the monitor finds present now.
+    monitor.asyncDevices(
+        [this, lifetime = std::weak_ptr<char>(mLifetime), &monitor, filter = std::move(filter),
+            profile]
+        (boost::system::error_code ec, const DeviceSet& present) mutable {
+            if (ec || lifetime.expired()) {
+                return;
+            }
+            reconcile(present, filter, profile);
+            follow(monitor, std::move(filter), profile);
+        });
+}
+
+} // namespace usbcdc
+
+#endif
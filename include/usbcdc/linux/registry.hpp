@@ -0,0 +1,373 @@
+#ifndef USBCDC_LINUX_REGISTRY_HPP
+#define USBCDC_LINUX_REGISTRY_HPP
+
+#include <util/asio/asynccompletion.hpp>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/detail/throw_error.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include <usbcdc/coroutine.hpp>
+#include <usbcdc/deviceevent.hpp>
+#include <usbcdc/devices.hpp>
+#include <usbcdc/iocontext.hpp>
+#include <usbcdc/linux/devicetable.hpp>
+#include <usbcdc/linux/monitor.hpp>
+
+#include <util/log.hpp>
+
+#include <boost/asio/yield.hpp>
+
+#include <cerrno>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace usbcdc {
+
+// Where `usbcdcd` publishes its device table, and where it accepts subscribers.
+constexpr const char* kDefaultRegistryTable = "/usbcdcd";
+constexpr const char* kDefaultRegistrySocket = "/run/usbcdcd.sock";
+
+class RegistryLock {
+    // An exclusive `flock()` on the file at `path`, created if need be, held until destruction.
+    // Throws `boost::system::system_error` if another process holds it.
+public:
+    explicit RegistryLock (const std::string& path);
+    ~RegistryLock () { ::close(mFd); }
+
+    RegistryLock (const RegistryLock&) = delete;
+    RegistryLock& operator= (const RegistryLock&) = delete;
+
+private:
+    int mFd;
+};
+
+class RegistryServer {
+    // Publishes the devices a monitor sees to a shared-memory device table, so that any number of
+    // processes can share one monitor. Each time the table changes, every subscriber connected to
+    // the unix socket at `socketPath` is sent the new generation, as a native-endian uint64_t.
+    // Notices are coalesced: a slow subscriber is only ever sent the latest generation.
+    //
+    // Only one server may use a socket path at a time. The constructor locks `<socketPath>.lock`
+    // before it touches the socket or the table, and throws `boost::system::system_error` if
+    // another server holds the lock.
+    //
+    // Run `context` from one thread.
+public:
+    RegistryServer (boost::asio::io_service& context, MonitorImpl& monitor,
+            const std::string& table = kDefaultRegistryTable,
+            const std::string& socketPath = kDefaultRegistrySocket);
+    ~RegistryServer ();
+
+    void start ();
+    // Enumerate devices and publish them, then keep the table up to date with the monitor's
+    // events. Subscribers are accepted from construction.
+
+    void close ();
+    // Stop accepting subscribers and disconnect those connected. Close the monitor as well to stop
+    // following its events.
+
+    void onMonitorFailure (std::function<void(boost::system::error_code)> handler) {
+        mMonitorFailureHandler = std::move(handler);
+    }
+    // Called if the monitor fails. The table can no longer follow the system's devices, so the
+    // server closes first: subscribers' waits fail with end of file, and new clients cannot
+    // connect. `usbcdcd` exits with an error, so that its supervisor restarts it.
+
+    uint64_t generation () const { return mTable.generation(); }
+    size_t subscribers () const { return mSubscribers.size(); }
+
+private:
+    struct Subscriber {
+        explicit Subscriber (boost::asio::io_service& context) : socket(context) {}
+        boost::asio::local::stream_protocol::socket socket;
+        uint64_t notice = 0;
+        bool writing = false;
+    };
+
+    void accept ();
+    void enumerate ();
+    void receive ();
+    void apply (const DeviceEvent& event);
+    void publish ();
+    void notify (std::shared_ptr<Subscriber> subscriber);
+
+    MonitorImpl& mMonitor;
+    RegistryLock mLock;
+    DeviceTableWriter mTable;
+    std::string mSocketPath;
+    boost::asio::local::stream_protocol::acceptor mAcceptor;
+    DeviceSet mDevices;
+    std::list<std::shared_ptr<Subscriber>> mSubscribers;
+    std::function<void(boost::system::error_code)> mMonitorFailureHandler;
+
+    std::shared_ptr<char> mLifetime = std::make_shared<char>();
+    // Handlers hold a weak_ptr to this, so that they can tell the server was destroyed.
+};
+
+class RegistryClient {
+    // Reads the device table a RegistryServer publishes. Reading the table makes no system calls;
+    // only waiting for it to change touches the server's socket.
+public:
+    RegistryClient (boost::asio::io_service& context,
+            const std::string& table = kDefaultRegistryTable,
+            const std::string& socketPath = kDefaultRegistrySocket);
+    // Throw `boost::system::system_error` if no server is running.
+
+    void close (boost::system::error_code& ec) { mSocket.close(ec); }
+
+    uint64_t generation () const { return mTable.generation(); }
+
+    uint64_t devices (DeviceSet& devices) { return mTable.read(devices); }
+    // Copy the current table into `devices`, and return its generation.
+
+    template <class CompletionToken>
+    auto asyncWaitForChange (uint64_t seen, CompletionToken&& token);
+    // Complete with `(boost::system::error_code, uint64_t generation)` once the table's
+    // generation is greater than `seen`. Fails with `boost::asio::error::eof` if the server goes
+    // away. Only one wait may be outstanding at a time.
+
+private:
+    boost::asio::io_service& mContext;
+    DeviceTableReader mTable;
+    boost::asio::local::stream_protocol::socket mSocket;
+    uint64_t mNotice = 0;
+};
+
+// =======================================================================================
+// Inline implementation
+
+inline RegistryLock::RegistryLock (const std::string& path)
+    : mFd(::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644))
+{
+    auto ec = boost::system::error_code{};
+    if (mFd < 0) {
+        ec = {errno, boost::system::system_category()};
+    }
+    else if (::flock(mFd, LOCK_EX | LOCK_NB)) {
+        ec = errno == EWOULDBLOCK
+            ? make_error_code(boost::system::errc::device_or_resource_busy)
+            : boost::system::error_code{errno, boost::system::system_category()};
+        ::close(mFd);
+    }
+    boost::asio::detail::throw_error(ec, ("lock " + path).c_str());
+}
+
+inline RegistryServer::RegistryServer (boost::asio::io_service& context, MonitorImpl& monitor,
+        const std::string& table, const std::string& socketPath)
+    : mMonitor(monitor)
+    , mLock(socketPath + ".lock")
+    , mTable(table)
+    , mSocketPath(socketPath)
+    , mAcceptor(context)
+{
+    // A previous server may have left its socket behind. It cannot still be running: we hold the
+    // lock.
+    ::unlink(socketPath.c_str());
+    auto endpoint = boost::asio::local::stream_protocol::endpoint{socketPath};
+    mAcceptor.open(endpoint.protocol());
+    mAcceptor.bind(endpoint);
+    ::chmod(socketPath.c_str(), 0666);
+    mAcceptor.listen();
+    mTable.publish(mDevices);
+    accept();
+}
+
+inline RegistryServer::~RegistryServer () {
+    close();
+    ::unlink(mSocketPath.c_str());
+}
+
+inline void RegistryServer::start () {
+    enumerate();
+}
+
+inline void RegistryServer::close () {
+    auto ec = boost::system::error_code{};
+    mAcceptor.close(ec);
+    for (auto& subscriber: mSubscribers) {
+        subscriber->socket.close(ec);
+    }
+    mSubscribers.clear();
+}
+
+inline void RegistryServer::accept () {
+    auto subscriber = std::make_shared<Subscriber>(ioContext(mAcceptor));
+    mAcceptor.async_accept(subscriber->socket,
+    [this, subscriber, lifetime = std::weak_ptr<char>(mLifetime)](boost::system::error_code ec) {
+        if (lifetime.expired() || ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+        if (ec) {
+            util::log::Logger lg;
+            BOOST_LOG(lg) << "Registry could not accept a subscriber: " << ec.message();
+        }
+        else {
+            mSubscribers.push_back(subscriber);
+            notify(subscriber);
+        }
+        accept();
+    });
+}
+
+inline void RegistryServer::enumerate () {
+    mMonitor.asyncDevices(
+    [this, lifetime = std::weak_ptr<char>(mLifetime)](boost::system::error_code ec,
+            DeviceSet devices) {
+        if (lifetime.expired() || ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+        if (ec) {
+            // Keep following events: the table will be incomplete, but not wrong.
+            util::log::Logger lg;
+            BOOST_LOG(lg) << "Registry could not enumerate devices: " << ec.message();
+        }
+        else {
+            mDevices = std::move(devices);
+        }
+        publish();
+        receive();
+    });
+}
+
+inline void RegistryServer::receive () {
+    mMonitor.asyncReceiveDeviceEvent(
+    [this, lifetime = std::weak_ptr<char>(mLifetime)](boost::system::error_code ec,
+            DeviceEvent event) {
+        if (lifetime.expired() || ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+        if (ec) {
+            util::log::Logger lg;
+            BOOST_LOG(lg) << "Registry stopped following the monitor: " << ec.message();
+            close();
+            if (mMonitorFailureHandler) {
+                mMonitorFailureHandler(ec);
+            }
+            return;
+        }
+        if (event.type == DeviceEvent::RESYNC) {
+            enumerate();
+            return;
+        }
+        apply(event);
+        publish();
+        receive();
+    });
+}
+
+inline void RegistryServer::apply (const DeviceEvent& event) {
+    auto erase = [this](const std::string& path) {
+        for (auto i = mDevices.begin(); i != mDevices.end(); ++i) {
+            if (i->path() == path) {
+                mDevices.erase(i);
+                return;
+            }
+        }
+    };
+    switch (event.type) {
+        case DeviceEvent::ADD:
+            erase(event.device.path());
+            mDevices.insert(event.device);
+            break;
+        case DeviceEvent::REMOVE:
+            erase(event.device.path());
+            break;
+        case DeviceEvent::RECONNECT:
+            erase(event.previousPath);
+            erase(event.device.path());
+            mDevices.insert(event.device);
+            break;
+        default:
+            break;
+    }
+}
+
+inline void RegistryServer::publish () {
+    mTable.publish(mDevices);
+    for (auto& subscriber: mSubscribers) {
+        notify(subscriber);
+    }
+}
+
+inline void RegistryServer::notify (std::shared_ptr<Subscriber> subscriber) {
+    if (subscriber->writing) {
+        // The write's completion will send the latest generation.
+        return;
+    }
+    subscriber->writing = true;
+    subscriber->notice = mTable.generation();
+    boost::asio::async_write(subscriber->socket,
+        boost::asio::buffer(&subscriber->notice, sizeof(subscriber->notice)),
+    [this, subscriber, lifetime = std::weak_ptr<char>(mLifetime)](boost::system::error_code ec,
+            size_t) {
+        subscriber->writing = false;
+        if (lifetime.expired()) {
+            return;
+        }
+        if (ec) {
+            // The subscriber went away, or the server closed.
+            mSubscribers.remove(subscriber);
+            return;
+        }
+        if (subscriber->notice != mTable.generation()) {
+            notify(subscriber);
+        }
+    });
+}
+
+inline RegistryClient::RegistryClient (boost::asio::io_service& context,
+        const std::string& table, const std::string& socketPath)
+    : mContext(context)
+    , mTable(table)
+    , mSocket(context)
+{
+    mSocket.connect(boost::asio::local::stream_protocol::endpoint{socketPath});
+}
+
+template <class CompletionToken>
+inline auto RegistryClient::asyncWaitForChange (uint64_t seen, CompletionToken&& token) {
+    auto coroutine =
+    [ this
+    , seen
+    , generation = uint64_t(0)
+    ](auto&& op, boost::system::error_code ec = {}, size_t = 0) mutable {
+        reenter (op) {
+            generation = mTable.generation();
+            if (generation > seen) {
+                yield mContext.post(std::move(op));
+            }
+            while (!ec && generation <= seen) {
+                // Notices may be stale; the table is the authority.
+                yield boost::asio::async_read(mSocket,
+                    boost::asio::buffer(&mNotice, sizeof(mNotice)), std::move(op));
+                generation = mTable.generation();
+            }
+            op.complete(ec, generation);
+        }
+    };
+
+    return util::asio::asyncDispatch(
+        mContext,
+        std::make_tuple(make_error_code(boost::asio::error::operation_aborted), uint64_t(0)),
+        std::move(coroutine),
+        std::forward<CompletionToken>(token)
+    );
+}
+
+} // usbcdc
+
+#include <boost/asio/unyield.hpp>
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef USBCDC_MONITORBACKEND_HPP
+#define USBCDC_MONITORBACKEND_HPP
+
+#include <iostream>
+#include <string>
+
+namespace usbcdc {
+
+enum class MonitorBackend {
+    NETLINK,
+    // Kernel uevents read directly from a netlink socket, with device properties read from sysfs.
+    // Needs no helper programs, but events arrive before udev has processed them, so a device
+    // node may briefly keep its default permissions; chosen by default only where udev is not
+    // installed. Unavailable outside the initial user namespace, where no uevents are delivered.
+    UDEVADM,
+    // `udevadm monitor` run as a child process, with properties from the udev database.
+    INOTIFY,
+    // Creation and deletion of nodes in /dev, with properties read from sysfs.
+    POLLING
+    // Periodic rescans of the system's devices. Works everywhere, but only notices changes at the
+    // poll interval.
+};
+
+inline const char* monitorBackendName (MonitorBackend backend) {
+    switch (backend) {
+        case MonitorBackend::NETLINK: return "netlink";
+        case MonitorBackend::UDEVADM: return "udevadm";
+        case MonitorBackend::INOTIFY: return "inotify";
+        case MonitorBackend::POLLING: return "polling";
+    }
+    return "unknown";
+}
+
+inline bool parseMonitorBackend (const std::string& name, MonitorBackend& backend) {
+    // The inverse of `monitorBackendName()`. Return false if `name` names no backend.
+    for (auto b: {MonitorBackend::NETLINK, MonitorBackend::UDEVADM,
+            MonitorBackend::INOTIFY, MonitorBackend::POLLING}) {
+        if (name == monitorBackendName(b)) {
+            backend = b;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline std::ostream& operator<< (std::ostream& os, MonitorBackend backend) {
+    return os << monitorBackendName(backend);
+}
+
+} // usbcdc
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef USBCDC_POLLSCHEDULE_HPP
+#define USBCDC_POLLSCHEDULE_HPP
+
+#include <chrono>
+#include <cstdint>
+
+namespace usbcdc {
+
+class PollSchedule {
+    // Decides when a polling monitor next enumerates devices. Right after a change, or after a
+    // consumer starts waiting for a device, a device is likely to (re)appear soon, so the monitor
+    // polls every `minimum` for `fastWindow`. After that, each poll which finds nothing new
+    // multiplies the interval by `backoff`, up to `maximum`.
+    //
+    // The schedule never reads the clock itself: every call is given the current time, so it can
+    // be driven by a simulated clock.
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Statistics {
+        uint64_t polls = 0;
+        uint64_t changes = 0;
+        // Polls which found a difference.
+        uint64_t fastPolls = 0;
+        // Polls scheduled at the minimum interval because they fell within a fast window.
+        uint64_t wakes = 0;
+        // Times a consumer opened a fast window.
+        Clock::duration interval = Clock::duration::zero();
+        // The interval until the next poll.
+    };
+
+    static constexpr std::chrono::milliseconds kDefaultMinimum{100};
+    static constexpr std::chrono::milliseconds kDefaultMaximum{2000};
+    static constexpr std::chrono::milliseconds kDefaultFastWindow{5000};
+    static constexpr double kDefaultBackoff = 2;
+
+    PollSchedule ();
+
+    void minimum (Clock::duration d);
+    Clock::duration minimum () const { return mMinimum; }
+    void maximum (Clock::duration d);
+    Clock::duration maximum () const { return mMaximum; }
+    // The interval is clamped to [minimum, maximum]. Setting either resets it to the minimum.
+
+    void fastWindow (Clock::duration d) { mFastWindow = d; }
+    Clock::duration fastWindow () const { return mFastWindow; }
+    // How long to keep polling at the minimum interval after a change or a wake.
+
+    void backoff (double factor) { mBackoff = factor < 1 ? 1 : factor; }
+    double backoff () const { return mBackoff; }
+    // What to multiply the interval by after each quiet poll outside a fast window. 1 polls at a
+    // fixed `minimum`.
+
+    void polled (Clock::time_point now, bool changed);
+    // Record a poll at `now`, and whether it found any difference.
+
+    void wake (Clock::time_point now);
+    // A consumer is waiting for a device: poll at the minimum interval, starting from the last
+    // poll, for the next `fastWindow`.
+
+    Clock::time_point next () const { return mLastPoll + mStatistics.interval; }
+    // When the next poll is due. May be in the past.
+
+    const Statistics& statistics () const { return mStatistics; }
+
+private:
+    Clock::duration mMinimum = kDefaultMinimum;
+    Clock::duration mMaximum = kDefaultMaximum;
+    Clock::duration mFastWindow = kDefaultFastWindow;
+    double mBackoff = kDefaultBackoff;
+
+    Clock::time_point mLastPoll;
+    Clock::time_point mFastUntil;
+    Statistics mStatistics;
+};
+
+} // namespace usbcdc
+
+#endif
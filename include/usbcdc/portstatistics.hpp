@@ -0,0 +1,151 @@
+#ifndef USBCDC_PORTSTATISTICS_HPP
+#define USBCDC_PORTSTATISTICS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace usbcdc {
+
+inline void bump (std::atomic<uint64_t>& counter, uint64_t n) {
+    // Add to a counter which only one thread writes at a time. A plain load and store is enough
+    // then, and costs no locked instruction; readers on other threads still see whole values.
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+class Log2Histogram {
+    // Counts values in power-of-two buckets: bucket 0 holds 0, bucket `i` holds [2^(i-1), 2^i),
+    // and the last bucket also holds everything larger. Recording is a single-writer `bump()`;
+    // any thread may read.
+public:
+    static constexpr size_t kBuckets = 24;
+
+    void record (uint64_t value) { bump(mCounts[std::min(bucket(value), kBuckets - 1)], 1); }
+
+    uint64_t count (size_t i) const { return mCounts[i].load(std::memory_order_relaxed); }
+
+    uint64_t total () const {
+        auto sum = uint64_t(0);
+        for (auto& c: mCounts) {
+            sum += c.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    uint64_t percentile (double p) const {
+        // The upper bound of the bucket holding the `p`th fraction of the values (0 < p <= 1),
+        // or 0 if there are none.
+        auto target = uint64_t(p * total());
+        auto sum = uint64_t(0);
+        for (size_t i = 0; i < kBuckets; ++i) {
+            sum += count(i);
+            if (sum && sum >= target) {
+                return i ? (uint64_t(1) << i) - 1 : 0;
+            }
+        }
+        return 0;
+    }
+
+    static uint64_t lowerBound (size_t i) { return i ? uint64_t(1) << (i - 1) : 0; }
+
+private:
+    static size_t bucket (uint64_t value) {
+#if defined(__GNUC__)
+        return value ? size_t(64 - __builtin_clzll(value)) : 0;
+#else
+        auto i = size_t(0);
+        for (; value; value >>= 1) {
+            ++i;
+        }
+        return i;
+#endif
+    }
+
+    std::atomic<uint64_t> mCounts[kBuckets] = {};
+};
+
+struct PortStatistics {
+    // Counters for one opened port, updated by the port's I/O and readable from any other thread
+    // at any time, e.g. by a monitoring thread's `StallDetector`. Reads and writes each update
+    // their own counters, and asio only ever has one read and one write in flight on a stream,
+    // so each counter has a single writer and needs no lock. Counters accumulate across reopens.
+    using Clock = std::chrono::steady_clock;
+
+    std::atomic<bool> open{false};
+
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+
+    Log2Histogram readSizes;
+    Log2Histogram writeSizes;
+    // Bytes per read from, and per write to, the port.
+
+    Log2Histogram handlerLatency;
+    // Microseconds from when a read could proceed to when its handler ran. For a
+    // `PortMultiplexer`, this runs from the wake-up which found the port readable. For a
+    // `SerialStream`, asio does not expose the moment its reactor sees the port readable, so this
+    // runs from the read being issued, and so includes any wait for input.
+
+    std::atomic<uint64_t> queued{0};
+    std::atomic<uint64_t> maxQueued{0};
+    // Bytes received from the port which its owner has not yet been handed: a `SerialStream`'s
+    // prebuffer, or a `PortMultiplexer` batch not yet delivered.
+
+    std::atomic<Clock::rep> openedAt{0};
+    std::atomic<Clock::rep> lastInput{0};
+    std::atomic<Clock::rep> lastOutput{0};
+    // `Clock` ticks since its epoch. `lastInput` starts out at `openedAt`.
+
+    Clock::duration sinceLastInput (Clock::time_point now = Clock::now()) const {
+        // How long since the port last received a byte, or since it was opened if it never has.
+        return now - Clock::time_point{Clock::duration{lastInput.load(std::memory_order_relaxed)}};
+    }
+
+    // Recording, by the port's owner:
+
+    void opened (Clock::time_point now) {
+        auto t = now.time_since_epoch().count();
+        openedAt.store(t, std::memory_order_relaxed);
+        lastInput.store(t, std::memory_order_relaxed);
+        open.store(true, std::memory_order_release);
+    }
+
+    void closed () {
+        open.store(false, std::memory_order_release);
+        queued.store(0, std::memory_order_relaxed);
+    }
+
+    void received (size_t n, Clock::time_point now) {
+        if (n) {
+            bump(bytesIn, n);
+            readSizes.record(n);
+            lastInput.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+    }
+
+    void sent (size_t n, Clock::time_point now) {
+        if (n) {
+            bump(bytesOut, n);
+            writeSizes.record(n);
+            lastOutput.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+    }
+
+    void handled (Clock::time_point ready, Clock::time_point now) {
+        handlerLatency.record(uint64_t(
+            std::chrono::duration_cast<std::chrono::microseconds>(now - ready).count()));
+    }
+
+    void queue (uint64_t n) {
+        queued.store(n, std::memory_order_relaxed);
+        if (n > maxQueued.load(std::memory_order_relaxed)) {
+            maxQueued.store(n, std::memory_order_relaxed);
+        }
+    }
+};
+
+} // namespace usbcdc
+
+#endif
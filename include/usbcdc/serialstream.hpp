@@ -0,0 +1,396 @@
+#ifndef USBCDC_SERIALSTREAM_HPP
+#define USBCDC_SERIALSTREAM_HPP
+
+#include <usbcdc/devices.hpp>
+#include <usbcdc/iocontext.hpp>
+#include <usbcdc/portstatistics.hpp>
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/version.hpp>
+#include <boost/asio/detail/bind_handler.hpp>
+#include <boost/asio/detail/handler_alloc_helpers.hpp>
+#include <boost/asio/detail/handler_cont_helpers.hpp>
+#include <boost/asio/detail/handler_invoke_helpers.hpp>
+
+#include <boost/predef.h>
+
+#if BOOST_OS_WINDOWS
+#include <boost/asio/serial_port.hpp>
+#else
+#include <boost/asio/posix/stream_descriptor.hpp>
+#endif
+
+#include <boost/system/error_code.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace usbcdc {
+
+struct SerialProfile {
+    // How an opened port trades CPU for latency. Every profile uses raw mode with VMIN=1/VTIME=0.
+    // Readiness notification is always edge-triggered: asio's epoll reactor registers descriptors
+    // with EPOLLET.
+
+    bool lowLatency = false;
+    // Set ASYNC_LOW_LATENCY on the port, asking the driver to hand received bytes to the tty
+    // layer immediately instead of batching them. Linux only; silently ignored by drivers which
+    // do not support it, cdc_acm among them.
+
+    std::chrono::nanoseconds spinBudget{0};
+    // If nonzero, each `async_read_some()` first busy-polls the port with non-blocking reads for
+    // up to this long before parking on the reactor. This burns a core while waiting, but skips
+    // the reactor wake-up when a reply is expected within the budget. The spin runs in a posted
+    // continuation, so `async_read_some()` itself returns at once, but it occupies the thread
+    // which runs it: only use a spin budget on an io_service whose threads serve nothing else.
+    // Synchronous reads and writes block as usual.
+
+    static SerialProfile lowLatencyProfile (
+            std::chrono::nanoseconds spin = std::chrono::microseconds{50}) {
+        auto p = SerialProfile{};
+        p.lowLatency = true;
+        p.spinBudget = spin;
+        return p;
+    }
+};
+
+class SerialStream {
+    // A CDC-ACM serial port opened from a `Device`, in raw mode. Models asio's AsyncReadStream and
+    // AsyncWriteStream: reads and writes go directly to and from the caller's buffers, without
+    // any intermediate copy. Every read and write is counted in `statistics()`.
+public:
+#if BOOST_OS_WINDOWS
+    using next_layer_type = boost::asio::serial_port;
+#else
+    using next_layer_type = boost::asio::posix::stream_descriptor;
+#endif
+    using native_handle_type = next_layer_type::native_handle_type;
+
+    explicit SerialStream (boost::asio::io_service& context)
+        : mStream(context)
+        , mPrebufferWatch(context)
+    {}
+
+    ~SerialStream () {
+        stopPrebuffering();
+        mStatistics->closed();
+    }
+
+    boost::asio::io_service& get_io_service () { return ioContext(mStream); }
+
+#if BOOST_ASIO_VERSION >= 101100
+    using executor_type = next_layer_type::executor_type;
+    executor_type get_executor () { return mStream.get_executor(); }
+#endif
+
+    void open (const Device& device, const SerialProfile& profile, boost::system::error_code& ec);
+    void open (const Device& device, const SerialProfile& profile = {});
+    void open (const Device& device, boost::system::error_code& ec) { open(device, {}, ec); }
+    // Open `device.path()` and configure it for raw binary I/O: no line discipline processing, no
+    // echo, no flow control, 8N1. Any stale input or output is discarded.
+
+    const SerialProfile& profile () const { return mProfile; }
+
+    std::shared_ptr<const PortStatistics> statistics () const { return mStatistics; }
+    // The port's I/O counters, which any thread may read while the port is in use, e.g. to feed
+    // a `StallDetector`. They outlive the stream, and accumulate across reopens.
+
+    void prebuffer (size_t limit = kDefaultPrebufferSize);
+    // Start reading the open port into an internal buffer of at most `limit` bytes, so that
+    // nothing the device sends is lost before the stream's owner gets around to reading it. The
+    // first `read_some()` or `async_read_some()` stops prebuffering, and reads return the
+    // buffered bytes before any newer ones. Once the buffer is full, further input waits in the
+    // driver. The prebuffer is filled by a handler which may run on any of the io_service's
+    // threads, concurrently with the owner's operations. Not supported on Windows, where this
+    // does nothing.
+
+    size_t prebuffered () const {
+        // The number of prebuffered bytes not yet read.
+        std::lock_guard<std::mutex> lock{mPrebuffer->mutex};
+        return mPrebuffer->unread();
+    }
+
+    static constexpr size_t kDefaultPrebufferSize = 4096;
+
+    bool is_open () const { return mStream.is_open(); }
+
+    void close (boost::system::error_code& ec) {
+        discardPrebuffer();
+        mStatistics->closed();
+        mStream.close(ec);
+    }
+    void close () {
+        discardPrebuffer();
+        mStatistics->closed();
+        mStream.close();
+    }
+
+    void cancel (boost::system::error_code& ec) { mStream.cancel(ec); }
+
+    native_handle_type native_handle () { return mStream.native_handle(); }
+    next_layer_type& next_layer () { return mStream; }
+
+#if !BOOST_OS_WINDOWS
+    native_handle_type release () {
+        // Stop prebuffering, and hand the open port's descriptor over to the caller, who must close
+        // it. Bytes already prebuffered stay readable through `read_some()` until `prebuffered()`
+        // is 0. Not available on Windows.
+        stopPrebuffering();
+        mStatistics->closed();
+        return mStream.release();
+    }
+#endif
+
+    template <class MutableBufferSequence>
+    size_t read_some (const MutableBufferSequence& buffers, boost::system::error_code& ec) {
+        // Once prebuffering has stopped, only the owner touches the prebuffer.
+        stopPrebuffering();
+        if (mPrebuffer->unread()) {
+            ec = {};
+            return takePrebuffered(buffers);
+        }
+        auto n = blocking([&] { return mStream.read_some(buffers, ec); }, READ, ec);
+        mStatistics->received(n, PortStatistics::Clock::now());
+        return n;
+    }
+
+    template <class ConstBufferSequence>
+    size_t write_some (const ConstBufferSequence& buffers, boost::system::error_code& ec) {
+        auto n = blocking([&] { return mStream.write_some(buffers, ec); }, WRITE, ec);
+        mStatistics->sent(n, PortStatistics::Clock::now());
+        return n;
+    }
+
+    template <class MutableBufferSequence, class ReadHandler>
+    auto async_read_some (const MutableBufferSequence& buffers, ReadHandler&& handler) {
+        stopPrebuffering();
+        boost::asio::async_completion<ReadHandler, void(boost::system::error_code, size_t)>
+            init{handler};
+        auto issued = PortStatistics::Clock::now();
+        if (mPrebuffer->unread()) {
+            auto n = takePrebuffered(buffers);
+            get_io_service().post(boost::asio::detail::bind_handler(
+                counting(std::move(init.completion_handler), PREBUFFERED_READ, issued),
+                boost::system::error_code{}, n));
+            return init.result.get();
+        }
+        if (mProfile.spinBudget.count()) {
+            get_io_service().post(SpinRead<MutableBufferSequence,
+                decltype(counting(std::move(init.completion_handler), READ, issued))>{
+                    this, mLifetime, buffers,
+                    counting(std::move(init.completion_handler), READ, issued),
+                    issued + mProfile.spinBudget});
+            return init.result.get();
+        }
+        mStream.async_read_some(buffers,
+            counting(std::move(init.completion_handler), READ, issued));
+        return init.result.get();
+    }
+
+    template <class ConstBufferSequence, class WriteHandler>
+    auto async_write_some (const ConstBufferSequence& buffers, WriteHandler&& handler) {
+        boost::asio::async_completion<WriteHandler, void(boost::system::error_code, size_t)>
+            init{handler};
+        mStream.async_write_some(buffers, counting(std::move(init.completion_handler), WRITE,
+            PortStatistics::Clock::now()));
+        return init.result.get();
+    }
+
+private:
+    enum Operation { READ, PREBUFFERED_READ, WRITE };
+
+    template <class Handler>
+    struct CountingHandler {
+        // Records a completed operation in the stream's statistics, then calls `handler`. It
+        // allocates, and runs, wherever `handler` would.
+        Handler handler;
+        std::shared_ptr<PortStatistics> statistics;
+        Operation operation;
+        PortStatistics::Clock::time_point issued;
+
+        void operator() (boost::system::error_code ec, size_t n) {
+            auto now = PortStatistics::Clock::now();
+            if (operation == WRITE) {
+                statistics->sent(n, now);
+            }
+            else {
+                // Prebuffered bytes were counted when they were read from the port.
+                if (operation == READ) {
+                    statistics->received(n, now);
+                }
+                statistics->handled(issued, now);
+            }
+            handler(ec, n);
+        }
+
+        friend void* asio_handler_allocate (size_t size, CountingHandler* h) {
+            return boost_asio_handler_alloc_helpers::allocate(size, h->handler);
+        }
+
+        friend void asio_handler_deallocate (void* p, size_t size, CountingHandler* h) {
+            boost_asio_handler_alloc_helpers::deallocate(p, size, h->handler);
+        }
+
+        friend bool asio_handler_is_continuation (CountingHandler* h) {
+            return boost_asio_handler_cont_helpers::is_continuation(h->handler);
+        }
+
+        template <class Function>
+        friend void asio_handler_invoke (Function&& f, CountingHandler* h) {
+            boost_asio_handler_invoke_helpers::invoke(f, h->handler);
+        }
+    };
+
+    template <class MutableBufferSequence, class Handler>
+    struct SpinRead {
+        // Busy-polls the port until `deadline`, then parks the read on the reactor. Like the
+        // `CountingHandler` it wraps, it allocates, and runs, wherever the caller's handler would.
+        SerialStream* self;
+        std::weak_ptr<char> lifetime;
+        MutableBufferSequence buffers;
+        Handler handler;
+        std::chrono::steady_clock::time_point deadline;
+
+        void operator() () {
+            if (lifetime.expired()) {
+                handler(boost::asio::error::operation_aborted, 0);
+                return;
+            }
+            do {
+                boost::system::error_code ec;
+                auto n = self->mStream.read_some(buffers, ec);
+                if (ec != boost::asio::error::would_block) {
+                    handler(ec, n);
+                    return;
+                }
+            } while (std::chrono::steady_clock::now() < deadline);
+            self->mStream.async_read_some(buffers, std::move(handler));
+        }
+
+        friend void* asio_handler_allocate (size_t size, SpinRead* op) {
+            return boost_asio_handler_alloc_helpers::allocate(size, op->handler);
+        }
+
+        friend void asio_handler_deallocate (void* p, size_t size, SpinRead* op) {
+            boost_asio_handler_alloc_helpers::deallocate(p, size, op->handler);
+        }
+
+        friend bool asio_handler_is_continuation (SpinRead* op) {
+            return boost_asio_handler_cont_helpers::is_continuation(op->handler);
+        }
+
+        template <class Function>
+        friend void asio_handler_invoke (Function&& f, SpinRead* op) {
+            boost_asio_handler_invoke_helpers::invoke(f, op->handler);
+        }
+    };
+
+    template <class Transfer>
+    size_t blocking (Transfer transfer, Operation operation, boost::system::error_code& ec) {
+        // Run a synchronous `transfer()`, waiting out would_block as a blocking descriptor would.
+        // A spin budget, or prebuffering, leaves the descriptor in non-blocking mode, but the
+        // synchronous operations must still block.
+        auto n = transfer();
+        while (ec == boost::asio::error::would_block) {
+            awaitReadiness(operation, ec);
+            if (ec) {
+                return 0;
+            }
+            n = transfer();
+        }
+        return n;
+    }
+
+    void awaitReadiness (Operation operation, boost::system::error_code& ec);
+    // Block until the port is ready for `operation`. asio's own `wait()` will not do: it only
+    // polls a descriptor which the user has put in non-blocking mode.
+
+    template <class Handler>
+    CountingHandler<std::decay_t<Handler>> counting (Handler&& handler, Operation operation,
+            PortStatistics::Clock::time_point issued) {
+        return {std::forward<Handler>(handler), mStatistics, operation, issued};
+    }
+
+    struct Prebuffer {
+        // Until prebuffering stops, the wait which fills this and the owner only touch it under
+        // `mutex`; afterwards only the owner does. The pending wait shares it, and checks `active`
+        // to learn whether the stream still wants input, or still exists.
+        std::mutex mutex;
+        std::vector<char> data;
+        size_t begin = 0;
+        size_t limit = 0;
+        std::atomic<bool> active{false};
+
+        size_t unread () const { return data.size() - begin; }
+    };
+
+    void awaitPrebufferInput ();
+    // Wait for input to prebuffer. Called with the prebuffer's mutex held.
+
+    void stopPrebuffering ();
+    void endPrebuffering ();
+    // `stopPrebuffering()` locks the prebuffer's mutex; `endPrebuffering()` expects it held.
+
+    void discardPrebuffer () {
+        stopPrebuffering();
+        mPrebuffer->data.clear();
+        mPrebuffer->begin = 0;
+    }
+
+    template <class MutableBufferSequence>
+    size_t takePrebuffered (const MutableBufferSequence& buffers) {
+        // Only called once prebuffering has stopped.
+        auto& p = *mPrebuffer;
+        auto n = boost::asio::buffer_copy(buffers, boost::asio::buffer(p.data) + p.begin);
+        p.begin += n;
+        if (p.begin == p.data.size()) {
+            p.data.clear();
+            p.data.shrink_to_fit();
+            p.begin = 0;
+        }
+        mStatistics->queue(p.unread());
+        return n;
+    }
+
+    next_layer_type mStream;
+    SerialProfile mProfile;
+
+    std::shared_ptr<Prebuffer> mPrebuffer = std::make_shared<Prebuffer>();
+
+    next_layer_type mPrebufferWatch;
+    // A duplicate of the port's descriptor on which prebuffering waits for input. Closing it
+    // cancels that wait without disturbing the owner's operations on `mStream`.
+
+    std::shared_ptr<PortStatistics> mStatistics = std::make_shared<PortStatistics>();
+
+    std::shared_ptr<char> mLifetime = std::make_shared<char>();
+    // A posted spin holds a weak reference, so that it can tell whether the stream still exists
+    // when it runs.
+};
+
+inline std::shared_ptr<SerialStream> preopen (boost::asio::io_service& context,
+        const Device& device, const SerialProfile& profile,
+        size_t prebufferSize = SerialStream::kDefaultPrebufferSize) {
+    // Open `device` with `profile` and start prebuffering its input, returning null if the port
+    // could not be opened.
+    auto stream = std::make_shared<SerialStream>(context);
+    boost::system::error_code ec;
+    stream->open(device, profile, ec);
+    if (ec) {
+        return nullptr;
+    }
+    stream->prebuffer(prebufferSize);
+    return stream;
+}
+
+} // namespace usbcdc
+
+#endif
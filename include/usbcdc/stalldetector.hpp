@@ -0,0 +1,84 @@
+#ifndef USBCDC_STALLDETECTOR_HPP
+#define USBCDC_STALLDETECTOR_HPP
+
+#include <usbcdc/portstatistics.hpp>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace usbcdc {
+
+class StallDetector {
+    // Reports ports which stay open without receiving a byte for longer than a threshold, such as
+    // a robot whose CDC link silently stopped. It only reads the ports' `PortStatistics`, so it
+    // may run on its own io_service and thread, apart from the ports' I/O. Each stall is reported
+    // once; a port which receives again is reported as recovered, and may then stall anew.
+public:
+    using Clock = PortStatistics::Clock;
+
+    using StallHandler = std::function<void(const std::string& path, Clock::duration idle)>;
+    using RecoverHandler = std::function<void(const std::string& path)>;
+
+    static constexpr std::chrono::seconds kDefaultThreshold{5};
+
+    explicit StallDetector (boost::asio::io_service& context,
+            Clock::duration threshold = kDefaultThreshold);
+    ~StallDetector ();
+
+    StallDetector (const StallDetector&) = delete;
+    StallDetector& operator= (const StallDetector&) = delete;
+
+    void threshold (Clock::duration d) { mThreshold = d; }
+    Clock::duration threshold () const { return mThreshold; }
+    // Ports are checked every quarter of the threshold, so a stall is reported at most a quarter
+    // of the threshold late.
+
+    void onStall (StallHandler handler) { mStallHandler = std::move(handler); }
+    void onRecover (RecoverHandler handler) { mRecoverHandler = std::move(handler); }
+
+    void watch (const std::string& path, std::shared_ptr<const PortStatistics> statistics);
+    // Watch the port at `path`, e.g. `stream.statistics()`. Watching a path again replaces its
+    // statistics. A closed port never counts as stalled.
+
+    void unwatch (const std::string& path);
+
+    size_t watched () const { return mPorts.size(); }
+
+    void start ();
+    // Check the watched ports periodically until `stop()`.
+
+    void stop ();
+
+    size_t check (Clock::time_point now);
+    // Check every watched port as of `now`, calling the handlers for any change, and return how
+    // many ports are stalled. `start()` calls this; tests may call it with a simulated clock.
+
+private:
+    struct Port {
+        std::shared_ptr<const PortStatistics> statistics;
+        bool stalled = false;
+    };
+
+    void arm ();
+
+    boost::asio::steady_timer mTimer;
+    Clock::duration mThreshold;
+    std::map<std::string, Port> mPorts;
+    StallHandler mStallHandler;
+    RecoverHandler mRecoverHandler;
+    bool mRunning = false;
+
+    std::shared_ptr<char> mLifetime = std::make_shared<char>();
+    // The pending timer handler holds a weak reference, so that it can tell whether the detector
+    // was destroyed before it ran.
+};
+
+} // namespace usbcdc
+
+#endif
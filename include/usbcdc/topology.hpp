@@ -0,0 +1,67 @@
+#ifndef USBCDC_TOPOLOGY_HPP
+#define USBCDC_TOPOLOGY_HPP
+
+#include <usbcdc/devices.hpp>
+
+#include <map>
+#include <string>
+
+namespace usbcdc {
+
+std::string usbPortPath (const std::string& sysPath);
+// Extract the USB port path (e.g., `1-1.4`) from a sysfs device path such as
+// `/devices/pci0000:00/0000:00:14.0/usb1/1-1/1-1.4/1-1.4:1.0/tty/ttyACM0`. Return an empty string
+// if `sysPath` does not pass through a USB interface.
+
+std::string parentPortPath (const std::string& portPath);
+// Return the port path of the hub `portPath` is plugged into, e.g. `1-1` for `1-1.4`, and `usb1`
+// for `1-1`.
+
+bool isUnderHub (const std::string& portPath, const std::string& hubPortPath);
+// True if `portPath` is `hubPortPath` or is plugged in somewhere beneath it. `hubPortPath` may also
+// name a root hub as `usbN`.
+
+DeviceSet devicesUnder (const std::string& hubPortPath);
+// Enumerate only the devices plugged in beneath the hub at `hubPortPath`. On Linux this reads just
+// that hub's sysfs subtree; elsewhere it filters a full `devices()` scan.
+
+class TopologyIndex {
+    // An index of a device set by USB port path, answering "which devices are behind this hub"
+    // without rescanning the system.
+    //
+    // Monitors neither maintain an index nor report hub-level events: the Linux monitor follows
+    // ttys only, and reports every tty beneath a hub which comes or goes on its own. An
+    // application which wants one builds it from `asyncDevices()` and keeps it current with the
+    // events it receives; `replaceSubtree()` is for reconciling it after a hub event the
+    // application learned of by other means.
+public:
+    TopologyIndex () = default;
+    explicit TopologyIndex (const DeviceSet& devices);
+
+    void insert (const Device& device);
+    void erase (const Device& device);
+
+    DeviceSet devicesUnder (const std::string& hubPortPath) const;
+    // All indexed devices plugged in beneath `hubPortPath`, at any depth.
+
+    DeviceSet children (const std::string& hubPortPath) const;
+    // Only the indexed devices plugged directly into `hubPortPath`.
+
+    DeviceSetDifferences replaceSubtree (const std::string& hubPortPath, const DeviceSet& devices);
+    // Replace every indexed device beneath `hubPortPath` with `devices`, typically the result of
+    // `usbcdc::devicesUnder(hubPortPath)` after a hub-level event, and return what changed.
+
+    size_t size () const { return mByPortPath.size(); }
+
+private:
+    using Map = std::multimap<std::string, Device>;
+    std::pair<Map::const_iterator, Map::const_iterator> subtree (const std::string& hub) const;
+
+    Map mByPortPath;
+    // Ordered so that a hub's subtree is one contiguous range. A composite device may expose more
+    // than one CDC interface, hence the multimap.
+};
+
+} // namespace usbcdc
+
+#endif
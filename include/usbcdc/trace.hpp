@@ -0,0 +1,80 @@
+#ifndef USBCDC_TRACE_HPP
+#define USBCDC_TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+
+namespace usbcdc {
+
+namespace trace {
+
+// Scoped spans for finding out where enumeration and monitoring spend their time. Tracing is off
+// until `enable(true)`; until then a span costs one relaxed atomic load. While enabled, each
+// thread records its spans into its own fixed-size ring buffer, without locks, keeping the most
+// recent `kSpansPerThread`. `writeChromeTrace()` dumps every thread's spans in Chrome's
+// trace-event format, for chrome://tracing, Perfetto, or speedscope.
+//
+// Define USBCDC_NO_TRACE (the USBCDC_TRACE CMake option) to compile the spans out entirely.
+
+constexpr size_t kSpansPerThread = 1 << 16;
+
+extern std::atomic<bool> gEnabled;
+
+inline bool enabled () { return gEnabled.load(std::memory_order_relaxed); }
+void enable (bool on);
+
+void record (const char* name, std::chrono::steady_clock::time_point start,
+        std::chrono::steady_clock::time_point end);
+// Record a span on the calling thread's buffer. `name` must outlive the trace, e.g. a literal.
+
+void writeChromeTrace (std::ostream& os);
+// Write every span recorded so far as a Chrome trace-event JSON object. Safe to call while other
+// threads are tracing; spans they overwrite during the dump are left out.
+
+void clear ();
+// Discard every span recorded so far. Not safe to call while other threads are tracing.
+
+class Scope {
+    // Records a span named `name` from construction to destruction, if tracing was enabled at
+    // construction.
+public:
+    explicit Scope (const char* name)
+        : mName(enabled() ? name : nullptr)
+    {
+        if (mName) {
+            mStart = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~Scope () {
+        if (mName) {
+            record(mName, mStart, std::chrono::steady_clock::now());
+        }
+    }
+
+    Scope (const Scope&) = delete;
+    Scope& operator= (const Scope&) = delete;
+
+private:
+    const char* mName;
+    std::chrono::steady_clock::time_point mStart;
+};
+
+} // trace
+
+} // usbcdc
+
+#define USBCDC_TRACE_CONCAT_(a, b) a##b
+#define USBCDC_TRACE_CONCAT(a, b) USBCDC_TRACE_CONCAT_(a, b)
+
+#ifdef USBCDC_NO_TRACE
+#define USBCDC_TRACE_SCOPE(name) do {} while (0)
+#else
+#define USBCDC_TRACE_SCOPE(name) \
+    ::usbcdc::trace::Scope USBCDC_TRACE_CONCAT(usbcdcTraceScope, __LINE__){name}
+#endif
+// Trace the rest of the enclosing block as a span named `name`, a string literal.
+
+#endif
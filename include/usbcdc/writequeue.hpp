@@ -0,0 +1,141 @@
+#ifndef USBCDC_WRITEQUEUE_HPP
+#define USBCDC_WRITEQUEUE_HPP
+
+#include <usbcdc/iocontext.hpp>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/write.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace usbcdc {
+
+template <class Stream>
+class WriteQueue {
+    // Coalesces small frames written to an opened port. Every frame queued during one turn of the
+    // io_service is sent with a single gather write (`writev(2)` on POSIX descriptors), so a
+    // control tick which emits dozens of frames costs one syscall and usually one USB transfer
+    // instead of one per frame. Frames are written straight from the caller's memory, which must
+    // stay valid until the frame's handler is called.
+public:
+    using Handler = std::function<void(boost::system::error_code)>;
+
+    struct BatchStatistics {
+        size_t frames = 0;
+        size_t bytes = 0;
+        std::chrono::steady_clock::duration duration{};
+    };
+
+    struct Statistics {
+        uint64_t batches = 0;
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        size_t maxFramesPerBatch = 0;
+        BatchStatistics lastBatch;
+    };
+
+    explicit WriteQueue (Stream& stream)
+        : mStream(stream)
+    {}
+
+    void asyncWrite (boost::asio::const_buffer frame, Handler handler);
+    // Queue `frame` for writing. `handler` is called once the whole batch containing the frame has
+    // been written, or has failed.
+
+    void onBatch (std::function<void(const BatchStatistics&)> f) { mOnBatch = std::move(f); }
+    // Called after each batch completes.
+
+    const Statistics& statistics () const { return mStatistics; }
+
+private:
+    void flush ();
+    void complete (boost::system::error_code ec);
+
+    Stream& mStream;
+    std::vector<boost::asio::const_buffer> mPending;
+    std::vector<Handler> mPendingHandlers;
+    std::vector<boost::asio::const_buffer> mInFlight;
+    std::vector<Handler> mInFlightHandlers;
+    // Double-buffered: frames queued while a batch is being written wait in `mPending`, and form
+    // the next batch. The vectors keep their capacity, so steady state allocates nothing here.
+
+    bool mFlushScheduled = false;
+    bool mWriting = false;
+    std::chrono::steady_clock::time_point mBatchStart;
+
+    Statistics mStatistics;
+    std::function<void(const BatchStatistics&)> mOnBatch;
+
+    std::shared_ptr<char> mLifetime = std::make_shared<char>();
+};
+
+template <class Stream>
+inline void WriteQueue<Stream>::asyncWrite (boost::asio::const_buffer frame, Handler handler) {
+    mPending.push_back(frame);
+    mPendingHandlers.push_back(std::move(handler));
+    if (!mWriting && !mFlushScheduled) {
+        // Defer the flush to the end of this turn so that any frames queued after this one by the
+        // same handler join the batch.
+        mFlushScheduled = true;
+        ioContext(mStream).post([this, lifetime = std::weak_ptr<char>(mLifetime)] {
+            if (!lifetime.expired()) {
+                mFlushScheduled = false;
+                flush();
+            }
+        });
+    }
+}
+
+template <class Stream>
+inline void WriteQueue<Stream>::flush () {
+    if (mWriting || mPending.empty()) {
+        return;
+    }
+    mWriting = true;
+    std::swap(mPending, mInFlight);
+    std::swap(mPendingHandlers, mInFlightHandlers);
+    mBatchStart = std::chrono::steady_clock::now();
+    boost::asio::async_write(mStream, mInFlight,
+        [this, lifetime = std::weak_ptr<char>(mLifetime)](boost::system::error_code ec, size_t) {
+            if (!lifetime.expired()) {
+                complete(ec);
+            }
+        });
+}
+
+template <class Stream>
+inline void WriteQueue<Stream>::complete (boost::system::error_code ec) {
+    auto batch = BatchStatistics{};
+    batch.frames = mInFlight.size();
+    batch.bytes = boost::asio::buffer_size(mInFlight);
+    batch.duration = std::chrono::steady_clock::now() - mBatchStart;
+
+    ++mStatistics.batches;
+    mStatistics.frames += batch.frames;
+    mStatistics.bytes += batch.bytes;
+    mStatistics.maxFramesPerBatch = std::max(mStatistics.maxFramesPerBatch, batch.frames);
+    mStatistics.lastBatch = batch;
+
+    mInFlight.clear();
+    mWriting = false;
+    for (auto& h: mInFlightHandlers) {
+        h(ec);
+    }
+    mInFlightHandlers.clear();
+    if (mOnBatch) {
+        mOnBatch(batch);
+    }
+    // Anything queued while this batch was in flight goes out now, without waiting another turn.
+    flush();
+}
+
+} // namespace usbcdc
+
+#endif
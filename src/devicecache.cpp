@@ -0,0 +1,91 @@
+#include <usbcdc/devicecache.hpp>
+#include <usbcdc/topology.hpp>
+
+namespace usbcdc {
+
+void DeviceCache::insert (const std::string& sysPath, const Device& device, uint64_t devNum) {
+    auto iter = mBySysPath.find(sysPath);
+    if (iter != mBySysPath.end()) {
+        eraseSecondaryKeys(sysPath, iter->second);
+        iter->second = Entry{device, devNum};
+    }
+    else {
+        mBySysPath.emplace(sysPath, Entry{device, devNum});
+    }
+    mSysPathByDevNode[device.path()] = sysPath;
+    if (devNum) {
+        mSysPathByDevNum[devNum] = sysPath;
+    }
+}
+
+bool DeviceCache::erase (const std::string& sysPath, Device& device) {
+    auto iter = mBySysPath.find(sysPath);
+    if (iter == mBySysPath.end()) {
+        return false;
+    }
+    eraseSecondaryKeys(sysPath, iter->second);
+    device = std::move(iter->second.device);
+    mBySysPath.erase(iter);
+    return true;
+}
+
+bool DeviceCache::move (const std::string& oldSysPath, const std::string& newSysPath) {
+    auto iter = mBySysPath.find(oldSysPath);
+    if (iter == mBySysPath.end()) {
+        return false;
+    }
+    auto entry = std::move(iter->second);
+    mBySysPath.erase(iter);
+    auto existing = mBySysPath.find(newSysPath);
+    if (existing != mBySysPath.end()) {
+        eraseSecondaryKeys(newSysPath, existing->second);
+        mBySysPath.erase(existing);
+    }
+    // Only the keys still pointing at the old path follow it: a reused node or number stays with
+    // the device which reused it.
+    auto node = mSysPathByDevNode.find(entry.device.path());
+    if (node != mSysPathByDevNode.end() && node->second == oldSysPath) {
+        node->second = newSysPath;
+    }
+    auto num = mSysPathByDevNum.find(entry.devNum);
+    if (entry.devNum && num != mSysPathByDevNum.end() && num->second == oldSysPath) {
+        num->second = newSysPath;
+    }
+    entry.device.portPath(usbPortPath(newSysPath));
+    mBySysPath.emplace(newSysPath, std::move(entry));
+    return true;
+}
+
+const Device* DeviceCache::findBySysPath (const std::string& sysPath) const {
+    auto iter = mBySysPath.find(sysPath);
+    return iter != mBySysPath.end() ? &iter->second.device : nullptr;
+}
+
+const Device* DeviceCache::findByDevNode (const std::string& devNode) const {
+    auto iter = mSysPathByDevNode.find(devNode);
+    return iter != mSysPathByDevNode.end() ? findBySysPath(iter->second) : nullptr;
+}
+
+const Device* DeviceCache::findByDevNum (uint64_t devNum) const {
+    auto iter = mSysPathByDevNum.find(devNum);
+    return iter != mSysPathByDevNum.end() ? findBySysPath(iter->second) : nullptr;
+}
+
+void DeviceCache::clear () {
+    mBySysPath.clear();
+    mSysPathByDevNode.clear();
+    mSysPathByDevNum.clear();
+}
+
+void DeviceCache::eraseSecondaryKeys (const std::string& sysPath, const Entry& entry) {
+    auto node = mSysPathByDevNode.find(entry.device.path());
+    if (node != mSysPathByDevNode.end() && node->second == sysPath) {
+        mSysPathByDevNode.erase(node);
+    }
+    auto num = mSysPathByDevNum.find(entry.devNum);
+    if (entry.devNum && num != mSysPathByDevNum.end() && num->second == sysPath) {
+        mSysPathByDevNum.erase(num);
+    }
+}
+
+} // usbcdc
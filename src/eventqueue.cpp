@@ -0,0 +1,71 @@
+#include <usbcdc/eventqueue.hpp>
+
+#include <algorithm>
+
+namespace usbcdc {
+
+constexpr size_t EventQueue::kDefaultCapacity;
+constexpr size_t EventQueue::kMinimumCapacity;
+
+EventQueue::EventQueue (size_t capacity, Policy policy)
+    : mSlots(std::max(capacity, kMinimumCapacity))
+    , mPolicy(policy)
+{}
+
+void EventQueue::capacity (size_t c) {
+    // Keep the newest events which fit.
+    auto slots = std::vector<DeviceEvent>(std::max(c, kMinimumCapacity));
+    auto keep = std::min(mSize, slots.size());
+    mStatistics.dropped += mSize - keep;
+    for (size_t i = 0; i < keep; ++i) {
+        slots[i] = std::move(mSlots[(mHead + mSize - keep + i) % mSlots.size()]);
+    }
+    mSlots = std::move(slots);
+    mHead = 0;
+    mSize = keep;
+}
+
+bool EventQueue::push (DeviceEvent&& event) {
+    if (full()) {
+        switch (mPolicy) {
+            case Policy::BLOCK:
+                return false;
+            case Policy::DROP_OLDEST:
+                ++mStatistics.dropped;
+                pop();
+                break;
+            case Policy::RESYNC:
+                if (!resyncPending()) {
+                    mStatistics.dropped += mSize;
+                    ++mStatistics.resyncs;
+                    mHead = 0;
+                    mSize = 1;
+                    mSlots[0] = DeviceEvent{DeviceEvent::RESYNC, Device{}, {}};
+                }
+                ++mStatistics.dropped;
+                return false;
+        }
+    }
+    else if (mPolicy == Policy::RESYNC && resyncPending()) {
+        // Everything after the marker would be stale relative to the resynchronized state.
+        ++mStatistics.dropped;
+        return false;
+    }
+    mSlots[(mHead + mSize) % mSlots.size()] = std::move(event);
+    ++mSize;
+    ++mStatistics.pushed;
+    mStatistics.highWaterMark = std::max(mStatistics.highWaterMark, mSize);
+    return true;
+}
+
+void EventQueue::pop () {
+    mSlots[mHead] = DeviceEvent{};
+    mHead = (mHead + 1) % mSlots.size();
+    --mSize;
+}
+
+bool EventQueue::resyncPending () const {
+    return mSize && mSlots[(mHead + mSize - 1) % mSlots.size()].type == DeviceEvent::RESYNC;
+}
+
+} // usbcdc
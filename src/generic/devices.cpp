@@ -0,0 +1,46 @@
+#include <usbcdc/devices.hpp>
+#include <usbcdc/topology.hpp>
+
+#include <future>
+#include <memory>
+#include <thread>
+
+namespace usbcdc {
+
+PartialDeviceSet devices (std::chrono::steady_clock::time_point deadline,
+        const CancellationToken& cancel) {
+    // The platform enumerates all devices in one call, so run it on a worker thread and abandon
+    // the worker if the call outlives the deadline or cancellation. The worker's result, if it
+    // ever comes, is dropped with the shared state.
+    auto task = std::make_shared<std::packaged_task<DeviceSet()>>([] { return devices(); });
+    auto future = task->get_future();
+    std::thread{[task] { (*task)(); }}.detach();
+
+    auto result = PartialDeviceSet{};
+    const auto kCancelPoll = std::chrono::milliseconds{10};
+    for (;;) {
+        auto wakeup = std::min(deadline, std::chrono::steady_clock::now() + kCancelPoll);
+        if (future.wait_until(wakeup) == std::future_status::ready) {
+            result.devices = future.get();
+            return result;
+        }
+        if ((result.cancelled = cancel.cancelled())
+                || std::chrono::steady_clock::now() >= deadline) {
+            result.timedOut.push_back("devices()");
+            return result;
+        }
+    }
+}
+
+DeviceSet devicesUnder (const std::string& hubPortPath) {
+    // No cheaper subtree enumeration is available on this platform, so filter a full scan.
+    auto result = DeviceSet{};
+    for (const auto& d: devices()) {
+        if (isUnderHub(d.portPath(), hubPortPath)) {
+            result.insert(d);
+        }
+    }
+    return result;
+}
+
+} // namespace usbcdc
@@ -0,0 +1,61 @@
+#include <usbcdc/identity.hpp>
+#include <usbcdc/deviceevent.hpp>
+
+#include <cstdio>
+
+namespace usbcdc {
+
+std::string stableId (const Device& device) {
+    char vidPid[16];
+    std::snprintf(vidPid, sizeof(vidPid), "%04x:%04x", device.vendorId(), device.productId());
+    if (device.serialNumber().size()) {
+        return std::string{vidPid} + "/serial/" + device.serialNumber();
+    }
+    if (device.portPath().size()) {
+        return std::string{vidPid} + "/port/" + device.portPath();
+    }
+    return {};
+}
+
+void IdentityTracker::process (DeviceEvent& event, Clock::time_point now) {
+    switch (event.type) {
+        case DeviceEvent::REMOVE: {
+            expire(now);
+            auto id = stableId(event.device);
+            if (id.size()) {
+                mDepartures[id] = Departure{event.device.path(), now};
+                mExpiry.emplace_back(now, std::move(id));
+            }
+            break;
+        }
+        case DeviceEvent::ADD: {
+            auto id = stableId(event.device);
+            if (id.empty()) {
+                break;
+            }
+            auto iter = mDepartures.find(id);
+            if (iter != mDepartures.end()) {
+                if (now - iter->second.time <= mWindow) {
+                    event.type = DeviceEvent::RECONNECT;
+                    event.previousPath = std::move(iter->second.path);
+                }
+                mDepartures.erase(iter);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void IdentityTracker::expire (Clock::time_point now) {
+    while (mExpiry.size() && now - mExpiry.front().first > mWindow) {
+        auto iter = mDepartures.find(mExpiry.front().second);
+        if (iter != mDepartures.end() && iter->second.time == mExpiry.front().first) {
+            mDepartures.erase(iter);
+        }
+        mExpiry.pop_front();
+    }
+}
+
+} // usbcdc
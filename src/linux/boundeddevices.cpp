@@ -0,0 +1,24 @@
+#include <usbcdc/monitor.hpp>
+#include <usbcdc/trace.hpp>
+
+#include <boost/system/system_error.hpp>
+
+namespace usbcdc {
+
+PartialDeviceSet devices (std::chrono::steady_clock::time_point deadline,
+        const CancellationToken& cancel) {
+    // Built on the sysfs enumeration the udev-less monitor backends use, which reads each
+    // device's attributes separately, rather than on `devices()`'s single lazy traversal.
+    USBCDC_TRACE_SCOPE("devices (bounded)");
+    auto result = PartialDeviceSet{};
+    auto ec = boost::system::error_code{};
+    for (auto& record: sysfsRecords(deadline, cancel, result, ec)) {
+        result.devices.insert(toDevice(record));
+    }
+    if (ec) {
+        throw boost::system::system_error(ec, "No sysfs");
+    }
+    return result;
+}
+
+} // usbcdc
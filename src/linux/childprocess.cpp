@@ -0,0 +1,145 @@
+#include <usbcdc/linux/childprocess.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace usbcdc {
+
+namespace {
+
+int openPidfd (pid_t pid) {
+    // A descriptor which polls readable once `pid` exits, or -1 if the kernel (before 5.3) or the
+    // C library cannot provide one.
+#ifdef SYS_pidfd_open
+    return int(::syscall(SYS_pidfd_open, pid, 0));
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+struct Reaper {
+    // Reaps released children without ever blocking on one of them, so a child which ignores
+    // SIGTERM cannot keep the others as zombies. Each child is polled with `waitpid(WNOHANG)`
+    // whenever its pidfd polls readable; where pidfds are unavailable, children are polled every
+    // few milliseconds until they have all been reaped. We cannot rely on SIGCHLD: it belongs to
+    // the application.
+    struct Child {
+        pid_t pid;
+        int pidfd;
+    };
+
+    static constexpr int kPollMilliseconds = 10;
+
+    std::mutex mutex;
+    std::vector<pid_t> incoming;
+    std::atomic<size_t> unreaped{0};
+    int wake[2];
+
+    Reaper () {
+        if (::pipe2(wake, O_CLOEXEC | O_NONBLOCK)) {
+            // Without a wakeup pipe the reaper falls back to polling, even when idle.
+            wake[0] = wake[1] = -1;
+        }
+        std::thread{[this] { run(); }}.detach();
+    }
+
+    void add (pid_t pid) {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            incoming.push_back(pid);
+        }
+        if (wake[1] >= 0) {
+            auto byte = char{};
+            while (::write(wake[1], &byte, 1) < 0 && errno == EINTR) {}
+        }
+    }
+
+    void run () {
+        auto children = std::vector<Child>{};
+        auto fds = std::vector<pollfd>{};
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                for (auto pid: incoming) {
+                    children.push_back({pid, openPidfd(pid)});
+                }
+                incoming.clear();
+            }
+
+            for (auto i = children.begin(); i != children.end();) {
+                if (exited(i->pid)) {
+                    if (i->pidfd >= 0) {
+                        ::close(i->pidfd);
+                    }
+                    i = children.erase(i);
+                    --unreaped;
+                }
+                else {
+                    ++i;
+                }
+            }
+
+            fds.clear();
+            fds.push_back({wake[0], POLLIN, 0});
+            auto timeout = wake[0] < 0 ? kPollMilliseconds : -1;
+            for (auto& child: children) {
+                if (child.pidfd >= 0) {
+                    fds.push_back({child.pidfd, POLLIN, 0});
+                }
+                else {
+                    timeout = kPollMilliseconds;
+                }
+            }
+            if (::poll(fds.data(), fds.size(), timeout) > 0 && fds[0].revents) {
+                char buffer[64];
+                while (::read(wake[0], buffer, sizeof(buffer)) > 0) {}
+            }
+        }
+    }
+
+    static bool exited (pid_t pid) {
+        auto rc = pid_t{};
+        while ((rc = ::waitpid(pid, nullptr, WNOHANG)) < 0 && errno == EINTR) {}
+        // ECHILD means someone else reaped it, e.g. the application ignores SIGCHLD.
+        return rc == pid || (rc < 0 && errno == ECHILD);
+    }
+};
+
+Reaper& reaper () {
+    // Never destroyed: the reaper thread may still be waiting when the process exits.
+    static auto r = new Reaper;
+    return *r;
+}
+
+} // <anonymous>
+
+void ChildProcess::release () {
+    if (mPid > 0) {
+        ::kill(mPid, SIGTERM);
+        reapChild(mPid);
+        mPid = 0;
+    }
+}
+
+void reapChild (pid_t pid) {
+    auto& r = reaper();
+    ++r.unreaped;
+    r.add(pid);
+}
+
+size_t unreapedChildren () {
+    return reaper().unreaped;
+}
+
+} // usbcdc
@@ -1,5 +1,10 @@
 #include <usbcdc/devices.hpp>
 
+#include "sysfs.hpp"
+
+#include <usbcdc/topology.hpp>
+#include <usbcdc/trace.hpp>
+
 #include <util/traversedir.hpp>
 
 #include <boost/algorithm/string/predicate.hpp>
@@ -41,6 +46,7 @@ struct BySubsystem {
     explicit BySubsystem (const std::string& target) : mTarget(target) {}
     // True if p has a child subsystem symlink matching target.
     bool operator() (const fs::path& p) const {
+        USBCDC_TRACE_SCOPE("BySubsystem");
         if (fs::is_directory(p) && !fs::is_symlink(p)) {
             auto ec = boost::system::error_code{};
             auto subsystem = fs::read_symlink(p / "subsystem", ec);
@@ -60,6 +66,7 @@ struct ByUsbInterfaceClass {
     ByUsbInterfaceClass () = default;
     explicit ByUsbInterfaceClass (UsbClass target) : mTarget(target) {}
     bool operator() (const fs::path& p) const {
+        USBCDC_TRACE_SCOPE("ByUsbInterfaceClass");
         if (fs::is_directory(p) && !fs::is_symlink(p)) {
             auto icPath = p / "bInterfaceClass";
             if (fs::exists(icPath)) {
@@ -78,6 +85,7 @@ struct ByUsbInterfaceClass {
 
 // For use with Boost.Range transformed adaptor
 static Device toDevice (const fs::path& p) {
+    USBCDC_TRACE_SCOPE("toDevice");
     auto productPath = p.parent_path() / "product";
     if (fs::exists(productPath)) {
         std::string productString;
@@ -93,7 +101,13 @@ static Device toDevice (const fs::path& p) {
                     while (std::getline(ueStream, path)) {
                         if (boost::algorithm::starts_with(path, key)) {
                             path.replace(0, key.length(), "/dev/");
-                            return Device{path, productString};
+                            auto device = Device{path, productString};
+                            auto usbDevice = p.parent_path();
+                            device.portPath(usbDevice.filename().string());
+                            device.serialNumber(readAttribute(usbDevice / "serial"));
+                            device.vendorId(readHexAttribute(usbDevice / "idVendor"));
+                            device.productId(readHexAttribute(usbDevice / "idProduct"));
+                            return device;
                         }
                     }
                 }
@@ -107,10 +121,12 @@ static bool deviceIsValid (const Device& d) {
     return d.path().size() && d.productString().size();
 }
 
-DeviceSet devices () {
+static DeviceSet devicesBeneath (const fs::path& root) {
+    // Time not spent in the filters and `toDevice` is spent in `traverseDirR`.
+    USBCDC_TRACE_SCOPE("traverseDirR");
     using std::begin;
     using std::end;
-    auto rng = util::traverseDirR(sysDevices())
+    auto rng = util::traverseDirR(root)
         | filtered(BySubsystem{"usb"})
         | filtered(ByUsbInterfaceClass{UsbClass::cdc})
         | transformed(toDevice)
@@ -119,4 +135,22 @@ DeviceSet devices () {
     return DeviceSet(begin(rng), end(rng));
 }
 
+DeviceSet devices () {
+    USBCDC_TRACE_SCOPE("devices");
+    return devicesBeneath(sysDevices());
+}
+
+DeviceSet devicesUnder (const std::string& hubPortPath) {
+    // /sys/bus/usb/devices has a symlink for every USB device and root hub, named by port path
+    // (or `usbN`), pointing into the /sys/devices tree. Only that hub's subtree needs a walk.
+    auto sysEnv = std::getenv("SYSFS_PATH");
+    auto link = fs::path{sysEnv ? sysEnv : "/sys"} / "bus" / "usb" / "devices" / hubPortPath;
+    auto ec = boost::system::error_code{};
+    auto hub = fs::canonical(link, ec);
+    if (ec || !fs::is_directory(hub)) {
+        return {};
+    }
+    return devicesBeneath(hub);
+}
+
 } // namespace usbcdc
@@ -0,0 +1,147 @@
+#include <usbcdc/linux/devicetable.hpp>
+
+#include <boost/asio/detail/throw_error.hpp>
+#include <boost/asio/error.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace usbcdc {
+
+namespace {
+
+boost::system::error_code lastError () {
+    return {errno, boost::system::system_category()};
+}
+
+void* mapTable (const std::string& name, bool create) {
+    auto fd = create
+        ? ::shm_open(name.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644)
+        : ::shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        boost::asio::detail::throw_error(lastError(), "shm_open");
+    }
+    if (create && ::ftruncate(fd, sizeof(DeviceTableLayout))) {
+        auto ec = lastError();
+        ::close(fd);
+        boost::asio::detail::throw_error(ec, "ftruncate");
+    }
+    auto p = ::mmap(nullptr, sizeof(DeviceTableLayout),
+        create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    auto ec = lastError();
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        boost::asio::detail::throw_error(ec, "mmap");
+    }
+    return p;
+}
+
+template <size_t N>
+void copyField (char (&field)[N], const std::string& value) {
+    auto n = std::min(value.size(), N - 1);
+    std::memcpy(field, value.data(), n);
+    field[n] = 0;
+}
+
+template <size_t N>
+std::string fieldString (const char (&field)[N]) {
+    return std::string(field, strnlen(field, N));
+}
+
+} // <anonymous>
+
+DeviceTableWriter::DeviceTableWriter (const std::string& name)
+    : mName(name)
+{
+    auto p = mapTable(name, true);
+    mTable = new (p) DeviceTableLayout{};
+    // Readers check the header last, once the table is valid.
+    mTable->version = DeviceTableLayout::kVersion;
+    std::atomic_thread_fence(std::memory_order_release);
+    mTable->magic = DeviceTableLayout::kMagic;
+}
+
+DeviceTableWriter::~DeviceTableWriter () {
+    ::munmap(mTable, sizeof(DeviceTableLayout));
+    ::shm_unlink(mName.c_str());
+}
+
+uint64_t DeviceTableWriter::publish (const DeviceSet& devices) {
+    auto sequence = mTable->sequence.load(std::memory_order_relaxed);
+    mTable->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto n = size_t(0);
+    for (auto& d: devices) {
+        if (n == DeviceTableLayout::kCapacity) {
+            break;
+        }
+        auto& e = mTable->entries[n++];
+        copyField(e.path, d.path());
+        copyField(e.productString, d.productString());
+        copyField(e.portPath, d.portPath());
+        copyField(e.serialNumber, d.serialNumber());
+        e.vendorId = d.vendorId();
+        e.productId = d.productId();
+    }
+    mTable->count.store(uint32_t(n), std::memory_order_relaxed);
+    mTable->truncated.store(devices.size() > n, std::memory_order_relaxed);
+    auto generation = mTable->generation.load(std::memory_order_relaxed) + 1;
+    mTable->generation.store(generation, std::memory_order_relaxed);
+
+    mTable->sequence.store(sequence + 2, std::memory_order_release);
+    return generation;
+}
+
+DeviceTableReader::DeviceTableReader (const std::string& name)
+    : mTable(static_cast<const DeviceTableLayout*>(mapTable(name, false)))
+    , mScratch(DeviceTableLayout::kCapacity)
+{
+    if (mTable->magic != DeviceTableLayout::kMagic
+            || mTable->version != DeviceTableLayout::kVersion) {
+        ::munmap(const_cast<DeviceTableLayout*>(mTable), sizeof(DeviceTableLayout));
+        boost::asio::detail::throw_error(
+            make_error_code(boost::system::errc::wrong_protocol_type), "DeviceTableReader");
+    }
+}
+
+DeviceTableReader::~DeviceTableReader () {
+    ::munmap(const_cast<DeviceTableLayout*>(mTable), sizeof(DeviceTableLayout));
+}
+
+uint64_t DeviceTableReader::read (DeviceSet& devices) {
+    for (;;) {
+        auto sequence = mTable->sequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            continue;
+        }
+        auto generation = mTable->generation.load(std::memory_order_relaxed);
+        auto n = std::min<size_t>(mTable->count.load(std::memory_order_relaxed),
+            DeviceTableLayout::kCapacity);
+        std::memcpy(mScratch.data(), mTable->entries, n * sizeof(DeviceTableEntry));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (mTable->sequence.load(std::memory_order_relaxed) != sequence) {
+            continue;
+        }
+
+        devices.clear();
+        for (size_t i = 0; i < n; ++i) {
+            auto& e = mScratch[i];
+            auto device = Device{fieldString(e.path), fieldString(e.productString)};
+            device.portPath(fieldString(e.portPath));
+            device.serialNumber(fieldString(e.serialNumber));
+            device.vendorId(e.vendorId);
+            device.productId(e.productId);
+            devices.insert(std::move(device));
+        }
+        return generation;
+    }
+}
+
+} // usbcdc
@@ -0,0 +1,531 @@
+#include <usbcdc/linux/eventsource.hpp>
+
+#include "sysfs.hpp"
+
+#include <usbcdc/devicecache.hpp>
+#include <usbcdc/trace.hpp>
+
+#include <boost/asio/buffer.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#include <linux/netlink.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace fs = boost::filesystem;
+
+namespace usbcdc {
+
+namespace {
+
+const char* const kDevDirectory = "/dev";
+const auto kPollInterval = std::chrono::milliseconds{500};
+
+fs::path sysfsRoot () {
+    auto sysEnv = std::getenv("SYSFS_PATH");
+    return fs::path{sysEnv ? sysEnv : "/sys"};
+}
+
+std::string encodeProperty (const std::string& value) {
+    // udev's `\xhh` escaping, as found in properties such as `ID_MODEL_ENC`, which
+    // `decodeProductString()` undoes.
+    static const char kPlain[] = "#+-.:=@_";
+    auto result = std::string{};
+    for (unsigned char c: value) {
+        if (std::isalnum(c) || (c && std::strchr(kPlain, c)) || c >= 0x80) {
+            result += char(c);
+        }
+        else {
+            char escape[5];
+            std::snprintf(escape, sizeof(escape), "\\x%02x", c);
+            result += escape;
+        }
+    }
+    return result;
+}
+
+bool describeTty (const fs::path& ttyDir, UdevRecord& record) {
+    // Fill in everything but `record.action` from the sysfs directory of a tty. Return false if
+    // the tty does not belong to a CDC-ACM interface.
+    USBCDC_TRACE_SCOPE("describeTty");
+    auto ec = boost::system::error_code{};
+    auto root = fs::canonical(sysfsRoot(), ec);
+    auto tty = ec ? fs::path{} : fs::canonical(ttyDir, ec);
+    auto interface = ec ? fs::path{} : fs::canonical(tty / "device", ec);
+    auto driver = ec ? fs::path{} : fs::read_symlink(interface / "driver", ec);
+    if (ec || driver.filename() != "cdc_acm") {
+        return false;
+    }
+    auto usbDevice = interface.parent_path();
+
+    record.devPath = tty.string().substr(root.string().size());
+    record.devPathOld.clear();
+    record.devName = std::string{kDevDirectory} + "/" + tty.filename().string();
+    record.usbDriver = driver.filename().string();
+    record.modelEnc = encodeProperty(readAttribute(usbDevice / "product"));
+    record.serialNumber = readAttribute(usbDevice / "serial");
+    record.vendorId = readHexAttribute(usbDevice / "idVendor");
+    record.productId = readHexAttribute(usbDevice / "idProduct");
+    record.devNum = 0;
+    unsigned major, minor;
+    if (std::sscanf(readAttribute(tty / "dev").c_str(), "%u:%u", &major, &minor) == 2) {
+        record.devNum = DeviceCache::makeDevNum(major, minor);
+    }
+    return true;
+}
+
+std::map<std::string, UdevRecord> scanTtys (boost::system::error_code& ec) {
+    // Every CDC-ACM tty in sysfs, keyed by its name.
+    USBCDC_TRACE_SCOPE("scanTtys");
+    auto ttys = std::map<std::string, UdevRecord>{};
+    auto classDir = sysfsRoot() / "class" / "tty";
+    auto iter = fs::directory_iterator{classDir, ec};
+    for (; !ec && iter != fs::directory_iterator{}; iter.increment(ec)) {
+        auto record = UdevRecord{};
+        if (describeTty(iter->path(), record)) {
+            ttys.emplace(iter->path().filename().string(), std::move(record));
+        }
+    }
+    return ttys;
+}
+
+class TtyResolver {
+    // Describes ttys, in the order submitted, on a worker thread, so that the caller can give up
+    // on a tty whose attributes never come back: a wedged USB device can block a sysfs read
+    // indefinitely. Destroying the resolver abandons the worker rather than joining it. The worker
+    // owns its state, discards the jobs left, and exits once its current read returns, if ever.
+public:
+    using Resolution = std::pair<bool, UdevRecord>;
+
+    TtyResolver () : mState(std::make_shared<State>()) {
+        std::thread{[state = mState] { run(*state); }}.detach();
+    }
+
+    ~TtyResolver () {
+        {
+            std::lock_guard<std::mutex> lock{mState->mutex};
+            mState->abandoned = true;
+            mState->jobs.clear();
+        }
+        mState->cv.notify_one();
+    }
+
+    TtyResolver (const TtyResolver&) = delete;
+    TtyResolver& operator= (const TtyResolver&) = delete;
+
+    std::future<Resolution> submit (const fs::path& ttyDir) {
+        auto job = std::packaged_task<Resolution()>{[ttyDir] {
+            auto resolution = Resolution{};
+            resolution.first = describeTty(ttyDir, resolution.second);
+            return resolution;
+        }};
+        auto future = job.get_future();
+        {
+            std::lock_guard<std::mutex> lock{mState->mutex};
+            mState->jobs.push_back(std::move(job));
+        }
+        mState->cv.notify_one();
+        return future;
+    }
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::packaged_task<Resolution()>> jobs;
+        bool abandoned = false;
+    };
+
+    static void run (State& state) {
+        for (;;) {
+            auto job = std::packaged_task<Resolution()>{};
+            {
+                std::unique_lock<std::mutex> lock{state.mutex};
+                state.cv.wait(lock, [&] { return state.abandoned || state.jobs.size(); });
+                if (state.abandoned) {
+                    return;
+                }
+                job = std::move(state.jobs.front());
+                state.jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::shared_ptr<State> mState;
+};
+
+void writeRecord (boost::asio::streambuf& buf, const UdevRecord& record) {
+    // The inverse of `parseUdevadm()`. Empty properties are left out, as udev does.
+    std::ostream os{&buf};
+    auto property = [&os](const char* key, const std::string& value) {
+        if (value.size()) {
+            os << key << '=' << value << '\n';
+        }
+    };
+    property("ACTION", record.action);
+    property("DEVPATH", record.devPath);
+    property("DEVPATH_OLD", record.devPathOld);
+    property("DEVNAME", record.devName);
+    os << "SUBSYSTEM=tty\n";
+    if (record.devNum) {
+        os << "MAJOR=" << (record.devNum >> 32) << '\n'
+           << "MINOR=" << (record.devNum & 0xffffffff) << '\n';
+    }
+    property("ID_USB_DRIVER", record.usbDriver);
+    property("ID_MODEL_ENC", record.modelEnc);
+    property("ID_SERIAL_SHORT", record.serialNumber);
+    if (record.vendorId || record.productId) {
+        os << std::hex << std::setfill('0')
+           << "ID_VENDOR_ID=" << std::setw(4) << record.vendorId << '\n'
+           << "ID_MODEL_ID=" << std::setw(4) << record.productId << '\n';
+    }
+    os << '\n';
+}
+
+class SysfsEventSource : public EventSource {
+    // Common ground for the backends which only learn that something changed, and read the
+    // details from sysfs.
+public:
+    SysfsEventSource (int descriptor, std::map<std::string, UdevRecord> known)
+        : EventSource(descriptor)
+        , mKnown(std::move(known))
+    {}
+
+protected:
+    const std::string& takeRaw (boost::asio::streambuf& buf, size_t n) {
+        // Copy the raw bytes out of `buf`'s output sequence, which `writeRecord()` reuses.
+        auto raw = boost::asio::buffer_cast<const char*>(buf.prepare(n));
+        mRaw.assign(raw, n);
+        return mRaw;
+    }
+
+    void add (boost::asio::streambuf& buf, const std::string& name) {
+        auto record = UdevRecord{};
+        if (!mKnown.count(name) && describeTty(sysfsRoot() / "class" / "tty" / name, record)) {
+            record.action = "add";
+            writeRecord(buf, record);
+            mKnown.emplace(name, std::move(record));
+        }
+    }
+
+    std::vector<std::string> knownNames () const {
+        auto names = std::vector<std::string>{};
+        for (auto& kv: mKnown) {
+            names.push_back(kv.first);
+        }
+        return names;
+    }
+
+    void remove (boost::asio::streambuf& buf, const std::string& name) {
+        // The tty is already gone from sysfs, so its DEVPATH comes from when it was added.
+        auto iter = mKnown.find(name);
+        if (iter != mKnown.end()) {
+            iter->second.action = "remove";
+            writeRecord(buf, iter->second);
+            mKnown.erase(iter);
+        }
+    }
+
+private:
+    std::map<std::string, UdevRecord> mKnown;
+    // The ttys reported so far, keyed by name.
+    std::string mRaw;
+};
+
+uint16_t hexProperty (const std::string& value) {
+    return uint16_t(std::strtoul(value.c_str(), nullptr, 16));
+}
+
+class NetlinkEventSource : public EventSource {
+    // Kernel uevents, as sent to the first NETLINK_KOBJECT_UEVENT multicast group. Only the
+    // kernel and privileged processes can send to this group. Each read is one datagram of
+    // NUL-separated strings: `action@devpath` followed by `KEY=value` properties.
+public:
+    using EventSource::EventSource;
+
+    MonitorBackend backend () const override { return MonitorBackend::NETLINK; }
+
+    void commit (boost::asio::streambuf& buf, size_t n) override {
+        USBCDC_TRACE_SCOPE("NetlinkEventSource::commit");
+        // The copy guarantees that the last string is terminated.
+        auto raw = std::string{boost::asio::buffer_cast<const char*>(buf.prepare(n)), n};
+        auto properties = std::map<std::string, std::string>{};
+        for (auto p = raw.c_str(), end = p + n; p < end; p += std::strlen(p) + 1) {
+            auto eq = std::strchr(p, '=');
+            if (eq) {
+                properties[std::string(p, eq)] = eq + 1;
+            }
+        }
+        if (properties["SUBSYSTEM"] != "tty" || properties["DEVNAME"].empty()) {
+            return;
+        }
+
+        auto record = UdevRecord{};
+        record.action = properties["ACTION"];
+        if (properties.count("ID_USB_DRIVER")) {
+            // Already processed by udev, or synthesized as if it had been.
+            record.usbDriver = properties["ID_USB_DRIVER"];
+            record.modelEnc = properties["ID_MODEL_ENC"];
+            record.serialNumber = properties["ID_SERIAL_SHORT"];
+            record.vendorId = hexProperty(properties["ID_VENDOR_ID"]);
+            record.productId = hexProperty(properties["ID_MODEL_ID"]);
+        }
+        else if (record.action == "add"
+                && !describeTty(sysfsRoot() / properties["DEVPATH"], record)) {
+            return;
+        }
+        record.devPath = properties["DEVPATH"];
+        record.devPathOld = properties["DEVPATH_OLD"];
+        record.devName = std::string{kDevDirectory} + "/" + properties["DEVNAME"];
+        if (!record.devNum && properties["MAJOR"].size() && properties["MINOR"].size()) {
+            record.devNum = DeviceCache::makeDevNum(
+                uint32_t(std::strtoul(properties["MAJOR"].c_str(), nullptr, 10)),
+                uint32_t(std::strtoul(properties["MINOR"].c_str(), nullptr, 10)));
+        }
+        writeRecord(buf, record);
+    }
+};
+
+class InotifyEventSource : public SysfsEventSource {
+    // Creation and deletion of device nodes in /dev. Each read is a run of `inotify_event`s.
+public:
+    using SysfsEventSource::SysfsEventSource;
+
+    MonitorBackend backend () const override { return MonitorBackend::INOTIFY; }
+
+    void commit (boost::asio::streambuf& buf, size_t n) override {
+        USBCDC_TRACE_SCOPE("InotifyEventSource::commit");
+        auto& raw = takeRaw(buf, n);
+        for (size_t i = 0; i + sizeof(inotify_event) <= raw.size(); ) {
+            inotify_event event;
+            std::memcpy(&event, raw.data() + i, sizeof(event));
+            auto name = std::string{raw.data() + i + sizeof(event)};
+            i += sizeof(event) + event.len;
+            if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+                add(buf, name);
+            }
+            else if (event.mask & (IN_DELETE | IN_MOVED_FROM)) {
+                remove(buf, name);
+            }
+        }
+    }
+};
+
+class PollingEventSource : public SysfsEventSource {
+    // A timerfd which expires every poll interval, at which point sysfs is rescanned and compared
+    // with the previous scan.
+public:
+    using SysfsEventSource::SysfsEventSource;
+
+    MonitorBackend backend () const override { return MonitorBackend::POLLING; }
+
+    void commit (boost::asio::streambuf& buf, size_t n) override {
+        USBCDC_TRACE_SCOPE("PollingEventSource::commit");
+        takeRaw(buf, n);
+        auto ec = boost::system::error_code{};
+        auto ttys = scanTtys(ec);
+        if (ec) {
+            return;
+        }
+        // Removals go first, so that a device which came back under a new name within one poll
+        // interval can be reported as a RECONNECT.
+        for (auto& name: knownNames()) {
+            if (!ttys.count(name)) {
+                remove(buf, name);
+            }
+        }
+        for (auto& kv: ttys) {
+            add(buf, kv.first);
+        }
+    }
+};
+
+boost::system::error_code lastError () {
+    return {errno, boost::system::system_category()};
+}
+
+bool ueventsDelivered () {
+    // The kernel broadcasts uevents only to network namespaces owned by the initial user
+    // namespace. In any other, such as a rootless container's, binding the socket succeeds but
+    // nothing ever arrives. The initial user namespace maps every uid to itself.
+    fs::ifstream uidMap{fs::path{"/proc/self/uid_map"}};
+    unsigned long inside, outside, count;
+    if (!(uidMap >> inside >> outside >> count)) {
+        // No user namespace support, so there is only the initial one.
+        return true;
+    }
+    return inside == 0 && outside == 0 && count == 4294967295ul;
+}
+
+} // <anonymous>
+
+std::unique_ptr<EventSource> openSysfsEventSource (MonitorBackend backend,
+        boost::system::error_code& ec) {
+    ec = {};
+    switch (backend) {
+        case MonitorBackend::NETLINK: {
+            if (!ueventsDelivered()) {
+                ec = make_error_code(boost::system::errc::not_supported);
+                return nullptr;
+            }
+            auto fd = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                NETLINK_KOBJECT_UEVENT);
+            if (fd < 0) {
+                ec = lastError();
+                return nullptr;
+            }
+            auto address = sockaddr_nl{};
+            address.nl_family = AF_NETLINK;
+            address.nl_groups = 1;
+            if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address))) {
+                ec = lastError();
+                ::close(fd);
+                return nullptr;
+            }
+            return std::make_unique<NetlinkEventSource>(fd);
+        }
+        case MonitorBackend::INOTIFY: {
+            auto known = scanTtys(ec);
+            if (ec) {
+                return nullptr;
+            }
+            auto fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (fd < 0) {
+                ec = lastError();
+                return nullptr;
+            }
+            if (::inotify_add_watch(fd, kDevDirectory,
+                    IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+                ec = lastError();
+                ::close(fd);
+                return nullptr;
+            }
+            return std::make_unique<InotifyEventSource>(fd, std::move(known));
+        }
+        case MonitorBackend::POLLING: {
+            auto known = scanTtys(ec);
+            if (ec) {
+                return nullptr;
+            }
+            auto fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            if (fd < 0) {
+                ec = lastError();
+                return nullptr;
+            }
+            auto interval = timespec{};
+            interval.tv_nsec = std::chrono::nanoseconds{kPollInterval}.count();
+            auto spec = itimerspec{interval, interval};
+            if (::timerfd_settime(fd, 0, &spec, nullptr)) {
+                ec = lastError();
+                ::close(fd);
+                return nullptr;
+            }
+            return std::make_unique<PollingEventSource>(fd, std::move(known));
+        }
+        default:
+            ec = make_error_code(boost::system::errc::not_supported);
+            return nullptr;
+    }
+}
+
+std::unique_ptr<EventSource> ueventEventSource (int descriptor) {
+    return std::make_unique<NetlinkEventSource>(descriptor);
+}
+
+std::vector<UdevRecord> sysfsRecords (boost::system::error_code& ec) {
+    auto records = std::vector<UdevRecord>{};
+    for (auto& kv: scanTtys(ec)) {
+        records.push_back(std::move(kv.second));
+    }
+    return records;
+}
+
+std::vector<UdevRecord> sysfsRecords (std::chrono::steady_clock::time_point deadline,
+        const CancellationToken& cancel, PartialDeviceSet& partial, boost::system::error_code& ec) {
+    USBCDC_TRACE_SCOPE("sysfsRecords (bounded)");
+    using Clock = std::chrono::steady_clock;
+    // How often to check for cancellation while waiting on the worker.
+    const auto kCancelPoll = std::chrono::milliseconds{10};
+
+    // Listing class/tty and reading each tty's driver link only touch kernel-generated directory
+    // entries, never a device. Ttys which are not CDC-ACM candidates, such as virtual consoles
+    // and serial ports, are dropped here, so they are never resolved or reported as timed out.
+    auto ttys = std::deque<std::pair<fs::path, std::future<TtyResolver::Resolution>>>{};
+    auto iter = fs::directory_iterator{sysfsRoot() / "class" / "tty", ec};
+    for (; !ec && iter != fs::directory_iterator{}; iter.increment(ec)) {
+        auto driverEc = boost::system::error_code{};
+        auto driver = fs::read_symlink(iter->path() / "device" / "driver", driverEc);
+        if (!driverEc && driver.filename() == "cdc_acm") {
+            ttys.emplace_back(iter->path(), std::future<TtyResolver::Resolution>{});
+        }
+    }
+    if (ec) {
+        return {};
+    }
+
+    auto resolver = std::make_unique<TtyResolver>();
+    for (auto& tty: ttys) {
+        tty.second = resolver->submit(tty.first);
+    }
+
+    auto records = std::vector<UdevRecord>{};
+    while (ttys.size()) {
+        auto& tty = ttys.front();
+        auto giveUp = std::min(deadline, Clock::now() + kDeviceResolveTimeout);
+        auto ready = false;
+        for (;;) {
+            ready = tty.second.wait_until(std::min(giveUp, Clock::now() + kCancelPoll))
+                == std::future_status::ready;
+            if (ready || (partial.cancelled = cancel.cancelled()) || Clock::now() >= giveUp) {
+                break;
+            }
+        }
+
+        if (ready) {
+            auto resolution = tty.second.get();
+            if (resolution.first) {
+                records.push_back(std::move(resolution.second));
+            }
+            ttys.pop_front();
+        }
+        else if (partial.cancelled || Clock::now() >= deadline) {
+            for (auto& t: ttys) {
+                partial.timedOut.push_back(t.first.string());
+            }
+            break;
+        }
+        else {
+            // This tty wedged the worker. Leave it behind, and resolve the rest on a fresh one.
+            partial.timedOut.push_back(tty.first.string());
+            ttys.pop_front();
+            resolver = std::make_unique<TtyResolver>();
+            for (auto& t: ttys) {
+                t.second = resolver->submit(t.first);
+            }
+        }
+    }
+    return records;
+}
+
+} // usbcdc
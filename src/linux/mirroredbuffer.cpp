@@ -0,0 +1,111 @@
+#include <usbcdc/linux/mirroredbuffer.hpp>
+
+#include <boost/asio/detail/throw_error.hpp>
+
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace usbcdc {
+
+namespace {
+
+boost::system::error_code lastError () {
+    return {errno, boost::system::system_category()};
+}
+
+} // <anonymous>
+
+MirroredBuffer::MirroredBuffer (size_t capacity) {
+    auto page = size_t(::sysconf(_SC_PAGESIZE));
+    mCapacity = std::max(page, (capacity + page - 1) / page * page);
+
+    auto fd = ::memfd_create("usbcdc-mirroredbuffer", MFD_CLOEXEC);
+    if (fd < 0) {
+        boost::asio::detail::throw_error(lastError(), "memfd_create");
+    }
+    if (::ftruncate(fd, off_t(mCapacity))) {
+        auto ec = lastError();
+        ::close(fd);
+        boost::asio::detail::throw_error(ec, "ftruncate");
+    }
+
+    // Reserve the address range for both views first, so that nothing else can be mapped between
+    // them, then map the memfd over each half.
+    auto base = ::mmap(nullptr, 2 * mCapacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        auto ec = lastError();
+        ::close(fd);
+        boost::asio::detail::throw_error(ec, "mmap");
+    }
+    mData = static_cast<char*>(base);
+    for (auto view: {mData, mData + mCapacity}) {
+        if (::mmap(view, mCapacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)
+                == MAP_FAILED) {
+            auto ec = lastError();
+            ::close(fd);
+            unmap();
+            boost::asio::detail::throw_error(ec, "mmap");
+        }
+    }
+    // The mappings keep the memfd's pages alive.
+    ::close(fd);
+}
+
+MirroredBuffer::~MirroredBuffer () {
+    unmap();
+}
+
+MirroredBuffer::MirroredBuffer (MirroredBuffer&& other) noexcept
+    : mData(other.mData)
+    , mCapacity(other.mCapacity)
+    , mBegin(other.mBegin)
+    , mSize(other.mSize)
+{
+    other.mData = nullptr;
+    other.mCapacity = other.mBegin = other.mSize = 0;
+}
+
+MirroredBuffer& MirroredBuffer::operator= (MirroredBuffer&& other) noexcept {
+    if (this != &other) {
+        unmap();
+        mData = other.mData;
+        mCapacity = other.mCapacity;
+        mBegin = other.mBegin;
+        mSize = other.mSize;
+        other.mData = nullptr;
+        other.mCapacity = other.mBegin = other.mSize = 0;
+    }
+    return *this;
+}
+
+MirroredBuffer::mutable_buffers_type MirroredBuffer::prepare (size_t n) {
+    if (n > space()) {
+        throw std::length_error{"MirroredBuffer too small"};
+    }
+    // The free space starts at most one capacity past `mData`, so it always lies in the views.
+    return mutable_buffers_type{mData + mBegin + mSize, n};
+}
+
+void MirroredBuffer::consume (size_t n) {
+    n = std::min(n, mSize);
+    mBegin += n;
+    if (mBegin >= mCapacity) {
+        mBegin -= mCapacity;
+    }
+    mSize -= n;
+    if (!mSize) {
+        // Keep reads page-aligned when the consumer keeps up.
+        mBegin = 0;
+    }
+}
+
+void MirroredBuffer::unmap () {
+    if (mData) {
+        ::munmap(mData, 2 * mCapacity);
+        mData = nullptr;
+    }
+}
+
+} // usbcdc
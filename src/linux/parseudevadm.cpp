@@ -1,25 +1,24 @@
 #include <usbcdc/monitor.hpp>
+#include <usbcdc/trace.hpp>
 
 #include <util/log.hpp>
 
-#include <boost/spirit/include/phoenix_operator.hpp>
+#include <boost/spirit/include/phoenix_bind.hpp>
 #include <boost/spirit/include/phoenix_fusion.hpp>
-#include <boost/spirit/include/phoenix_stl.hpp>
 #include <boost/spirit/include/qi.hpp>
 
 #include <boost/fusion/adapted.hpp>
 
+#include <boost/asio/buffers_iterator.hpp>
 #include <boost/asio/streambuf.hpp>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/range/iterator_range.hpp>
 
-#include <boost/algorithm/string/find_format.hpp>
-#include <boost/algorithm/string/regex_find_format.hpp>
-#include <boost/algorithm/hex.hpp>
-
-#include <chrono>
-#include <iostream>
-#include <map>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
 #include <string>
 
 namespace usbcdc {
@@ -27,22 +26,39 @@ namespace usbcdc {
 namespace {
 namespace qi = boost::spirit::qi;
 
+const char* const kProperties[] = {
+    // The properties a `UdevRecord` is built from, in the order `UdevadmGrammar::begin()` takes
+    // their destinations.
+    "ACTION", "DEVPATH", "DEVPATH_OLD", "DEVNAME", "ID_USB_DRIVER", "ID_MODEL_ENC",
+    "ID_SERIAL_SHORT", "ID_VENDOR_ID", "ID_MODEL_ID", "MAJOR", "MINOR"
+};
+
+constexpr size_t kPropertyCount = sizeof(kProperties) / sizeof(kProperties[0]);
+
 template <class Iter>
-struct UdevadmGrammar : qi::grammar<Iter, std::map<std::string, std::string>()> {
-    qi::rule<Iter, std::map<std::string, std::string>()> start;
+struct UdevadmGrammar : qi::grammar<Iter> {
+    // Matches one record, handing each property's key and value to `store()` as iterator ranges,
+    // so that matching itself builds no strings.
+    using Range = boost::iterator_range<Iter>;
+
+    qi::rule<Iter> start;
     qi::rule<Iter> nonProperty;
-    qi::rule<Iter, std::pair<std::string, std::string>()> property;
-    qi::rule<Iter, std::string()> key;
-    qi::rule<Iter, std::string()> value;
+    qi::rule<Iter> property;
+    qi::rule<Iter, Range()> key;
+    qi::rule<Iter, Range()> value;
+
+    std::array<std::string*, kPropertyCount> destinations;
+    unsigned stored = 0;
+    // A bit per property already stored: the first occurrence of a repeated property wins.
+    size_t properties = 0;
+    // How many properties, wanted or not, the record had.
 
     UdevadmGrammar () : UdevadmGrammar::base_type(start, "udevadm") {
-        using qi::_1;
-        using qi::_val;
         using boost::phoenix::at_c;
-        using boost::phoenix::insert;
+        using boost::phoenix::bind;
 
         start.name("start");
-        start = *(property[insert(_val, _1)] | nonProperty)
+        start = *(property | nonProperty)
             >> qi::eol
             > qi::eoi;
 
@@ -50,13 +66,14 @@ struct UdevadmGrammar : qi::grammar<Iter, std::map<std::string, std::string>()>
         nonProperty = +(qi::char_ - qi::eol) >> qi::eol;
 
         property.name("property");
-        property %= key >> '=' >> value >> qi::eol;
+        property = (key >> '=' >> value >> qi::eol)
+            [bind(&UdevadmGrammar::store, this, qi::_1, qi::_2)];
 
         key.name("key");
-        key %= +(qi::char_ - qi::eol - '=');
+        key %= qi::raw[+(qi::char_ - qi::eol - '=')];
 
         value.name("value");
-        value %= +(qi::char_ - qi::eol);
+        value %= qi::raw[+(qi::char_ - qi::eol)];
 
         using ErrorHandlerArgs = boost::fusion::vector<
             Iter&, const Iter&, const Iter&, const qi::info&>;
@@ -73,69 +90,165 @@ struct UdevadmGrammar : qi::grammar<Iter, std::map<std::string, std::string>()>
         qi::on_error<qi::fail>(key, logError);
         qi::on_error<qi::fail>(value, logError);
     }
+
+    void begin (const std::array<std::string*, kPropertyCount>& d) {
+        // Parse the next record into `d`, whose strings are emptied but keep their capacity.
+        destinations = d;
+        for (auto s: destinations) {
+            s->clear();
+        }
+        stored = 0;
+        properties = 0;
+    }
+
+    void store (const Range& k, const Range& v) {
+        ++properties;
+        for (size_t i = 0; i < kPropertyCount; ++i) {
+            auto name = kProperties[i];
+            auto length = std::strlen(name);
+            if (size_t(k.size()) == length && std::equal(k.begin(), k.end(), name)) {
+                if (!(stored & 1u << i)) {
+                    stored |= 1u << i;
+                    auto& out = *destinations[i];
+                    out.resize(size_t(v.size()));
+                    std::copy(v.begin(), v.end(), &out[0]);
+                }
+                return;
+            }
+        }
+    }
 };
 
+const std::array<int8_t, 256>& hexDigits () {
+    // The value of each byte as a hexadecimal digit, or -1.
+    static const auto table = [] {
+        auto t = std::array<int8_t, 256>{};
+        t.fill(-1);
+        for (int i = 0; i < 10; ++i) {
+            t['0' + i] = int8_t(i);
+        }
+        for (int i = 0; i < 6; ++i) {
+            t['a' + i] = t['A' + i] = int8_t(10 + i);
+        }
+        return t;
+    }();
+    return table;
+}
+
+} // <anonymous>
+
 std::string decodeProductString (std::string input) {
     // udev encodes some characters, such as spaces, to an escaped character sequence of the form
-    // `\xhh` where `h` is a hexadecimal digit. Decode all such instances. This is a bit ugly.
-    boost::algorithm::find_format_all(
-        input,
-        boost::algorithm::regex_finder(boost::regex(R"(\\x([0-9a-fA-F]{2}))")),
-        // I originally tried `regex_formatter(std::string(R"(\x\1)"))` instead of this lambda,
-        // but this does not produce a correct string, and it causes a segfault later that I didn't
-        // figure out.
-        [](const auto& result) {
-            char c;
-            assert(std::distance(result.begin(), result.end()) == 4);
-            // We know that the regex can only match 4-character substrings. If we interpret only
-            // the latter two characters as hexadecimal digits, the decoded integer is guaranteed
-            // to fit in our `char c`.
-            boost::algorithm::unhex(result.begin() + 2, result.end(), &c);
-            return std::string{c};
+    // `\xhh` where `h` is a hexadecimal digit. Decode all such instances in one pass, in place:
+    // `out` never gets ahead of `in`, since each escape shrinks four characters to one. Runs of
+    // plain characters between backslashes are found with `memchr()` and moved in one go.
+    auto& digits = hexDigits();
+    auto begin = &input[0];
+    auto end = begin + input.size();
+    auto in = static_cast<char*>(std::memchr(begin, '\\', input.size()));
+    if (!in) {
+        return input;
+    }
+    auto out = in;
+    while (in != end) {
+        if (*in == '\\' && end - in >= 4 && in[1] == 'x') {
+            auto hi = digits[uint8_t(in[2])];
+            auto lo = digits[uint8_t(in[3])];
+            if (hi >= 0 && lo >= 0) {
+                *out++ = char(hi << 4 | lo);
+                in += 4;
+                continue;
+            }
         }
-    );
+        auto next = static_cast<char*>(std::memchr(in + 1, '\\', end - in - 1));
+        auto stop = next ? next : end;
+        std::memmove(out, in, stop - in);
+        out += stop - in;
+        in = stop;
+    }
+    input.resize(out - begin);
     return input;
 }
 
-bool parseUdevadm (boost::asio::streambuf& buf, size_t n,
-        std::map<std::string, std::string>& properties) {
+struct UdevadmParser::Impl {
+    using Iter = boost::asio::buffers_iterator<boost::asio::streambuf::const_buffers_type>;
+
+    UdevadmGrammar<Iter> grammar;
+    std::string vendorId;
+    std::string productId;
+    std::string major;
+    std::string minor;
+    // Properties which the record holds as numbers, parsed from these.
+};
+
+UdevadmParser::UdevadmParser () : mImpl(std::make_unique<Impl>()) {}
+UdevadmParser::~UdevadmParser () = default;
+UdevadmParser::UdevadmParser (UdevadmParser&&) noexcept = default;
+UdevadmParser& UdevadmParser::operator= (UdevadmParser&&) noexcept = default;
+
+bool UdevadmParser::parse (boost::asio::streambuf& buf, size_t n, UdevRecord& record) {
+    USBCDC_TRACE_SCOPE("parseUdevadm");
+    auto& impl = *mImpl;
+    impl.grammar.begin({{&record.action, &record.devPath, &record.devPathOld, &record.devName,
+        &record.usbDriver, &record.modelEnc, &record.serialNumber,
+        &impl.vendorId, &impl.productId, &impl.major, &impl.minor}});
     auto begin = boost::asio::buffers_begin(buf.data());
     auto end = begin + n;
-    UdevadmGrammar<decltype(begin)> grammar;
-    return qi::parse(begin, end, grammar, properties);
+    if (!qi::parse(begin, end, impl.grammar) || !impl.grammar.properties) {
+        return false;
+    }
+
+    USBCDC_TRACE_SCOPE("UdevRecord");
+    record.vendorId = 0;
+    record.productId = 0;
+    try {
+        if (impl.vendorId.size() && impl.productId.size()) {
+            record.vendorId = uint16_t(std::stoul(impl.vendorId, nullptr, 16));
+            record.productId = uint16_t(std::stoul(impl.productId, nullptr, 16));
+        }
+    }
+    catch (std::exception&) {}
+    record.devNum = 0;
+    try {
+        if (impl.major.size() && impl.minor.size()) {
+            record.devNum = DeviceCache::makeDevNum(
+                boost::lexical_cast<uint32_t>(impl.major), boost::lexical_cast<uint32_t>(impl.minor));
+        }
+    }
+    catch (boost::bad_lexical_cast&) {}
+
+    return true;
 }
 
-} // <anonymous>
+bool parseUdevadm (boost::asio::streambuf& buf, size_t n, UdevRecord& record) {
+    return UdevadmParser{}.parse(buf, n, record);
+}
 
 bool parseUdevadm (boost::asio::streambuf& buf, size_t n, Device& device) {
-    auto properties = std::map<std::string, std::string>{};
-    auto success = parseUdevadm(buf, n, properties);
-
-    if (!success || !properties.size() || properties["ID_USB_DRIVER"] != "cdc_acm") {
+    auto record = UdevRecord{};
+    if (!parseUdevadm(buf, n, record) || record.usbDriver != "cdc_acm") {
         return false;
     }
 
-    device.path(properties["DEVNAME"]);
-    device.productString(decodeProductString(properties["ID_MODEL_ENC"]));
+    device.path(record.devName);
+    device.productString(decodeProductString(std::move(record.modelEnc)));
 
     return true;
 }
 
 bool parseUdevadm (boost::asio::streambuf& buf, size_t n, DeviceEvent& event) {
-    auto properties = std::map<std::string, std::string>{};
-    auto success = parseUdevadm(buf, n, properties);
-
-    if (!success || !properties.size() || properties["ID_USB_DRIVER"] != "cdc_acm") {
+    auto record = UdevRecord{};
+    if (!parseUdevadm(buf, n, record) || record.usbDriver != "cdc_acm") {
         return false;
     }
 
-    event.device.path(properties["DEVNAME"]);
-    event.device.productString(decodeProductString(properties["ID_MODEL_ENC"]));
+    event.device.path(record.devName);
+    event.device.productString(decodeProductString(std::move(record.modelEnc)));
 
-    if (properties["ACTION"] == "add") {
+    if (record.action == "add") {
         event.type = DeviceEvent::ADD;
     }
-    else if (properties["ACTION"] == "remove") {
+    else if (record.action == "remove") {
         event.type = DeviceEvent::REMOVE;
     }
     else {
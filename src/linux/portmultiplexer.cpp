@@ -0,0 +1,351 @@
+#include <usbcdc/linux/portmultiplexer.hpp>
+
+#include "../posix/rawport.hpp"
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/detail/throw_error.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace usbcdc {
+
+constexpr size_t PortMultiplexer::kDefaultBufferSize;
+
+static boost::system::error_code lastError () {
+    return boost::system::error_code{errno, boost::system::system_category()};
+}
+
+static int createEpoll () {
+    auto fd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (fd < 0) {
+        boost::asio::detail::throw_error(lastError(), "epoll_create1");
+    }
+    return fd;
+}
+
+PortMultiplexer::PortMultiplexer (boost::asio::io_service& context, size_t bufferSize)
+    : mEpoll(context, createEpoll())
+    , mBufferSize(bufferSize)
+    , mEvents(1)
+{}
+
+PortMultiplexer::~PortMultiplexer () {
+    close();
+}
+
+void PortMultiplexer::add (const Device& device, const SerialProfile& profile,
+        boost::system::error_code& ec) {
+    if (mPorts.count(device.path())) {
+        ec = boost::asio::error::already_open;
+        return;
+    }
+    auto fd = openRawPort(device.path(), profile, ec);
+    if (fd < 0) {
+        return;
+    }
+    insert(device, fd, {}, ec);
+}
+
+void PortMultiplexer::adopt (const Device& device, SerialStream& stream,
+        boost::system::error_code& ec) {
+    if (mPorts.count(device.path())) {
+        ec = boost::asio::error::already_open;
+        return;
+    }
+    if (!stream.is_open()) {
+        ec = boost::asio::error::bad_descriptor;
+        return;
+    }
+    auto fd = stream.release();
+    auto pending = std::vector<char>(stream.prebuffered());
+    if (pending.size()) {
+        stream.read_some(boost::asio::buffer(pending), ec);
+    }
+    // The stream may have left the descriptor blocking, which would stall a wake-up's reads.
+    auto flags = ::fcntl(fd, F_GETFL);
+    if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        ec = lastError();
+        ::close(fd);
+        return;
+    }
+    auto adopted = PortStatistics::Clock::now();
+    auto hasPending = !pending.empty();
+    insert(device, fd, std::move(pending), ec);
+    if (!ec && hasPending) {
+        // Delivered from a handler of its own, so that the read handler is never reentered.
+        ioContext(mEpoll).post(
+            [this, lifetime = std::weak_ptr<char>(mLifetime), path = device.path(), adopted] {
+                if (!lifetime.expired()) {
+                    deliverPending(path, adopted);
+                }
+            });
+    }
+}
+
+void PortMultiplexer::insert (const Device& device, int fd, std::vector<char> pending,
+        boost::system::error_code& ec) {
+    auto filled = pending.size();
+    pending.resize(std::max(mBufferSize, filled));
+    auto port = std::unique_ptr<Port>(new Port{device, fd, std::move(pending), filled, false,
+        std::make_shared<PortStatistics>(), {}});
+
+    // Level-triggered, so a port whose buffer filled before the tty was drained is simply
+    // reported again on the next wake-up. A tty's hangup shows up as EPOLLHUP, which epoll always
+    // reports, and as a failed read.
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = port.get();
+    if (::epoll_ctl(mEpoll.native_handle(), EPOLL_CTL_ADD, fd, &ev)) {
+        ec = lastError();
+        ::close(fd);
+        return;
+    }
+    auto now = PortStatistics::Clock::now();
+    port->statistics->opened(now);
+    if (filled) {
+        port->statistics->received(filled, now);
+        port->statistics->queue(filled);
+    }
+    ec = {};
+    mPorts.emplace(device.path(), std::move(port));
+    // The per-wake-up vectors grow at the start of the next wake-up, not here: a handler may be
+    // adding this port while the current batch is being iterated.
+}
+
+void PortMultiplexer::remove (const std::string& path) {
+    auto iter = mPorts.find(path);
+    if (iter != mPorts.end()) {
+        closePort(*iter->second, {});
+    }
+}
+
+size_t PortMultiplexer::write (const std::string& path, boost::asio::const_buffer data,
+        boost::system::error_code& ec) {
+    auto iter = mPorts.find(path);
+    if (iter == mPorts.end()) {
+        ec = boost::asio::error::bad_descriptor;
+        return 0;
+    }
+    auto n = ::write(iter->second->fd, boost::asio::buffer_cast<const void*>(data),
+        boost::asio::buffer_size(data));
+    if (n < 0) {
+        ec = errno == EAGAIN ? make_error_code(boost::asio::error::would_block) : lastError();
+        return 0;
+    }
+    ec = {};
+    iter->second->statistics->sent(size_t(n), PortStatistics::Clock::now());
+    return size_t(n);
+}
+
+std::shared_ptr<const PortStatistics> PortMultiplexer::statistics (const std::string& path) const {
+    auto iter = mPorts.find(path);
+    return iter != mPorts.end() ? iter->second->statistics : nullptr;
+}
+
+void PortMultiplexer::start () {
+    arm();
+}
+
+void PortMultiplexer::close () {
+    auto ports = std::vector<Port*>{};
+    for (auto& kv: mPorts) {
+        ports.push_back(kv.second.get());
+    }
+    for (auto port: ports) {
+        closePort(*port, boost::asio::error::operation_aborted);
+    }
+    // `mGraveyard` is left alone: we may be inside a handler which refers to one of its ports.
+    boost::system::error_code ec;
+    mEpoll.close(ec);
+}
+
+void PortMultiplexer::handleEvent (const DeviceEvent& event,
+        const std::function<bool(const Device&)>& filter, const SerialProfile& profile) {
+    switch (event.type) {
+        case DeviceEvent::RECONNECT:
+            remove(event.previousPath);
+            // fall through
+        case DeviceEvent::ADD:
+            open(event.device, filter, profile, event.stream.get());
+            break;
+        case DeviceEvent::REMOVE:
+            remove(event.device.path());
+            break;
+        case DeviceEvent::RESYNC:
+            reconcile(devices(), filter, profile);
+            break;
+    }
+}
+
+void PortMultiplexer::reconcile (const DeviceSet& present,
+        const std::function<bool(const Device&)>& filter, const SerialProfile& profile) {
+    auto paths = std::unordered_set<std::string>{};
+    for (const auto& device: present) {
+        paths.insert(device.path());
+    }
+    auto gone = std::vector<std::string>{};
+    for (const auto& kv: mPorts) {
+        if (!paths.count(kv.first)) {
+            gone.push_back(kv.first);
+        }
+    }
+    for (const auto& path: gone) {
+        remove(path);
+    }
+    for (const auto& device: present) {
+        if (!mPorts.count(device.path())) {
+            open(device, filter, profile, nullptr);
+        }
+    }
+}
+
+void PortMultiplexer::open (const Device& device,
+        const std::function<bool(const Device&)>& filter, const SerialProfile& profile,
+        SerialStream* stream) {
+    if (filter && !filter(device)) {
+        return;
+    }
+    boost::system::error_code ec;
+    if (stream) {
+        adopt(device, *stream, ec);
+    }
+    else {
+        add(device, profile, ec);
+    }
+    if (ec && mCloseHandler) {
+        mCloseHandler(device, ec);
+    }
+}
+
+void PortMultiplexer::deliverPending (const std::string& path,
+        PortStatistics::Clock::time_point adopted) {
+    // A wake-up which found the port readable first has delivered the pending bytes already,
+    // along with what it read.
+    auto iter = mPorts.find(path);
+    if (iter == mPorts.end() || !iter->second->filled) {
+        return;
+    }
+    auto& port = *iter->second;
+    if (mReadHandler) {
+        port.statistics->handled(adopted, PortStatistics::Clock::now());
+        mReadHandler({PortData{port.device, boost::asio::buffer(port.buffer.data(), port.filled)}});
+    }
+    port.filled = 0;
+    port.statistics->queue(0);
+}
+
+void PortMultiplexer::arm () {
+    if (mArmed || !mEpoll.is_open()) {
+        return;
+    }
+    mArmed = true;
+    mEpoll.async_read_some(boost::asio::null_buffers(),
+        [this, lifetime = std::weak_ptr<char>(mLifetime)](boost::system::error_code ec, size_t) {
+            if (!lifetime.expired()) {
+                onReady(ec);
+            }
+        });
+}
+
+void PortMultiplexer::onReady (boost::system::error_code ec) {
+    mArmed = false;
+    if (ec) {
+        return;
+    }
+
+    auto ready = PortStatistics::Clock::now();
+    mEvents.resize(std::max(mEvents.size(), mPorts.size()));
+    mReady.clear();
+    mBatch.clear();
+    mReady.reserve(mPorts.size());
+    mBatch.reserve(mPorts.size());
+    auto nEvents = ::epoll_wait(mEpoll.native_handle(), mEvents.data(), int(mEvents.size()), 0);
+    for (int i = 0; i < nEvents; ++i) {
+        auto& port = *static_cast<Port*>(mEvents[i].data.ptr);
+        if (port.closed) {
+            continue;
+        }
+        drain(port, ready);
+        if (!port.closed) {
+            mReady.push_back(&port);
+        }
+    }
+    // Build the batch only after draining, since draining may close ports.
+    for (auto port: mReady) {
+        if (!port->closed && port->filled) {
+            mBatch.push_back(PortData{port->device,
+                boost::asio::buffer(port->buffer.data(), port->filled)});
+        }
+    }
+    if (mBatch.size() && mReadHandler) {
+        auto now = PortStatistics::Clock::now();
+        for (auto port: mReady) {
+            if (!port->closed && port->filled) {
+                port->statistics->handled(ready, now);
+            }
+        }
+        mReadHandler(mBatch);
+    }
+    for (auto port: mReady) {
+        port->filled = 0;
+        port->statistics->queue(0);
+    }
+    for (auto port: mReady) {
+        if (port->hangup) {
+            closePort(*port, port->hangup);
+        }
+    }
+    mGraveyard.clear();
+    arm();
+}
+
+void PortMultiplexer::drain (Port& port, PortStatistics::Clock::time_point now) {
+    // Read until the tty is empty or the buffer is full.
+    auto& n = port.filled;
+    while (n < port.buffer.size()) {
+        auto rc = ::read(port.fd, port.buffer.data() + n, port.buffer.size() - n);
+        if (rc > 0) {
+            n += size_t(rc);
+            port.statistics->received(size_t(rc), now);
+            port.statistics->queue(n);
+            continue;
+        }
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        // EOF or an error such as EIO after the device was unplugged. The port is closed after
+        // the read handler has seen what was read before.
+        port.hangup = rc ? lastError() : make_error_code(boost::asio::error::eof);
+        return;
+    }
+}
+
+void PortMultiplexer::closePort (Port& port, boost::system::error_code ec) {
+    if (port.closed) {
+        return;
+    }
+    port.closed = true;
+    port.statistics->closed();
+    if (mEpoll.is_open()) {
+        ::epoll_ctl(mEpoll.native_handle(), EPOLL_CTL_DEL, port.fd, nullptr);
+    }
+    ::close(port.fd);
+    auto iter = mPorts.find(port.device.path());
+    if (iter != mPorts.end()) {
+        mGraveyard.push_back(std::move(iter->second));
+        mPorts.erase(iter);
+    }
+    if (ec && ec != boost::asio::error::operation_aborted && mCloseHandler) {
+        mCloseHandler(mGraveyard.back()->device, ec);
+    }
+}
+
+} // usbcdc
@@ -0,0 +1,28 @@
+#include "sysfs.hpp"
+
+#include <boost/filesystem/fstream.hpp>
+
+#include <exception>
+
+namespace fs = boost::filesystem;
+
+namespace usbcdc {
+
+std::string readAttribute (const fs::path& p) {
+    auto value = std::string{};
+    fs::ifstream stream{p};
+    std::getline(stream, value);
+    return value;
+}
+
+uint16_t readHexAttribute (const fs::path& p) {
+    auto value = readAttribute(p);
+    try {
+        return value.size() ? uint16_t(std::stoul(value, nullptr, 16)) : 0;
+    }
+    catch (std::exception&) {
+        return 0;
+    }
+}
+
+} // namespace usbcdc
@@ -0,0 +1,19 @@
+#ifndef USBCDC_LINUX_SYSFS_HPP
+#define USBCDC_LINUX_SYSFS_HPP
+
+#include <boost/filesystem/path.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace usbcdc {
+
+std::string readAttribute (const boost::filesystem::path& p);
+// The first line of the sysfs attribute at `p`, or an empty string if it cannot be read.
+
+uint16_t readHexAttribute (const boost::filesystem::path& p);
+// A hexadecimal sysfs attribute such as `idVendor`, or 0 if it cannot be read or parsed.
+
+} // namespace usbcdc
+
+#endif
@@ -1,4 +1,5 @@
 #include <usbcdc/devices.hpp>
+#include <usbcdc/trace.hpp>
 
 #include "osx_sharedioobject.hpp"
 
@@ -138,6 +139,7 @@ private:
 };
 
 DeviceSet devices () {
+    USBCDC_TRACE_SCOPE("devices");
     using std::begin;
     using std::end;
     auto it = DeviceIterator{};
@@ -0,0 +1,51 @@
+#include <usbcdc/pollschedule.hpp>
+
+#include <algorithm>
+
+namespace usbcdc {
+
+constexpr std::chrono::milliseconds PollSchedule::kDefaultMinimum;
+constexpr std::chrono::milliseconds PollSchedule::kDefaultMaximum;
+constexpr std::chrono::milliseconds PollSchedule::kDefaultFastWindow;
+constexpr double PollSchedule::kDefaultBackoff;
+
+PollSchedule::PollSchedule () {
+    mStatistics.interval = mMinimum;
+}
+
+void PollSchedule::minimum (Clock::duration d) {
+    mMinimum = std::max(d, Clock::duration{1});
+    mMaximum = std::max(mMaximum, mMinimum);
+    mStatistics.interval = mMinimum;
+}
+
+void PollSchedule::maximum (Clock::duration d) {
+    mMaximum = std::max(d, mMinimum);
+    mStatistics.interval = mMinimum;
+}
+
+void PollSchedule::polled (Clock::time_point now, bool changed) {
+    mLastPoll = now;
+    ++mStatistics.polls;
+    if (changed) {
+        ++mStatistics.changes;
+        mFastUntil = now + mFastWindow;
+    }
+    auto& interval = mStatistics.interval;
+    if (now < mFastUntil) {
+        ++mStatistics.fastPolls;
+        interval = mMinimum;
+    }
+    else {
+        auto grown = std::chrono::duration_cast<Clock::duration>(interval * mBackoff);
+        interval = std::min(std::max(grown, mMinimum), mMaximum);
+    }
+}
+
+void PollSchedule::wake (Clock::time_point now) {
+    ++mStatistics.wakes;
+    mFastUntil = std::max(mFastUntil, now + mFastWindow);
+    mStatistics.interval = mMinimum;
+}
+
+} // usbcdc
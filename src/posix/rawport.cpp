@@ -0,0 +1,77 @@
+#include "rawport.hpp"
+
+#include <boost/predef.h>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#if BOOST_OS_LINUX
+#include <linux/serial.h>
+#endif
+
+#include <cerrno>
+
+namespace usbcdc {
+
+static boost::system::error_code lastError () {
+    return boost::system::error_code{errno, boost::system::system_category()};
+}
+
+static bool configureRaw (int fd, boost::system::error_code& ec) {
+    termios tio;
+    if (::tcgetattr(fd, &tio)) {
+        ec = lastError();
+        return false;
+    }
+    ::cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+    tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+    // CDC-ACM devices ignore the line rate, but some firmware keys off of it, so pick the rate
+    // Barobo firmware has always been opened at.
+    ::cfsetispeed(&tio, B115200);
+    ::cfsetospeed(&tio, B115200);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    if (::tcsetattr(fd, TCSANOW, &tio) || ::tcflush(fd, TCIOFLUSH)) {
+        ec = lastError();
+        return false;
+    }
+    return true;
+}
+
+static void requestLowLatency (int fd) {
+#if BOOST_OS_LINUX
+    // Best effort, and usually ignored: cdc_acm accepts TIOCSSERIAL but only honours its close
+    // delays, and ptys reject it. A few USB serial drivers, such as ftdi_sio, shorten their
+    // latency timer in response.
+    serial_struct ss;
+    if (!::ioctl(fd, TIOCGSERIAL, &ss)) {
+        ss.flags |= ASYNC_LOW_LATENCY;
+        ::ioctl(fd, TIOCSSERIAL, &ss);
+    }
+#else
+    (void)fd;
+#endif
+}
+
+int openRawPort (const std::string& path, const SerialProfile& profile,
+        boost::system::error_code& ec) {
+    auto fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        ec = lastError();
+        return -1;
+    }
+    if (!configureRaw(fd, ec)) {
+        ::close(fd);
+        return -1;
+    }
+    if (profile.lowLatency) {
+        requestLowLatency(fd);
+    }
+    return fd;
+}
+
+} // usbcdc
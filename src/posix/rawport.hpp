@@ -0,0 +1,19 @@
+#ifndef USBCDC_POSIX_RAWPORT_HPP
+#define USBCDC_POSIX_RAWPORT_HPP
+
+#include <usbcdc/serialstream.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <string>
+
+namespace usbcdc {
+
+int openRawPort (const std::string& path, const SerialProfile& profile,
+        boost::system::error_code& ec);
+// Open the tty at `path` non-blocking and close-on-exec, put it in raw mode, apply `profile`'s
+// driver settings, and discard any stale I/O. Return the file descriptor, or -1 and set `ec`.
+
+} // namespace usbcdc
+
+#endif
@@ -0,0 +1,136 @@
+#include <usbcdc/serialstream.hpp>
+
+#include "rawport.hpp"
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/detail/throw_error.hpp>
+
+#include <cerrno>
+
+#include <poll.h>
+#include <unistd.h>
+
+namespace usbcdc {
+
+void SerialStream::open (const Device& device, const SerialProfile& profile,
+        boost::system::error_code& ec) {
+    if (is_open()) {
+        ec = boost::asio::error::already_open;
+        return;
+    }
+    auto fd = openRawPort(device.path(), profile, ec);
+    if (fd < 0) {
+        return;
+    }
+    mStream.assign(fd, ec);
+    if (ec) {
+        ::close(fd);
+        return;
+    }
+    if (profile.spinBudget.count()) {
+        // Make `read_some()` report would_block rather than wait in the reactor, so that
+        // `async_read_some()` can spin on it.
+        mStream.non_blocking(true, ec);
+    }
+    mProfile = profile;
+    mStatistics->opened(PortStatistics::Clock::now());
+}
+
+void SerialStream::open (const Device& device, const SerialProfile& profile) {
+    boost::system::error_code ec;
+    open(device, profile, ec);
+    boost::asio::detail::throw_error(ec, "open");
+}
+
+void SerialStream::prebuffer (size_t limit) {
+    std::lock_guard<std::mutex> lock{mPrebuffer->mutex};
+    if (!is_open() || mPrebuffer->active.load(std::memory_order_relaxed) || !limit) {
+        return;
+    }
+    auto fd = ::dup(native_handle());
+    if (fd < 0) {
+        return;
+    }
+    boost::system::error_code ec;
+    mPrebufferWatch.assign(fd, ec);
+    if (ec) {
+        ::close(fd);
+        return;
+    }
+    mStream.non_blocking(true, ec);
+    if (ec) {
+        mPrebufferWatch.close(ec);
+        return;
+    }
+    mPrebuffer->limit = mPrebuffer->data.size() + limit;
+    mPrebuffer->data.reserve(mPrebuffer->limit);
+    mPrebuffer->active.store(true, std::memory_order_relaxed);
+    awaitPrebufferInput();
+}
+
+void SerialStream::awaitPrebufferInput () {
+    // A readiness wait rather than a read, so that a read issued by the owner later is never
+    // queued behind one of ours.
+    mPrebufferWatch.async_read_some(boost::asio::null_buffers(),
+        [this, prebuffer = mPrebuffer](boost::system::error_code ec, size_t) {
+            // The stream stops prebuffering before it is destroyed, so `this` is valid while
+            // `active` is set.
+            std::lock_guard<std::mutex> lock{prebuffer->mutex};
+            auto& p = *prebuffer;
+            if (!p.active.load(std::memory_order_relaxed)) {
+                return;
+            }
+            if (!ec) {
+                auto old = p.data.size();
+                p.data.resize(p.limit);
+                auto n = mStream.read_some(boost::asio::buffer(&p.data[old], p.limit - old), ec);
+                p.data.resize(old + n);
+                mStatistics->received(n, PortStatistics::Clock::now());
+                mStatistics->queue(p.unread());
+                if (ec == boost::asio::error::would_block) {
+                    ec = {};
+                }
+            }
+            if (ec || p.data.size() == p.limit) {
+                // Errors are left for the owner's first read to discover.
+                endPrebuffering();
+                return;
+            }
+            awaitPrebufferInput();
+        });
+}
+
+void SerialStream::awaitReadiness (Operation operation, boost::system::error_code& ec) {
+    auto fd = pollfd{native_handle(), short(operation == WRITE ? POLLOUT : POLLIN), 0};
+    while (::poll(&fd, 1, -1) < 0) {
+        if (errno != EINTR) {
+            ec = boost::system::error_code{errno, boost::system::system_category()};
+            return;
+        }
+    }
+    // Hangups and errors are left for the retried operation to report.
+    ec = {};
+}
+
+void SerialStream::stopPrebuffering () {
+    // Reads call this first, so the common case, not prebuffering, takes no lock. A wait which
+    // stopped prebuffering itself published its last input with the release store below.
+    if (!mPrebuffer->active.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock{mPrebuffer->mutex};
+    endPrebuffering();
+}
+
+void SerialStream::endPrebuffering () {
+    if (!mPrebuffer->active.load(std::memory_order_relaxed)) {
+        return;
+    }
+    boost::system::error_code ec;
+    mPrebufferWatch.close(ec);
+    mStream.non_blocking(mProfile.spinBudget.count() != 0, ec);
+    // Last, so that an owner which sees prebuffering stopped also sees all of the above.
+    mPrebuffer->active.store(false, std::memory_order_release);
+}
+
+} // usbcdc
@@ -0,0 +1,90 @@
+#include <usbcdc/stalldetector.hpp>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace usbcdc {
+
+constexpr std::chrono::seconds StallDetector::kDefaultThreshold;
+
+StallDetector::StallDetector (boost::asio::io_service& context, Clock::duration threshold)
+    : mTimer(context)
+    , mThreshold(threshold)
+{}
+
+StallDetector::~StallDetector () {
+    stop();
+}
+
+void StallDetector::watch (const std::string& path,
+        std::shared_ptr<const PortStatistics> statistics) {
+    mPorts[path] = Port{std::move(statistics), false};
+}
+
+void StallDetector::unwatch (const std::string& path) {
+    mPorts.erase(path);
+}
+
+void StallDetector::start () {
+    if (!mRunning) {
+        mRunning = true;
+        arm();
+    }
+}
+
+void StallDetector::stop () {
+    mRunning = false;
+    boost::system::error_code ec;
+    mTimer.cancel(ec);
+}
+
+size_t StallDetector::check (Clock::time_point now) {
+    // Handlers run after the scan, so that they may watch or unwatch ports.
+    auto stalls = std::vector<std::pair<std::string, Clock::duration>>{};
+    auto recoveries = std::vector<std::string>{};
+    auto stalled = size_t(0);
+    for (auto& kv: mPorts) {
+        auto& port = kv.second;
+        auto open = port.statistics && port.statistics->open.load(std::memory_order_acquire);
+        auto idle = open ? port.statistics->sinceLastInput(now) : Clock::duration::zero();
+        if (open && idle > mThreshold) {
+            ++stalled;
+            if (!port.stalled) {
+                port.stalled = true;
+                stalls.emplace_back(kv.first, idle);
+            }
+        }
+        else if (port.stalled) {
+            // The port received again, or was closed.
+            port.stalled = false;
+            recoveries.push_back(kv.first);
+        }
+    }
+    for (auto& stall: stalls) {
+        if (mStallHandler) {
+            mStallHandler(stall.first, stall.second);
+        }
+    }
+    for (auto& path: recoveries) {
+        if (mRecoverHandler) {
+            mRecoverHandler(path);
+        }
+    }
+    return stalled;
+}
+
+void StallDetector::arm () {
+    auto interval = std::max(mThreshold / 4, Clock::duration{std::chrono::milliseconds{1}});
+    mTimer.expires_from_now(interval);
+    mTimer.async_wait(
+    [this, lifetime = std::weak_ptr<char>(mLifetime)](boost::system::error_code ec) {
+        if (lifetime.expired() || ec || !mRunning) {
+            return;
+        }
+        check(Clock::now());
+        arm();
+    });
+}
+
+} // usbcdc
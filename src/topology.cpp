@@ -0,0 +1,112 @@
+#include <usbcdc/topology.hpp>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <cctype>
+
+namespace usbcdc {
+
+std::string usbPortPath (const std::string& sysPath) {
+    // USB interface directories are named `<port path>:<config>.<interface>`, which is the only
+    // kind of path component containing both a '-' and a ':' and starting with a digit. PCI
+    // addresses, for example, have no '-'.
+    auto end = sysPath.size();
+    while (end) {
+        auto begin = sysPath.rfind('/', end - 1);
+        begin = begin == std::string::npos ? 0 : begin + 1;
+        auto component = sysPath.substr(begin, end - begin);
+        auto colon = component.find(':');
+        if (colon != std::string::npos && component.find('-') < colon
+                && std::isdigit(static_cast<unsigned char>(component[0]))) {
+            return component.substr(0, colon);
+        }
+        end = begin ? begin - 1 : 0;
+    }
+    return {};
+}
+
+std::string parentPortPath (const std::string& portPath) {
+    auto dot = portPath.rfind('.');
+    if (dot != std::string::npos) {
+        return portPath.substr(0, dot);
+    }
+    auto dash = portPath.find('-');
+    if (dash != std::string::npos) {
+        return "usb" + portPath.substr(0, dash);
+    }
+    return {};
+}
+
+bool isUnderHub (const std::string& portPath, const std::string& hubPortPath) {
+    if (boost::algorithm::starts_with(hubPortPath, "usb")) {
+        return boost::algorithm::starts_with(portPath, hubPortPath.substr(3) + "-");
+    }
+    return portPath == hubPortPath || boost::algorithm::starts_with(portPath, hubPortPath + ".");
+}
+
+TopologyIndex::TopologyIndex (const DeviceSet& devices) {
+    for (const auto& d: devices) {
+        insert(d);
+    }
+}
+
+void TopologyIndex::insert (const Device& device) {
+    mByPortPath.emplace(device.portPath(), device);
+}
+
+void TopologyIndex::erase (const Device& device) {
+    auto range = mByPortPath.equal_range(device.portPath());
+    for (auto iter = range.first; iter != range.second; ++iter) {
+        if (!(iter->second < device) && !(device < iter->second)) {
+            mByPortPath.erase(iter);
+            return;
+        }
+    }
+}
+
+std::pair<TopologyIndex::Map::const_iterator, TopologyIndex::Map::const_iterator>
+TopologyIndex::subtree (const std::string& hub) const {
+    // '/' and '.' sort immediately after '.' and '-' respectively, so these bounds capture the hub
+    // itself and every `hub.*` beneath it, but not siblings like `1-10` when `hub` is `1-1`.
+    if (boost::algorithm::starts_with(hub, "usb")) {
+        auto bus = hub.substr(3);
+        return {mByPortPath.lower_bound(bus + "-"), mByPortPath.lower_bound(bus + ".")};
+    }
+    auto first = mByPortPath.lower_bound(hub);
+    auto last = mByPortPath.lower_bound(hub + "/");
+    return {first, last};
+}
+
+DeviceSet TopologyIndex::devicesUnder (const std::string& hubPortPath) const {
+    auto range = subtree(hubPortPath);
+    auto result = DeviceSet{};
+    for (auto iter = range.first; iter != range.second; ++iter) {
+        result.insert(iter->second);
+    }
+    return result;
+}
+
+DeviceSet TopologyIndex::children (const std::string& hubPortPath) const {
+    auto range = subtree(hubPortPath);
+    auto result = DeviceSet{};
+    for (auto iter = range.first; iter != range.second; ++iter) {
+        if (parentPortPath(iter->first) == hubPortPath) {
+            result.insert(iter->second);
+        }
+    }
+    return result;
+}
+
+DeviceSetDifferences TopologyIndex::replaceSubtree (const std::string& hubPortPath,
+        const DeviceSet& devices) {
+    auto diff = deviceSetDifferences(devicesUnder(hubPortPath), devices);
+    for (const auto& d: diff.removed) {
+        erase(d);
+    }
+    for (const auto& d: diff.added) {
+        insert(d);
+    }
+    return diff;
+}
+
+} // usbcdc
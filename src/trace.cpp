@@ -0,0 +1,153 @@
+#include <usbcdc/trace.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace usbcdc {
+
+namespace trace {
+
+std::atomic<bool> gEnabled{false};
+
+namespace {
+
+struct Span {
+    const char* name;
+    int64_t start;
+    int64_t end;
+    // Nanoseconds on the steady clock.
+};
+
+struct SpanSlot {
+    // A Span whose fields `writeChromeTrace()` may read while the owning thread overwrites them.
+    // Relaxed atomics make that a detectable tear rather than a data race.
+    std::atomic<const char*> name{nullptr};
+    std::atomic<int64_t> start{0};
+    std::atomic<int64_t> end{0};
+};
+
+struct ThreadBuffer {
+    // Written only by its own thread. `head` counts every span ever recorded; span `i` lives in
+    // slot `i % kSpansPerThread` until span `i + kSpansPerThread` overwrites it. `claimed` runs
+    // ahead of `head` while a slot is being written, so that readers can tell which slots they
+    // may have caught mid-write.
+    explicit ThreadBuffer (unsigned t) : tid(t), spans(kSpansPerThread) {}
+    unsigned tid;
+    std::vector<SpanSlot> spans;
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> claimed{0};
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    // Kept after their threads exit, so that their spans can still be dumped.
+};
+
+Registry& registry () {
+    static Registry r;
+    return r;
+}
+
+ThreadBuffer& threadBuffer () {
+    // The registry's lock is only taken the first time each thread records a span.
+    thread_local auto buffer = [] {
+        auto& r = registry();
+        std::lock_guard<std::mutex> lock{r.mutex};
+        r.buffers.push_back(std::make_shared<ThreadBuffer>(unsigned(r.buffers.size() + 1)));
+        return r.buffers.back();
+    }();
+    return *buffer;
+}
+
+int64_t nanoseconds (std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+void writeName (std::ostream& os, const char* name) {
+    os << '"';
+    for (; *name; ++name) {
+        if (*name == '"' || *name == '\\') {
+            os << '\\';
+        }
+        os << *name;
+    }
+    os << '"';
+}
+
+} // <anonymous>
+
+void enable (bool on) {
+    gEnabled.store(on, std::memory_order_relaxed);
+}
+
+void record (const char* name, std::chrono::steady_clock::time_point start,
+        std::chrono::steady_clock::time_point end) {
+    auto& buffer = threadBuffer();
+    auto i = buffer.head.load(std::memory_order_relaxed);
+    auto& slot = buffer.spans[i % kSpansPerThread];
+    // A reader which copies any of the slot's new fields is then guaranteed to see this claim, and
+    // so to discard the slot.
+    buffer.claimed.store(i + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(nanoseconds(start), std::memory_order_relaxed);
+    slot.end.store(nanoseconds(end), std::memory_order_relaxed);
+    buffer.head.store(i + 1, std::memory_order_release);
+}
+
+void writeChromeTrace (std::ostream& os) {
+    auto buffers = [] {
+        auto& r = registry();
+        std::lock_guard<std::mutex> lock{r.mutex};
+        return r.buffers;
+    }();
+
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    auto first = true;
+    auto copy = std::vector<Span>{};
+    for (auto& buffer: buffers) {
+        auto head = buffer->head.load(std::memory_order_acquire);
+        auto begin = head > kSpansPerThread ? head - kSpansPerThread : 0;
+        copy.clear();
+        for (auto i = begin; i < head; ++i) {
+            auto& slot = buffer->spans[i % kSpansPerThread];
+            copy.push_back(Span{slot.name.load(std::memory_order_relaxed),
+                slot.start.load(std::memory_order_relaxed),
+                slot.end.load(std::memory_order_relaxed)});
+        }
+        // Anything the thread may have overwritten while we copied, or be overwriting now, is
+        // unreliable.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto after = buffer->claimed.load(std::memory_order_relaxed);
+        auto firstIntact = after > kSpansPerThread ? after - kSpansPerThread : 0;
+        auto skip = size_t(std::min(std::max(firstIntact, begin) - begin, head - begin));
+
+        for (auto s = copy.begin() + skip; s != copy.end(); ++s) {
+            os << (first ? "" : ",") << "\n{\"name\":";
+            first = false;
+            writeName(os, s->name);
+            os << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+               << ",\"ts\":" << s->start / 1000 << '.' << s->start / 100 % 10
+               << ",\"dur\":" << (s->end - s->start) / 1000 << '.' << (s->end - s->start) / 100 % 10
+               << '}';
+        }
+    }
+    os << "\n]}\n";
+}
+
+void clear () {
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock{r.mutex};
+    for (auto& buffer: r.buffers) {
+        buffer->head.store(0, std::memory_order_relaxed);
+        buffer->claimed.store(0, std::memory_order_relaxed);
+    }
+}
+
+} // trace
+
+} // usbcdc
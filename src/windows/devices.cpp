@@ -1,4 +1,5 @@
 #include <usbcdc/devices.hpp>
+#include <usbcdc/trace.hpp>
 
 #include <util/windows/error.hpp>
 
@@ -211,6 +212,7 @@ static Device toDevice (DevInfo di) {
 using namespace boost::adaptors;
 
 DeviceSet devices () {
+    USBCDC_TRACE_SCOPE("devices");
     using std::begin;
     using std::end;
     auto diIter = DevInfoIterator{};
@@ -0,0 +1,53 @@
+#include <usbcdc/serialstream.hpp>
+
+#include <boost/asio/detail/throw_error.hpp>
+
+namespace usbcdc {
+
+void SerialStream::open (const Device& device, const SerialProfile& profile,
+        boost::system::error_code& ec) {
+    // `serial_port::open()` already puts the port in binary mode with no flow control, which is
+    // the Windows equivalent of raw mode. There is no low-latency knob here, and the port handle
+    // is overlapped-only, so neither part of `profile` applies.
+    using boost::asio::serial_port_base;
+    mStream.open(device.path(), ec);
+    if (ec) { return; }
+    mStream.set_option(serial_port_base::baud_rate(115200), ec);
+    if (ec) { return; }
+    mStream.set_option(serial_port_base::character_size(8), ec);
+    if (ec) { return; }
+    mStream.set_option(serial_port_base::parity(serial_port_base::parity::none), ec);
+    if (ec) { return; }
+    mStream.set_option(serial_port_base::stop_bits(serial_port_base::stop_bits::one), ec);
+    if (ec) { return; }
+    mStream.set_option(serial_port_base::flow_control(serial_port_base::flow_control::none), ec);
+    if (ec) { return; }
+    mProfile = profile;
+    mProfile.lowLatency = false;
+    mProfile.spinBudget = {};
+    mStatistics->opened(PortStatistics::Clock::now());
+}
+
+void SerialStream::open (const Device& device, const SerialProfile& profile) {
+    boost::system::error_code ec;
+    open(device, profile, ec);
+    boost::asio::detail::throw_error(ec, "open");
+}
+
+void SerialStream::prebuffer (size_t) {
+    // Overlapped serial ports have no readiness notification, and a pending read cannot be taken
+    // back from the port once the owner starts reading, so there is no prebuffering here.
+}
+
+void SerialStream::awaitPrebufferInput () {}
+
+void SerialStream::awaitReadiness (Operation, boost::system::error_code& ec) {
+    // Synchronous operations on a serial_port block anyway, and never report would_block.
+    ec = {};
+}
+
+void SerialStream::stopPrebuffering () {}
+
+void SerialStream::endPrebuffering () {}
+
+} // usbcdc
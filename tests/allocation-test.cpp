@@ -0,0 +1,145 @@
+#include <util/doctest.h>
+
+#include <usbcdc/monitor.hpp>
+
+#include "syntheticevents.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#if BOOST_OS_LINUX
+
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// This program replaces the global allocator to count heap allocations, so it holds only the
+// tests which need that, and the rest of the suite runs under the usual allocator.
+
+static std::atomic<size_t> gAllocations{0};
+
+void* operator new (size_t size) {
+    ++gAllocations;
+    if (auto p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete (void* p) noexcept { std::free(p); }
+void operator delete (void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+using synthetic::udevRecord;
+
+// =======================================================================================
+// Test cases
+
+TEST_CASE("receiving queued events does not allocate") {
+    // Turning a batch of records into events allocates, but once a read has queued several
+    // events, handing each one to the consumer should reuse the monitor's operation storage.
+    const int kEvents = 8;
+    auto records = std::string{};
+    for (int i = 0; i < kEvents; ++i) {
+        records += udevRecord("add", i);
+    }
+    int fds[2];
+    REQUIRE(!::pipe(fds));
+    REQUIRE(::write(fds[1], records.data(), records.size()) == ssize_t(records.size()));
+
+    boost::asio::io_service context;
+    usbcdc::MonitorImpl monitor{context, fds[0]};
+
+    struct State {
+        usbcdc::MonitorImpl& monitor;
+        int received;
+        size_t allocationsAfterWarmUp;
+    } state{monitor, 0, 0};
+
+    struct OnEvent {
+        State* s;
+        void operator() (boost::system::error_code ec, usbcdc::DeviceEvent event) {
+            REQUIRE(!ec);
+            CHECK(event.type == usbcdc::DeviceEvent::ADD);
+            if (++s->received == 1) {
+                s->allocationsAfterWarmUp = gAllocations;
+            }
+            if (s->received < kEvents) {
+                s->monitor.asyncReceiveDeviceEvent(*this);
+            }
+        }
+    };
+
+    monitor.asyncReceiveDeviceEvent(OnEvent{&state});
+    context.run();
+    auto allocations = gAllocations - state.allocationsAfterWarmUp;
+    CHECK(state.received == kEvents);
+    CHECK(allocations == 0);
+
+    boost::system::error_code ec;
+    monitor.close(ec);
+    ::close(fds[1]);
+}
+
+TEST_CASE("reading and parsing one record per read does not allocate") {
+    // In steady state each record arrives in a read of its own. Reading it, and parsing it into
+    // the monitor's reused record, should not touch the heap. `change` records are parsed in full
+    // but queue no event, so the receive stays outstanding throughout, and what is counted is
+    // the read and parse path alone: an ADD or REMOVE event still allocates in the monitor's
+    // device cache.
+    const int kWarmUp = 4;
+    const int kRecords = 64;
+    int fds[2];
+    REQUIRE(!::pipe(fds));
+    auto send = [&](const std::string& record) {
+        REQUIRE(::write(fds[1], record.data(), record.size()) == ssize_t(record.size()));
+    };
+
+    boost::asio::io_service context;
+    usbcdc::MonitorImpl monitor{context, fds[0]};
+    auto received = 0;
+    monitor.asyncReceiveDeviceEvent([&](boost::system::error_code ec, usbcdc::DeviceEvent event) {
+        CHECK(!ec);
+        CHECK(event.type == usbcdc::DeviceEvent::ADD);
+        ++received;
+    });
+
+    auto deliver = [&](const std::string& record) {
+        // Hand the monitor exactly one record, and let it read and parse it before the next.
+        send(record);
+        int unread;
+        do {
+            context.poll();
+            context.reset();
+            REQUIRE(!::ioctl(fds[0], FIONREAD, &unread));
+        } while (unread);
+        context.poll();
+        context.reset();
+    };
+    const auto change = udevRecord("change", 0);
+    for (int i = 0; i < kWarmUp; ++i) {
+        deliver(change);
+    }
+    auto before = size_t(gAllocations);
+    for (int i = 0; i < kRecords; ++i) {
+        deliver(change);
+    }
+    auto allocations = gAllocations - before;
+    CHECK(!received);
+    CHECK(allocations == 0);
+
+    // The records were parsed, not merely left in the pipe: the next one completes the receive.
+    send(udevRecord("add", 0));
+    while (!received && context.run_one()) {}
+    CHECK(received == 1);
+
+    boost::system::error_code ec;
+    monitor.close(ec);
+    ::close(fds[1]);
+}
+
+} // <anonymous>
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef USBCDC_TESTS_BENCHMARK_HPP
+#define USBCDC_TESTS_BENCHMARK_HPP
+
+// Timing and reporting for the benchmark program, so that each benchmark only has to describe
+// its workload.
+
+#include <util/log.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+inline double seconds (Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+template <class F>
+Clock::duration time (F&& f) {
+    // How long `f()` takes to run.
+    auto start = Clock::now();
+    f();
+    return Clock::now() - start;
+}
+
+inline std::string throughput (size_t bytes, Clock::duration d) {
+    std::ostringstream os;
+    os << bytes / seconds(d) / (1024 * 1024) << " MiB/s";
+    return os.str();
+}
+
+inline std::string rate (double count, Clock::duration d, const char* unit) {
+    std::ostringstream os;
+    os << count / seconds(d) << " " << unit << "/s";
+    return os.str();
+}
+
+class Latencies {
+    // Samples of one operation's duration, summarized by their percentiles.
+public:
+    explicit Latencies (size_t expected) { mSamples.reserve(expected); }
+
+    void add (Clock::duration d) { mSamples.push_back(d); }
+    size_t size () const { return mSamples.size(); }
+
+    std::string summary () {
+        if (mSamples.empty()) {
+            return "no samples";
+        }
+        std::sort(mSamples.begin(), mSamples.end());
+        std::ostringstream os;
+        os << "p50 " << micros(0.5) << "us, p99 " << micros(0.99)
+            << "us, p99.9 " << micros(0.999) << "us, max " << micros(1) << "us";
+        return os.str();
+    }
+
+private:
+    long long micros (double p) const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            mSamples[size_t(p * (mSamples.size() - 1))]).count();
+    }
+
+    std::vector<Clock::duration> mSamples;
+};
+
+inline void report (const std::string& what, const std::string& result) {
+    util::log::Logger lg;
+    BOOST_LOG(lg) << what << ": " << result;
+}
+
+} // namespace bench
+
+#endif
@@ -0,0 +1,67 @@
+#include <util/doctest.h>
+
+#include <usbcdc/devicecache.hpp>
+
+namespace {
+
+// =======================================================================================
+// Test cases
+
+TEST_CASE("DeviceCache resolves removed devices by any key") {
+    usbcdc::DeviceCache cache;
+    auto sysPath = std::string{"/devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/tty/ttyACM0"};
+    auto device = usbcdc::Device{"/dev/ttyACM0", "Linkbot Labs Linkbot"};
+    cache.insert(sysPath, device, usbcdc::DeviceCache::makeDevNum(166, 0));
+
+    REQUIRE(cache.findBySysPath(sysPath));
+    CHECK(cache.findByDevNode("/dev/ttyACM0")->productString() == device.productString());
+    CHECK(cache.findByDevNum(usbcdc::DeviceCache::makeDevNum(166, 0))->path() == device.path());
+
+    usbcdc::Device removed;
+    CHECK(cache.erase(sysPath, removed));
+    CHECK(removed.productString() == device.productString());
+    CHECK(!cache.size());
+    CHECK(!cache.findByDevNode("/dev/ttyACM0"));
+    CHECK(!cache.erase(sysPath, removed));
+}
+
+TEST_CASE("DeviceCache follows moved devices") {
+    usbcdc::DeviceCache cache;
+    auto a = std::string{"/devices/usb1/1-1/1-1:1.0/tty/ttyACM0"};
+    auto b = std::string{"/devices/usb1/1-2/1-2:1.0/tty/ttyACM0"};
+    auto device = usbcdc::Device{"/dev/ttyACM0", "Linkbot"};
+    device.portPath("1-1");
+    cache.insert(a, device);
+    CHECK(cache.move(a, b));
+    CHECK(!cache.findBySysPath(a));
+    REQUIRE(cache.findBySysPath(b));
+    CHECK(cache.findBySysPath(b)->portPath() == "1-2");
+    CHECK(cache.findByDevNode("/dev/ttyACM0"));
+    CHECK(!cache.move(a, "/devices/usb1/1-3/1-3:1.0/tty/ttyACM0"));
+}
+
+TEST_CASE("DeviceCache keeps keys a later device has reused") {
+    // ttyACM0 went away and another device took its node and number before the first one's
+    // remove arrived. Removing or moving the stale entry must not unindex the new device.
+    usbcdc::DeviceCache cache;
+    auto a = std::string{"/devices/usb1/1-1/1-1:1.0/tty/ttyACM0"};
+    auto b = std::string{"/devices/usb1/1-2/1-2:1.0/tty/ttyACM0"};
+    auto c = std::string{"/devices/usb1/1-3/1-3:1.0/tty/ttyACM0"};
+    auto devNum = usbcdc::DeviceCache::makeDevNum(166, 0);
+    cache.insert(a, usbcdc::Device{"/dev/ttyACM0", "Old"}, devNum);
+    cache.insert(b, usbcdc::Device{"/dev/ttyACM0", "New"}, devNum);
+
+    CHECK(cache.move(a, c));
+    REQUIRE(cache.findByDevNode("/dev/ttyACM0"));
+    CHECK(cache.findByDevNode("/dev/ttyACM0")->productString() == "New");
+
+    usbcdc::Device removed;
+    CHECK(cache.erase(c, removed));
+    CHECK(removed.productString() == "Old");
+    REQUIRE(cache.findByDevNode("/dev/ttyACM0"));
+    CHECK(cache.findByDevNode("/dev/ttyACM0")->productString() == "New");
+    REQUIRE(cache.findByDevNum(devNum));
+    CHECK(cache.findByDevNum(devNum)->productString() == "New");
+}
+
+}  // <anonymous>
@@ -0,0 +1,52 @@
+#include <util/doctest.h>
+
+#include <usbcdc/eventqueue.hpp>
+
+namespace {
+
+usbcdc::DeviceEvent makeEvent (int n) {
+    return {usbcdc::DeviceEvent::ADD, usbcdc::Device{"/dev/ttyACM" + std::to_string(n), "Linkbot"}, {}};
+}
+
+// =======================================================================================
+// Test cases
+
+TEST_CASE("EventQueue BLOCK policy refuses events while full") {
+    usbcdc::EventQueue q{2, usbcdc::EventQueue::Policy::BLOCK};
+    CHECK(q.push(makeEvent(0)));
+    CHECK(q.push(makeEvent(1)));
+    CHECK(q.wouldBlock());
+    CHECK(!q.push(makeEvent(2)));
+    CHECK(q.front().device.path() == "/dev/ttyACM0");
+    q.pop();
+    CHECK(q.push(makeEvent(2)));
+    CHECK(q.statistics().highWaterMark == 2);
+    CHECK(q.statistics().dropped == 0);
+}
+
+TEST_CASE("EventQueue DROP_OLDEST policy keeps the newest events") {
+    usbcdc::EventQueue q{2, usbcdc::EventQueue::Policy::DROP_OLDEST};
+    for (int i = 0; i < 5; ++i) {
+        CHECK(q.push(makeEvent(i)));
+    }
+    CHECK(q.size() == 2);
+    CHECK(q.front().device.path() == "/dev/ttyACM3");
+    CHECK(q.statistics().dropped == 3);
+}
+
+TEST_CASE("EventQueue RESYNC policy collapses overflow into one marker") {
+    usbcdc::EventQueue q{3, usbcdc::EventQueue::Policy::RESYNC};
+    for (int i = 0; i < 3; ++i) {
+        CHECK(q.push(makeEvent(i)));
+    }
+    CHECK(!q.push(makeEvent(3)));
+    CHECK(!q.push(makeEvent(4)));
+    REQUIRE(q.size() == 1);
+    CHECK(q.front().type == usbcdc::DeviceEvent::RESYNC);
+    CHECK(q.statistics().resyncs == 1);
+    q.pop();
+    CHECK(q.push(makeEvent(5)));
+    CHECK(q.front().device.path() == "/dev/ttyACM5");
+}
+
+}  // <anonymous>
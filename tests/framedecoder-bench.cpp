@@ -0,0 +1,45 @@
+#include <util/doctest.h>
+
+#include <usbcdc/framedecoder.hpp>
+
+#include "benchmark.hpp"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// =======================================================================================
+// Benchmarks
+
+TEST_CASE("FrameDecoder throughput by frame size") {
+    const size_t kChunkSize = 4096;
+    const size_t kTotal = 256 * 1024 * 1024;
+    for (size_t frameSize: {16, 64, 256, 1024}) {
+        // Frames of `frameSize` payload bytes plus a delimiter, so that some frames straddle
+        // chunk boundaries just as they would across reads.
+        auto stream = std::vector<uint8_t>(kChunkSize * 16, 0x55);
+        for (size_t i = frameSize; i < stream.size(); i += frameSize + 1) {
+            stream[i] = 0;
+        }
+        usbcdc::FrameDecoder decoder{0x00, 4096};
+        auto bytes = size_t(0);
+        auto elapsed = bench::time([&] {
+            for (size_t done = 0; done < kTotal; done += stream.size()) {
+                for (size_t offset = 0; offset < stream.size(); offset += kChunkSize) {
+                    decoder.decode(boost::asio::buffer(&stream[offset], kChunkSize),
+                        [&bytes](boost::asio::const_buffer f) { bytes += f.size(); });
+                }
+            }
+        });
+        CHECK(bytes);
+        std::ostringstream os;
+        os << bench::throughput(kTotal, elapsed) << ", "
+            << bench::rate(double(decoder.statistics().frames), elapsed, "frames") << ", "
+            << decoder.statistics().assembledFrames << " assembled";
+        bench::report(std::to_string(frameSize) + "-byte frames", os.str());
+    }
+}
+
+}  // <anonymous>
@@ -0,0 +1,62 @@
+#include <util/doctest.h>
+
+#include <usbcdc/framedecoder.hpp>
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<std::string> decodeAll (usbcdc::FrameDecoder& decoder, const std::string& chunk) {
+    auto frames = std::vector<std::string>{};
+    decoder.decode(boost::asio::buffer(chunk), [&frames](boost::asio::const_buffer f) {
+        frames.emplace_back(static_cast<const char*>(f.data()), f.size());
+    });
+    return frames;
+}
+
+// =======================================================================================
+// Test cases
+
+TEST_CASE("FrameDecoder splits frames within and across buffers") {
+    usbcdc::FrameDecoder decoder{'|', 8};
+
+    auto frames = decodeAll(decoder, "abc|def||gh");
+    REQUIRE(frames.size() == 2);
+    CHECK(frames[0] == "abc");
+    CHECK(frames[1] == "def");
+    CHECK(decoder.statistics().assembledFrames == 0);
+
+    frames = decodeAll(decoder, "ij|k");
+    REQUIRE(frames.size() == 1);
+    CHECK(frames[0] == "ghij");
+    CHECK(decoder.statistics().assembledFrames == 1);
+
+    // Oversized frames are dropped whole, whether contiguous or assembled.
+    frames = decodeAll(decoder, "lmnopqrstu|v|0123456789");
+    REQUIRE(frames.size() == 1);
+    CHECK(frames[0] == "v");
+    frames = decodeAll(decoder, "0123|w|");
+    REQUIRE(frames.size() == 1);
+    CHECK(frames[0] == "w");
+    CHECK(decoder.statistics().oversizedFrames == 2);
+}
+
+TEST_CASE("FrameDecoder accepts buffer sequences") {
+    usbcdc::FrameDecoder decoder;
+    auto a = std::string{"abc\0de", 6};
+    auto b = std::string{"f\0", 2};
+    auto buffers = std::array<boost::asio::const_buffer, 2>{{
+        boost::asio::buffer(a), boost::asio::buffer(b)
+    }};
+    auto frames = std::vector<std::string>{};
+    decoder.decode(buffers, [&frames](boost::asio::const_buffer f) {
+        frames.emplace_back(static_cast<const char*>(f.data()), f.size());
+    });
+    REQUIRE(frames.size() == 2);
+    CHECK(frames[0] == "abc");
+    CHECK(frames[1] == "def");
+}
+
+}  // <anonymous>
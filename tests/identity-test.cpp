@@ -0,0 +1,56 @@
+#include <util/doctest.h>
+
+#include <usbcdc/deviceevent.hpp>
+#include <usbcdc/identity.hpp>
+
+namespace {
+
+usbcdc::Device makeDevice (const std::string& path, const std::string& serialNumber) {
+    auto d = usbcdc::Device{path, "Linkbot"};
+    d.portPath("1-1.4");
+    d.serialNumber(serialNumber);
+    d.vendorId(0x2341);
+    d.productId(0x8036);
+    return d;
+}
+
+// =======================================================================================
+// Test cases
+
+TEST_CASE("stable identity prefers serial number over port path") {
+    auto a = makeDevice("/dev/ttyACM0", "ZRG6");
+    auto b = makeDevice("/dev/ttyACM1", "ZRG6");
+    b.portPath("1-2");
+    CHECK(usbcdc::stableId(a) == usbcdc::stableId(b));
+
+    auto c = makeDevice("/dev/ttyACM0", "");
+    auto d = makeDevice("/dev/ttyACM1", "");
+    CHECK(usbcdc::stableId(c) == usbcdc::stableId(d));
+    d.portPath("1-2");
+    CHECK(usbcdc::stableId(c) != usbcdc::stableId(d));
+
+    CHECK(usbcdc::stableId(usbcdc::Device{"/dev/ttyS0", "UART"}).empty());
+}
+
+TEST_CASE("IdentityTracker reports re-appearances within the window as RECONNECT") {
+    using namespace std::chrono;
+    auto t0 = steady_clock::now();
+    usbcdc::IdentityTracker tracker;
+    tracker.window(seconds{5});
+
+    auto remove = usbcdc::DeviceEvent{usbcdc::DeviceEvent::REMOVE, makeDevice("/dev/ttyACM0", "ZRG6")};
+    tracker.process(remove, t0);
+    CHECK(remove.type == usbcdc::DeviceEvent::REMOVE);
+
+    auto add = usbcdc::DeviceEvent{usbcdc::DeviceEvent::ADD, makeDevice("/dev/ttyACM1", "ZRG6")};
+    tracker.process(add, t0 + seconds{1});
+    CHECK(add.type == usbcdc::DeviceEvent::RECONNECT);
+    CHECK(add.previousPath == "/dev/ttyACM0");
+
+    tracker.process(remove, t0 + seconds{2});
+    auto lateAdd = usbcdc::DeviceEvent{usbcdc::DeviceEvent::ADD, makeDevice("/dev/ttyACM1", "ZRG6")};
+    tracker.process(lateAdd, t0 + seconds{10});
+    CHECK(lateAdd.type == usbcdc::DeviceEvent::ADD);
+}
+
+}  // <anonymous>
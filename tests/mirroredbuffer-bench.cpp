@@ -0,0 +1,110 @@
+#include <util/doctest.h>
+
+#include "benchmark.hpp"
+#include "pty.hpp"
+
+#include <boost/predef.h>
+
+#if BOOST_OS_LINUX
+
+#include <usbcdc/serialstream.hpp>
+#include <usbcdc/linux/mirroredbuffer.hpp>
+
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace {
+
+using synthetic::Pty;
+
+size_t scanFrames (boost::asio::const_buffer data, size_t& frames) {
+    // Count the NUL-terminated frames in `data`, and return how many bytes they take up. Whatever
+    // follows the last delimiter is the start of a frame still to come.
+    auto begin = static_cast<const char*>(data.data());
+    auto end = begin + data.size();
+    auto p = begin;
+    while (auto d = static_cast<const char*>(std::memchr(p, 0, size_t(end - p)))) {
+        ++frames;
+        p = d + 1;
+    }
+    return size_t(p - begin);
+}
+
+// =======================================================================================
+// Benchmarks
+
+TEST_CASE("MirroredBuffer versus streambuf, framing a pty's input") {
+    // The robot sends NUL-terminated frames which straddle reads. The streambuf compacts its
+    // leftover partial frame on every `prepare()`; the mirrored buffer never moves a byte.
+    const size_t kTotal = 16 * 1024 * 1024;
+    const size_t kFrameSize = 257;
+    const size_t kReadSize = 64 * 1024;
+    auto source = std::vector<char>(kTotal, 'x');
+    for (size_t i = kFrameSize - 1; i < kTotal; i += kFrameSize) {
+        source[i] = 0;
+    }
+
+    auto measure = [&](const char* name, auto&& startRead) {
+        boost::asio::io_service context;
+        Pty pty;
+        boost::asio::posix::stream_descriptor robot{context, pty.master};
+        usbcdc::SerialStream stream{context};
+        stream.open(pty.device);
+
+        auto frames = size_t(0);
+        auto nRead = size_t(0);
+        auto elapsed = bench::time([&] {
+            boost::asio::async_write(robot, boost::asio::buffer(source),
+                [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+            startRead(stream, frames, nRead);
+            context.run();
+        });
+        CHECK(nRead == kTotal);
+        CHECK(frames == kTotal / kFrameSize);
+        bench::report(name, bench::throughput(nRead, elapsed) + ", "
+            + bench::rate(double(frames), elapsed, "frames"));
+    };
+
+    measure("streambuf", [&](usbcdc::SerialStream& stream, size_t& frames, size_t& nRead) {
+        auto buf = std::make_shared<boost::asio::streambuf>();
+        auto onRead = std::make_shared<std::function<void(boost::system::error_code, size_t)>>();
+        *onRead = [&, buf, onRead](boost::system::error_code ec, size_t n) {
+            buf->commit(n);
+            nRead += n;
+            buf->consume(scanFrames(buf->data(), frames));
+            if (!ec && nRead < kTotal) {
+                stream.async_read_some(buf->prepare(kReadSize), *onRead);
+            }
+            else {
+                *onRead = nullptr;
+            }
+        };
+        stream.async_read_some(buf->prepare(kReadSize), *onRead);
+    });
+
+    measure("MirroredBuffer", [&](usbcdc::SerialStream& stream, size_t& frames, size_t& nRead) {
+        auto buf = std::make_shared<usbcdc::MirroredBuffer>(kReadSize);
+        auto onRead = std::make_shared<std::function<void(boost::system::error_code, size_t)>>();
+        *onRead = [&, buf, onRead](boost::system::error_code ec, size_t n) {
+            nRead += n;
+            buf->consume(scanFrames(buf->data(), frames));
+            if (!ec && nRead < kTotal) {
+                usbcdc::asyncReadSome(stream, *buf, *onRead);
+            }
+            else {
+                *onRead = nullptr;
+            }
+        };
+        usbcdc::asyncReadSome(stream, *buf, *onRead);
+    });
+}
+
+} // <anonymous>
+
+#endif
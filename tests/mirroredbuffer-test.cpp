@@ -0,0 +1,111 @@
+#include <util/doctest.h>
+
+#include <boost/predef.h>
+
+#if BOOST_OS_LINUX
+
+#include <usbcdc/serialstream.hpp>
+#include <usbcdc/linux/mirroredbuffer.hpp>
+
+#include "pty.hpp"
+
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/write.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string>
+
+namespace {
+
+using synthetic::Pty;
+
+// =======================================================================================
+// Test cases
+
+TEST_CASE("MirroredBuffer keeps wrapped data contiguous") {
+    usbcdc::MirroredBuffer buffer{1};
+    auto capacity = buffer.capacity();
+    REQUIRE(capacity >= 4096);
+
+    // Park the readable bytes near the end, so that the next write wraps.
+    buffer.commit(capacity - 100);
+    buffer.consume(capacity - 200);
+    CHECK(buffer.size() == 100);
+    boost::asio::mutable_buffer space = buffer.prepare();
+    REQUIRE(space.size() == capacity - 100);
+    auto p = static_cast<char*>(space.data());
+    for (size_t i = 0; i < capacity - 100; ++i) {
+        p[i] = char(i % 251);
+    }
+    buffer.commit(capacity - 100);
+    CHECK(buffer.size() == capacity);
+    CHECK(!buffer.space());
+    CHECK_THROWS_AS(buffer.prepare(1), std::length_error);
+
+    // One span holds everything, including the bytes written past the wrap point.
+    boost::asio::const_buffer data = buffer.data();
+    REQUIRE(data.size() == capacity);
+    auto q = static_cast<const char*>(data.data()) + 100;
+    auto intact = true;
+    for (size_t i = 0; i < capacity - 100; ++i) {
+        intact = intact && q[i] == char(i % 251);
+    }
+    CHECK(intact);
+
+    buffer.consume(capacity);
+    CHECK(!buffer.size());
+    CHECK(buffer.space() == capacity);
+}
+
+TEST_CASE("MirroredBuffer frames a pty's input across reads and wraps") {
+    // A one-page buffer, so that frames straddle reads, and the buffer wraps many times over.
+    const size_t kFrameSize = 100;
+    const size_t kFrames = 200;
+    auto source = std::string{};
+    for (size_t f = 0; f < kFrames; ++f) {
+        source += std::string(kFrameSize - 1, char('a' + f % 26));
+        source += '\0';
+    }
+
+    boost::asio::io_service context;
+    Pty pty;
+    boost::asio::posix::stream_descriptor robot{context, pty.master};
+    usbcdc::SerialStream stream{context};
+    stream.open(pty.device);
+    usbcdc::MirroredBuffer buffer{1};
+
+    auto frames = size_t(0);
+    auto intact = true;
+    std::function<void(boost::system::error_code, size_t)> onRead;
+    onRead = [&](boost::system::error_code ec, size_t) {
+        REQUIRE(!ec);
+        // Every complete frame must be one contiguous span, wherever the wrap fell.
+        auto begin = static_cast<const char*>(buffer.data().data());
+        auto end = begin + buffer.size();
+        auto p = begin;
+        while (auto d = static_cast<const char*>(std::memchr(p, 0, size_t(end - p)))) {
+            auto expected = char('a' + frames % 26);
+            intact = intact && size_t(d - p) == kFrameSize - 1
+                && std::all_of(p, d, [expected](char c) { return c == expected; });
+            ++frames;
+            p = d + 1;
+        }
+        buffer.consume(size_t(p - begin));
+        if (frames < kFrames) {
+            usbcdc::asyncReadSome(stream, buffer, onRead);
+        }
+    };
+    boost::asio::async_write(robot, boost::asio::buffer(source),
+        [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+    usbcdc::asyncReadSome(stream, buffer, onRead);
+    context.run();
+    CHECK(frames == kFrames);
+    CHECK(intact);
+    CHECK(!buffer.size());
+}
+
+} // <anonymous>
+
+#endif
@@ -0,0 +1,111 @@
+#include <util/doctest.h>
+
+#include <usbcdc/monitor.hpp>
+
+#include "syntheticevents.hpp"
+
+#include <boost/predef.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Benchmarks, which take too long, or depend too much on the host, for the test suite. Built as
+// usbcdc-bench, but not run by ctest.
+
+#if BOOST_OS_LINUX
+
+namespace {
+
+using namespace synthetic;
+
+// =======================================================================================
+// Benchmarks
+
+TEST_CASE("monitor throughput and latency under synthetic load") {
+    const int kDevices = 25000;
+    auto receive = [](usbcdc::MonitorImpl& monitor, LoadRecorder& recorder, int n) {
+        monitor.asyncReceiveDeviceEvent(ReceiveLoop{monitor, recorder, n});
+    };
+    runLoad("udevadm records at 100k/s", Wire::UDEVADM, kDevices, 100000, receive);
+    runLoad("udevadm records, unthrottled", Wire::UDEVADM, kDevices, 0, receive);
+    runLoad("uevents at 100k/s", Wire::UEVENT, kDevices, 100000, receive);
+    runLoad("uevents, unthrottled", Wire::UEVENT, kDevices, 0, receive);
+
+#if USBCDC_HAS_COROUTINES
+    auto await = [](usbcdc::MonitorImpl& monitor, LoadRecorder& recorder, int n) {
+        [](usbcdc::MonitorImpl& monitor, LoadRecorder& recorder, int n) -> Detached {
+            while (n--) {
+                recorder(co_await monitor.awaitDeviceEvent());
+            }
+        }(monitor, recorder, n);
+    };
+    runLoad("udevadm records, co_await, unthrottled", Wire::UDEVADM, kDevices, 0, await);
+#endif
+}
+
+TEST_CASE("monitor construction and teardown are cheap") {
+    // Short-lived tools create and destroy monitors freely, so an unused monitor must not spawn
+    // `udevadm`, and a used one must leave no zombie behind once closed.
+    if (usbcdc::toolPaths().udevadm.empty() || usbcdc::toolPaths().stdbuf.empty()) {
+        MESSAGE("udevadm is not installed");
+        return;
+    }
+    using std::chrono::steady_clock;
+    const int kCycles = 1000;
+    util::log::Logger lg;
+    auto micros = [](steady_clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count();
+    };
+    auto idle = std::vector<double>{};
+    auto ready = std::vector<double>{};
+    auto released = std::vector<double>{};
+
+    boost::asio::io_service context;
+    for (int i = 0; i < kCycles; ++i) {
+        auto start = steady_clock::now();
+        {
+            usbcdc::MonitorImpl monitor{context, usbcdc::MonitorBackend::UDEVADM};
+        }
+        idle.push_back(micros(steady_clock::now() - start));
+
+        // Ready once `udevadm` runs and a read on its pipe is pending.
+        start = steady_clock::now();
+        auto monitor = std::make_unique<usbcdc::MonitorImpl>(context,
+            usbcdc::MonitorBackend::UDEVADM);
+        monitor->asyncReceiveDeviceEvent([](boost::system::error_code, usbcdc::DeviceEvent) {});
+        context.poll();
+        ready.push_back(micros(steady_clock::now() - start));
+
+        // Released once the monitor is gone and `udevadm` has been reaped.
+        start = steady_clock::now();
+        boost::system::error_code ec;
+        monitor->close(ec);
+        context.run();
+        context.reset();
+        monitor.reset();
+        while (usbcdc::unreapedChildren()) {
+            std::this_thread::yield();
+        }
+        released.push_back(micros(steady_clock::now() - start));
+    }
+
+    for (auto v: {&idle, &ready, &released}) {
+        std::sort(v->begin(), v->end());
+    }
+    auto report = [&](const char* name, const std::vector<double>& v) {
+        BOOST_LOG(lg) << name << " over " << kCycles << " cycles: p50 " << v[v.size() / 2]
+            << "us p99 " << v[v.size() * 99 / 100] << "us max " << v.back() << "us";
+    };
+    report("construct and destroy, unused", idle);
+    report("construct to first event ready", ready);
+    report("close to fully released", released);
+    CHECK(idle[idle.size() / 2] < 1000);
+    CHECK(usbcdc::unreapedChildren() == 0);
+}
+
+} // <anonymous>
+
+#endif
@@ -2,8 +2,36 @@
 
 #include <usbcdc/monitor.hpp>
 
+#include "syntheticevents.hpp"
+
+#include <boost/asio/steady_timer.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if BOOST_OS_LINUX
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#endif
+
 namespace {
 
+using namespace synthetic;
+
 // =======================================================================================
 // Test cases
 
@@ -47,4 +75,512 @@ TEST_CASE("can respond to events") {
     context.run();
 }
 
+TEST_CASE("a Monitor refuses a second receive or wait") {
+    // Whichever operation is outstanding keeps the monitor; the others fail at once, without
+    // aborting it or re-arming its timer.
+    boost::asio::io_service context;
+    usbcdc::Monitor m{context};
+    boost::asio::steady_timer later{context};
+    auto never = [](const usbcdc::Device&) { return false; };
+    boost::system::error_code waitEc, receiveEc, secondWaitEc;
+    auto waited = std::chrono::steady_clock::duration{};
+
+    m.asyncDevices([&](boost::system::error_code ec, const usbcdc::DeviceSet&) {
+        REQUIRE(!ec);
+        auto start = std::chrono::steady_clock::now();
+        m.asyncWaitForDevice(never, std::chrono::milliseconds(300),
+        [&, start](boost::system::error_code ec, usbcdc::Device) {
+            waitEc = ec;
+            waited = std::chrono::steady_clock::now() - start;
+        });
+        later.expires_from_now(std::chrono::milliseconds(50));
+        later.async_wait([&](boost::system::error_code) {
+            m.asyncReceiveDeviceEvent([&](boost::system::error_code ec, usbcdc::DeviceEvent) {
+                receiveEc = ec;
+            });
+            m.asyncWaitForDevice(never, std::chrono::milliseconds(300),
+            [&](boost::system::error_code ec, usbcdc::Device) {
+                secondWaitEc = ec;
+            });
+        });
+    });
+
+    context.run();
+    CHECK(receiveEc == boost::asio::error::in_progress);
+    CHECK(secondWaitEc == boost::asio::error::in_progress);
+    CHECK(waitEc == boost::asio::error::timed_out);
+    CHECK(waited >= std::chrono::milliseconds(300));
+}
+
+TEST_CASE("a closed Monitor stays closed") {
+    // Operations started after `close()` fail at once instead of polling or reading again.
+#if BOOST_OS_LINUX
+    using ClosableMonitor = usbcdc::MonitorImpl;
+#else
+    using ClosableMonitor = usbcdc::Monitor;
+#endif
+    boost::asio::io_service context;
+    ClosableMonitor m{context};
+    auto failed = [](boost::system::error_code ec) {
+        return ec && ec != boost::asio::error::in_progress && ec != boost::asio::error::timed_out;
+    };
+    boost::system::error_code receiveEc, waitEc;
+
+    m.asyncDevices([&](boost::system::error_code ec, const usbcdc::DeviceSet&) {
+        REQUIRE(!ec);
+        m.close(ec);
+        m.asyncReceiveDeviceEvent([&](boost::system::error_code ec, usbcdc::DeviceEvent) {
+            receiveEc = ec;
+            m.asyncWaitForDevice([](const usbcdc::Device&) { return false; },
+                std::chrono::seconds(10), [&](boost::system::error_code ec, usbcdc::Device) {
+                    waitEc = ec;
+                });
+        });
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    context.run();
+    CHECK(failed(receiveEc));
+    CHECK(failed(waitEc));
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+}
+
+#if BOOST_OS_LINUX
+
+void writeFile (const boost::filesystem::path& p, const std::string& contents) {
+    boost::filesystem::ofstream{p} << contents << '\n';
+}
+
+void addFakeTty (const boost::filesystem::path& sysfs, int n) {
+    // Lay out the sysfs entries for the `n`th CDC-ACM port on a hub, as the kernel would.
+    namespace fs = boost::filesystem;
+    auto name = "ttyACM" + std::to_string(n);
+    auto usbDevice = sysfs / "devices/usb1/1-1" / ("1-1." + std::to_string(n));
+    auto interface = usbDevice / ("1-1." + std::to_string(n) + ":1.0");
+    auto tty = interface / "tty" / name;
+    fs::create_directories(tty);
+    fs::create_directories(sysfs / "bus/usb/drivers/cdc_acm");
+    fs::create_directories(sysfs / "class/tty");
+    writeFile(usbDevice / "idVendor", "2341");
+    writeFile(usbDevice / "idProduct", "0001");
+    writeFile(usbDevice / "product", "Linkbot USB");
+    writeFile(usbDevice / "serial", "SN" + std::to_string(n));
+    writeFile(tty / "dev", "166:" + std::to_string(n));
+    fs::create_directory_symlink(sysfs / "bus/usb/drivers/cdc_acm", interface / "driver");
+    fs::create_directory_symlink(interface, tty / "device");
+    fs::create_directory_symlink(tty, sysfs / "class/tty" / name);
+}
+
+void removeFakeTty (const boost::filesystem::path& sysfs, int n) {
+    boost::filesystem::remove(sysfs / "class/tty" / ("ttyACM" + std::to_string(n)));
+    boost::filesystem::remove_all(sysfs / "devices/usb1/1-1" / ("1-1." + std::to_string(n)));
+}
+
+TEST_CASE("can wait for a device") {
+    // Synthetic uevents stand in for plugging in devices, so the wait must find the right one well
+    // before its deadline.
+    using std::chrono::steady_clock;
+    int fds[2];
+    REQUIRE(!::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds));
+    auto send = [&](const std::string& action, int n) {
+        auto datagram = encodeEvent(Wire::UEVENT, ttyProperties(action, n));
+        CHECK(::write(fds[1], datagram.data(), datagram.size()) == ssize_t(datagram.size()));
+    };
+    boost::asio::io_service context;
+    usbcdc::MonitorImpl monitor{context, usbcdc::ueventEventSource(fds[0])};
+
+    // Another device arrives before the wait starts, and the awaited one after.
+    send("add", 1);
+    auto found = usbcdc::Device{};
+    auto result = make_error_code(boost::asio::error::would_block);
+    auto start = steady_clock::now();
+    monitor.asyncWaitForDevice(
+        [](const usbcdc::Device& d) { return d.path() == "/dev/ttyACM3"; },
+        std::chrono::seconds{10},
+        [&](boost::system::error_code ec, usbcdc::Device device) {
+            result = ec;
+            found = std::move(device);
+        });
+    boost::asio::steady_timer plugIn{context, std::chrono::milliseconds{20}};
+    plugIn.async_wait([&](boost::system::error_code) { send("add", 3); });
+    context.run();
+    context.reset();
+    CHECK(!result);
+    CHECK(found.path() == "/dev/ttyACM3");
+    CHECK(steady_clock::now() - start < std::chrono::seconds{10});
+
+    // A receive started during a wait fails at once, and leaves the wait to time out.
+    auto receiveResult = boost::system::error_code{};
+    start = steady_clock::now();
+    monitor.asyncWaitForDevice(
+        [](const usbcdc::Device& d) { return d.path() == "/dev/ttyACM9"; },
+        std::chrono::milliseconds{50},
+        [&](boost::system::error_code ec, usbcdc::Device) { result = ec; });
+    boost::asio::steady_timer later{context, std::chrono::milliseconds{10}};
+    later.async_wait([&](boost::system::error_code) {
+        monitor.asyncReceiveDeviceEvent([&](boost::system::error_code ec, usbcdc::DeviceEvent) {
+            receiveResult = ec;
+        });
+    });
+    context.run();
+    context.reset();
+    CHECK(receiveResult == boost::asio::error::in_progress);
+    CHECK(result == boost::asio::error::timed_out);
+    CHECK(steady_clock::now() - start >= std::chrono::milliseconds{50});
+
+    // The waits left every event queued.
+    auto events = std::vector<usbcdc::DeviceEvent>{};
+    for (int i = 0; i < 2; ++i) {
+        monitor.asyncReceiveDeviceEvent([&](boost::system::error_code ec, usbcdc::DeviceEvent e) {
+            CHECK(!ec);
+            events.push_back(std::move(e));
+        });
+        context.run();
+        context.reset();
+    }
+    REQUIRE(events.size() == 2);
+    CHECK(events[0].device.path() == "/dev/ttyACM1");
+    CHECK(events[1].device.path() == "/dev/ttyACM3");
+
+    boost::system::error_code ec;
+    monitor.close(ec);
+    ::close(fds[1]);
+}
+
+TEST_CASE("renames are not lost under the BLOCK policy") {
+    // A rename queues two events, so with one slot free the record must wait rather than lose its
+    // ADD. A move which keeps the device's name only changes its USB port.
+    auto moveRecord = [](int from, int to, int toName) {
+        auto name = "ttyACM" + std::to_string(toName);
+        return encodeEvent(Wire::UDEVADM, {
+            {"ACTION", "move"},
+            {"DEVPATH", usbDevPath(to) + "/1-1." + std::to_string(to) + ":1.0/tty/" + name},
+            {"SUBSYSTEM", "tty"},
+            {"DEVPATH_OLD", ttyProperties("add", from)[1].second},
+            {"DEVNAME", "/dev/" + name},
+        });
+    };
+    auto records = udevRecord("add", 0) + udevRecord("add", 1) + moveRecord(0, 5, 5)
+        + moveRecord(1, 7, 1) + encodeEvent(Wire::UDEVADM, {
+            {"ACTION", "remove"},
+            {"DEVPATH", usbDevPath(7) + "/1-1.7:1.0/tty/ttyACM1"},
+            {"SUBSYSTEM", "tty"},
+        });
+    int fds[2];
+    REQUIRE(!::pipe(fds));
+    REQUIRE(::write(fds[1], records.data(), records.size()) == ssize_t(records.size()));
+
+    boost::asio::io_service context;
+    usbcdc::MonitorImpl monitor{context, fds[0]};
+    monitor.eventQueueCapacity(2);
+    monitor.eventQueuePolicy(usbcdc::EventQueue::Policy::BLOCK);
+    auto events = std::vector<usbcdc::DeviceEvent>{};
+    for (int i = 0; i < 5; ++i) {
+        monitor.asyncReceiveDeviceEvent([&](boost::system::error_code ec, usbcdc::DeviceEvent e) {
+            CHECK(!ec);
+            events.push_back(std::move(e));
+        });
+        context.run();
+        context.reset();
+    }
+    REQUIRE(events.size() == 5);
+    CHECK(events[2].type == usbcdc::DeviceEvent::REMOVE);
+    CHECK(events[2].device.path() == "/dev/ttyACM0");
+    CHECK(events[3].type != usbcdc::DeviceEvent::REMOVE);
+    CHECK(events[3].device.path() == "/dev/ttyACM5");
+    CHECK(events[3].device.portPath() == "1-1.5");
+    CHECK(events[4].type == usbcdc::DeviceEvent::REMOVE);
+    CHECK(events[4].device.path() == "/dev/ttyACM1");
+    CHECK(events[4].device.portPath() == "1-1.7");
+    CHECK(monitor.eventQueueStatistics().dropped == 0);
+
+    boost::system::error_code ec;
+    monitor.close(ec);
+    ::close(fds[1]);
+}
+
+TEST_CASE("a monitor can run without udev") {
+    // The polling backend only needs sysfs, which `SYSFS_PATH` points at a fake of here.
+    char dir[] = "/tmp/usbcdc-sysfs-XXXXXX";
+    REQUIRE(::mkdtemp(dir));
+    auto sysfs = boost::filesystem::path{dir};
+    auto previousBackend = std::getenv("USBCDC_MONITOR_BACKEND");
+    auto restoreBackend = std::string{previousBackend ? previousBackend : ""};
+    ::setenv("SYSFS_PATH", dir, 1);
+    ::setenv("USBCDC_MONITOR_BACKEND", "polling", 1);
+    addFakeTty(sysfs, 0);
+
+    boost::asio::io_service context;
+    usbcdc::MonitorImpl monitor{context};
+    CHECK(monitor.backend() == usbcdc::MonitorBackend::POLLING);
+
+    auto devices = usbcdc::DeviceSet{};
+    monitor.asyncDevices([&](boost::system::error_code ec, usbcdc::DeviceSet ds) {
+        CHECK(!ec);
+        devices = std::move(ds);
+    });
+    context.run();
+    context.reset();
+    REQUIRE(devices.size() == 1);
+    CHECK(devices.begin()->path() == "/dev/ttyACM0");
+    CHECK(devices.begin()->productString() == "Linkbot USB");
+
+    auto events = std::vector<usbcdc::DeviceEvent>{};
+    auto receive = [&] {
+        monitor.asyncReceiveDeviceEvent([&](boost::system::error_code ec, usbcdc::DeviceEvent e) {
+            CHECK(!ec);
+            events.push_back(std::move(e));
+        });
+        context.run();
+        context.reset();
+    };
+
+    addFakeTty(sysfs, 1);
+    receive();
+    REQUIRE(events.size() == 1);
+    CHECK(events[0].type == usbcdc::DeviceEvent::ADD);
+    CHECK(events[0].device.path() == "/dev/ttyACM1");
+    CHECK(events[0].device.productString() == "Linkbot USB");
+    CHECK(events[0].device.serialNumber() == "SN1");
+    CHECK(events[0].device.vendorId() == 0x2341);
+    CHECK(events[0].device.portPath() == "1-1.1");
+
+    removeFakeTty(sysfs, 0);
+    receive();
+    REQUIRE(events.size() == 2);
+    CHECK(events[1].type == usbcdc::DeviceEvent::REMOVE);
+    CHECK(events[1].device.path() == "/dev/ttyACM0");
+
+    boost::system::error_code ec;
+    monitor.close(ec);
+    if (restoreBackend.size()) {
+        ::setenv("USBCDC_MONITOR_BACKEND", restoreBackend.c_str(), 1);
+    }
+    else {
+        ::unsetenv("USBCDC_MONITOR_BACKEND");
+    }
+    ::unsetenv("SYSFS_PATH");
+    boost::filesystem::remove_all(sysfs);
+}
+
+TEST_CASE("bounded enumeration gives up on a wedged device") {
+    // A FIFO in place of ttyACM1's `product` attribute blocks whoever opens it, as a read from a
+    // wedged USB device would.
+    using std::chrono::steady_clock;
+    char dir[] = "/tmp/usbcdc-sysfs-XXXXXX";
+    REQUIRE(::mkdtemp(dir));
+    auto sysfs = boost::filesystem::path{dir};
+    ::setenv("SYSFS_PATH", dir, 1);
+    for (int n = 0; n < 3; ++n) {
+        addFakeTty(sysfs, n);
+    }
+    // Ttys of other kinds, which must never be reported as timed out.
+    boost::filesystem::create_directories(sysfs / "devices/virtual/tty/tty0");
+    boost::filesystem::create_directory_symlink(sysfs / "devices/virtual/tty/tty0",
+        sysfs / "class/tty/tty0");
+    auto serialPort = sysfs / "devices/platform/serial8250";
+    boost::filesystem::create_directories(serialPort / "tty/ttyS0");
+    boost::filesystem::create_directories(sysfs / "bus/platform/drivers/serial8250");
+    boost::filesystem::create_directory_symlink(sysfs / "bus/platform/drivers/serial8250",
+        serialPort / "driver");
+    boost::filesystem::create_directory_symlink(serialPort, serialPort / "tty/ttyS0/device");
+    boost::filesystem::create_directory_symlink(serialPort / "tty/ttyS0",
+        sysfs / "class/tty/ttyS0");
+    auto product = sysfs / "devices/usb1/1-1/1-1.1/product";
+    boost::filesystem::remove(product);
+    REQUIRE(!::mkfifo(product.c_str(), 0600));
+    auto wedged = (sysfs / "class/tty/ttyACM1").string();
+
+    auto checkResolved = [&](const usbcdc::PartialDeviceSet& result) {
+        REQUIRE(result.devices.size() == 2);
+        CHECK(result.devices.begin()->path() == "/dev/ttyACM0");
+        CHECK(result.devices.rbegin()->path() == "/dev/ttyACM2");
+        CHECK(std::count(result.timedOut.begin(), result.timedOut.end(), wedged) == 1);
+    };
+
+    auto start = steady_clock::now();
+    auto result = usbcdc::devices(start + std::chrono::seconds{10});
+    CHECK(steady_clock::now() - start < usbcdc::kDeviceResolveTimeout * 4);
+    checkResolved(result);
+    CHECK(result.timedOut.size() == 1);
+    CHECK(!result.cancelled);
+
+    auto cancel = usbcdc::CancellationToken{};
+    cancel.cancel();
+    start = steady_clock::now();
+    result = usbcdc::devices(start + std::chrono::seconds{10}, cancel);
+    CHECK(steady_clock::now() - start < usbcdc::kDeviceResolveTimeout);
+    CHECK(result.cancelled);
+    CHECK(std::count(result.timedOut.begin(), result.timedOut.end(), wedged) == 1);
+    for (auto& path: result.timedOut) {
+        CHECK(path.find("ttyACM") != std::string::npos);
+    }
+
+    int fds[2];
+    REQUIRE(!::pipe(fds));
+    boost::asio::io_service context;
+    usbcdc::MonitorImpl monitor{context, fds[0]};
+    // Both calls share the monitor's one worker, and are served in turn.
+    auto results = std::vector<usbcdc::PartialDeviceSet>{};
+    for (int i = 0; i < 2; ++i) {
+        monitor.asyncDevicesUntil(steady_clock::now() + std::chrono::seconds{10}, {},
+        [&](boost::system::error_code ec, usbcdc::PartialDeviceSet r) {
+            CHECK(!ec);
+            results.push_back(std::move(r));
+        });
+    }
+    context.run();
+    REQUIRE(results.size() == 2);
+    checkResolved(results[0]);
+    checkResolved(results[1]);
+
+    // Release the abandoned workers.
+    auto fifo = ::open(product.c_str(), O_WRONLY | O_NONBLOCK);
+    if (fifo >= 0) {
+        ::close(fifo);
+    }
+    boost::system::error_code ec;
+    monitor.close(ec);
+    ::close(fds[1]);
+    ::unsetenv("SYSFS_PATH");
+    boost::filesystem::remove_all(sysfs);
+}
+
+TEST_CASE("a child which will not exit does not keep the others from being reaped") {
+    auto spawn = [](bool exits) {
+        auto pid = ::fork();
+        REQUIRE(pid >= 0);
+        if (!pid) {
+            if (!exits) {
+                ::pause();
+            }
+            ::_exit(0);
+        }
+        return pid;
+    };
+    auto wait = [](size_t unreaped) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (usbcdc::unreapedChildren() > unreaped
+                && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return usbcdc::unreapedChildren() == unreaped;
+    };
+    auto stuck = spawn(false);
+    usbcdc::reapChild(stuck);
+    usbcdc::reapChild(spawn(true));
+    CHECK(wait(1));
+    ::kill(stuck, SIGKILL);
+    CHECK(wait(0));
+}
+
+TEST_CASE("a Monitor can be driven from many threads") {
+    // Receives are started from arbitrary threads of a multi-threaded io_service while another
+    // thread closes the monitor at a random moment. Meant to be run under ThreadSanitizer.
+    const int kRounds = 50;
+    const int kEvents = 64;
+    const int kThreads = 8;
+    auto records = std::string{};
+    for (int i = 0; i < kEvents; ++i) {
+        records += udevRecord("add", i);
+    }
+    std::mt19937 rng{std::random_device{}()};
+    std::uniform_int_distribution<int> closeDelay{0, 2000};
+
+    for (int round = 0; round < kRounds; ++round) {
+        int fds[2];
+        REQUIRE(!::pipe(fds));
+        REQUIRE(::write(fds[1], records.data(), records.size()) == ssize_t(records.size()));
+
+        boost::asio::io_service context;
+        usbcdc::MonitorImpl monitor{context, fds[0]};
+
+        struct State {
+            boost::asio::io_service& context;
+            usbcdc::MonitorImpl& monitor;
+            std::atomic<int> received;
+            std::atomic<bool> failed;
+        } state{context, monitor, {0}, {false}};
+
+        struct OnEvent {
+            State* s;
+            void operator() (boost::system::error_code ec, usbcdc::DeviceEvent) {
+                if (ec) {
+                    s->failed = true;
+                    return;
+                }
+                ++s->received;
+                s->context.post([s = s] { s->monitor.asyncReceiveDeviceEvent(OnEvent{s}); });
+            }
+        };
+
+        monitor.asyncReceiveDeviceEvent(OnEvent{&state});
+        auto threads = std::vector<std::thread>{};
+        for (int i = 0; i < kThreads; ++i) {
+            threads.emplace_back([&context] { context.run(); });
+        }
+        auto delay = std::chrono::microseconds{closeDelay(rng)};
+        std::thread closer{[&monitor, delay] {
+            std::this_thread::sleep_for(delay);
+            boost::system::error_code ec;
+            monitor.close(ec);
+        }};
+
+        closer.join();
+        for (auto& t: threads) {
+            t.join();
+        }
+        CHECK(state.failed);
+        CHECK(state.received <= kEvents);
+        ::close(fds[1]);
+    }
+}
+
+TEST_CASE("a burst of synthetic events arrives in order, without loss") {
+    // A small run of the load benchmark in tests/monitor-bench.cpp, for its correctness checks.
+    const int kDevices = 500;
+    auto receive = [](usbcdc::MonitorImpl& monitor, LoadRecorder& recorder, int n) {
+        monitor.asyncReceiveDeviceEvent(ReceiveLoop{monitor, recorder, n});
+    };
+    runLoad("udevadm records", Wire::UDEVADM, kDevices, 0, receive);
+    runLoad("uevents", Wire::UEVENT, kDevices, 0, receive);
+
+#if USBCDC_HAS_COROUTINES
+    auto await = [](usbcdc::MonitorImpl& monitor, LoadRecorder& recorder, int n) {
+        [](usbcdc::MonitorImpl& monitor, LoadRecorder& recorder, int n) -> Detached {
+            while (n--) {
+                recorder(co_await monitor.awaitDeviceEvent());
+            }
+        }(monitor, recorder, n);
+    };
+    runLoad("udevadm records, co_await", Wire::UDEVADM, kDevices, 0, await);
+#endif
+}
+
+#endif
+
+#if USBCDC_HAS_COROUTINES
+
+TEST_CASE("can co_await devices and events") {
+    boost::asio::io_service context;
+    usbcdc::Monitor m{context};
+
+    [](usbcdc::Monitor& m) -> Detached {
+        util::log::Logger lg;
+        try {
+            auto devices = co_await m.awaitDevices();
+            BOOST_LOG(lg) << devices.size() << " devices are plugged in, waiting for device event";
+            auto event = co_await m.awaitDeviceEvent();
+            BOOST_LOG(lg) << "DeviceEvent received: " << event;
+        }
+        catch (const boost::system::system_error& e) {
+            BOOST_LOG(lg) << "Monitor failed: " << e.what();
+        }
+    }(m);
+
+    context.run();
+}
+
+#endif
+
 }  // <anonymous>
@@ -0,0 +1,54 @@
+#include <util/doctest.h>
+
+#include <usbcdc/monitor.hpp>
+
+#include "benchmark.hpp"
+
+#if BOOST_OS_LINUX
+
+#include "referencedecoder.hpp"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// =======================================================================================
+// Benchmarks
+
+TEST_CASE("decodeProductString speed versus the regex decoder") {
+    auto corpus = std::vector<std::string>{
+        R"(Linkbot\x20USB)",
+        R"(Linkbot\x20Labs\x20Robot\x20Controller)",
+        R"(USB\x20Serial\x20Device\x20\x28COM\x29)",
+        R"(Arduino\x20Uno)",
+        R"(FT232R)",
+    };
+    const int kRounds = 20000;
+    const auto strings = double(kRounds * corpus.size());
+
+    auto nanosPerString = [&](auto decode) {
+        auto bytes = size_t(0);
+        auto elapsed = bench::time([&] {
+            for (int i = 0; i < kRounds; ++i) {
+                for (auto& s: corpus) {
+                    bytes += decode(s).size();
+                }
+            }
+        });
+        CHECK(bytes);
+        return bench::seconds(elapsed) / strings * 1e9;
+    };
+    auto regex = nanosPerString(reference::decodeProductString);
+    auto table = nanosPerString(usbcdc::decodeProductString);
+    std::ostringstream os;
+    os << regex << " ns/string with the regex, " << table << " ns/string with the table, "
+        << regex / table << "x faster";
+    bench::report("decodeProductString", os.str());
+    CHECK(regex / table >= 10);
+}
+
+}  // <anonymous>
+
+#endif
@@ -0,0 +1,54 @@
+#include <util/doctest.h>
+#include <util/log.hpp>
+
+#include <usbcdc/monitor.hpp>
+
+#if BOOST_OS_LINUX
+
+#include "referencedecoder.hpp"
+
+#include <random>
+#include <string>
+
+namespace {
+
+TEST_CASE("decodeProductString decodes udev escapes") {
+    CHECK(usbcdc::decodeProductString("") == "");
+    CHECK(usbcdc::decodeProductString("Linkbot") == "Linkbot");
+    CHECK(usbcdc::decodeProductString(R"(Linkbot\x20USB)") == "Linkbot USB");
+    CHECK(usbcdc::decodeProductString(R"(\x41\x62)") == "Ab");
+    CHECK(usbcdc::decodeProductString(R"(a\x5cx41)") == R"(a\x41)");
+    CHECK(usbcdc::decodeProductString(R"(\\x41)") == R"(\A)");
+    CHECK(usbcdc::decodeProductString(R"(\x4)") == R"(\x4)");
+    CHECK(usbcdc::decodeProductString(R"(\xg1\X41)") == R"(\xg1\X41)");
+}
+
+TEST_CASE("decodeProductString agrees with the regex decoder on fuzzed input") {
+    // Inputs are drawn mostly from characters which make up escapes, so that complete, truncated,
+    // and malformed escapes are all common.
+    static const char kAlphabet[] = R"(\\\\xxx0123456789abcdefABCDEFgG  Lk)";
+    std::mt19937 rng{20180501};
+    std::uniform_int_distribution<size_t> length{0, 48};
+    std::uniform_int_distribution<size_t> pick{0, sizeof(kAlphabet) - 2};
+    for (int i = 0; i < 100000; ++i) {
+        auto input = std::string(length(rng), ' ');
+        for (auto& c: input) {
+            c = kAlphabet[pick(rng)];
+        }
+        if (i % 16 == 0 && input.size()) {
+            input[pick(rng) % input.size()] = char(rng());
+        }
+        auto expected = reference::decodeProductString(input);
+        auto actual = usbcdc::decodeProductString(input);
+        if (actual != expected) {
+            util::log::Logger lg;
+            BOOST_LOG(lg) << "Mismatch decoding '" << input << "'";
+            CHECK(actual == expected);
+            break;
+        }
+    }
+}
+
+}  // <anonymous>
+
+#endif
@@ -0,0 +1,87 @@
+#include <util/doctest.h>
+
+#include <usbcdc/pollschedule.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+using Clock = usbcdc::PollSchedule::Clock;
+using std::chrono::milliseconds;
+
+usbcdc::PollSchedule makeSchedule () {
+    auto schedule = usbcdc::PollSchedule{};
+    schedule.minimum(milliseconds{100});
+    schedule.maximum(milliseconds{1000});
+    schedule.fastWindow(milliseconds{500});
+    schedule.backoff(2);
+    return schedule;
+}
+
+std::vector<long> quietPolls (usbcdc::PollSchedule& schedule, Clock::time_point& now, int n) {
+    // Advance a simulated clock through `n` polls which find nothing, and return the interval in
+    // milliseconds before each.
+    auto result = std::vector<long>{};
+    for (int i = 0; i < n; ++i) {
+        auto next = std::max(schedule.next(), now);
+        result.push_back(long(std::chrono::duration_cast<milliseconds>(next - now).count()));
+        now = next;
+        schedule.polled(now, false);
+    }
+    return result;
+}
+
+// =======================================================================================
+// Test cases
+
+TEST_CASE("PollSchedule backs off exponentially to its maximum when idle") {
+    auto schedule = makeSchedule();
+    auto now = Clock::time_point{} + std::chrono::hours{1};
+    schedule.polled(now, false);
+    CHECK(quietPolls(schedule, now, 6) == std::vector<long>{200, 400, 800, 1000, 1000, 1000});
+    CHECK(schedule.statistics().interval == milliseconds{1000});
+    CHECK(schedule.statistics().fastPolls == 0);
+}
+
+TEST_CASE("PollSchedule polls fast for a window after a change") {
+    auto schedule = makeSchedule();
+    auto now = Clock::time_point{} + std::chrono::hours{1};
+    schedule.polled(now, false);
+    quietPolls(schedule, now, 5);
+
+    schedule.polled(now, true);
+    CHECK(quietPolls(schedule, now, 7) == std::vector<long>{100, 100, 100, 100, 100, 200, 400});
+    CHECK(schedule.statistics().changes == 1);
+    CHECK(schedule.statistics().fastPolls == 5);
+    CHECK(schedule.statistics().polls == 14);
+}
+
+TEST_CASE("PollSchedule polls fast for a window after a wake") {
+    auto schedule = makeSchedule();
+    auto now = Clock::time_point{} + std::chrono::hours{1};
+    schedule.polled(now, false);
+    quietPolls(schedule, now, 5);
+    REQUIRE(schedule.next() - now == milliseconds{1000});
+
+    // A consumer starts waiting partway through a long interval: the next poll is already due.
+    now += milliseconds{300};
+    schedule.wake(now);
+    CHECK(schedule.next() <= now);
+    CHECK(quietPolls(schedule, now, 7) == std::vector<long>{0, 100, 100, 100, 100, 100, 200});
+    CHECK(schedule.statistics().wakes == 1);
+}
+
+TEST_CASE("PollSchedule with no backoff polls at a fixed interval") {
+    auto schedule = makeSchedule();
+    schedule.backoff(0.5);
+    CHECK(schedule.backoff() == 1);
+    auto now = Clock::time_point{} + std::chrono::hours{1};
+    schedule.polled(now, false);
+    CHECK(quietPolls(schedule, now, 4) == std::vector<long>{100, 100, 100, 100});
+
+    schedule.maximum(milliseconds{10});
+    CHECK(schedule.maximum() == milliseconds{100});
+}
+
+} // <anonymous>
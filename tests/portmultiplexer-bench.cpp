@@ -0,0 +1,74 @@
+#include <util/doctest.h>
+
+#include <usbcdc/linux/portmultiplexer.hpp>
+
+#include "benchmark.hpp"
+#include "pty.hpp"
+
+#include <boost/predef.h>
+
+#if BOOST_OS_LINUX
+
+#include <boost/asio/write.hpp>
+
+#include <ctime>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using synthetic::AsyncPty;
+
+// =======================================================================================
+// Benchmarks
+
+TEST_CASE("PortMultiplexer throughput with 256 ports") {
+    const size_t kPorts = 256;
+    const size_t kBytesPerPort = 256 * 1024;
+
+    boost::asio::io_service context;
+    usbcdc::PortMultiplexer mux{context};
+    auto ptys = std::vector<std::unique_ptr<AsyncPty>>{};
+    for (size_t i = 0; i < kPorts; ++i) {
+        ptys.push_back(std::make_unique<AsyncPty>(context));
+        boost::system::error_code ec;
+        mux.add(ptys.back()->device, ec);
+        REQUIRE(!ec);
+    }
+
+    auto total = size_t(0);
+    auto wakeUps = size_t(0);
+    mux.onRead([&](const std::vector<usbcdc::PortMultiplexer::PortData>& batch) {
+        ++wakeUps;
+        for (const auto& p: batch) {
+            total += boost::asio::buffer_size(p.data);
+        }
+        if (total == kPorts * kBytesPerPort) {
+            mux.close();
+        }
+    });
+    mux.start();
+
+    auto source = std::vector<char>(kBytesPerPort, 'x');
+    for (auto& pty: ptys) {
+        boost::asio::async_write(pty->master, boost::asio::buffer(source),
+            [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+    }
+
+    auto cpuStart = std::clock();
+    auto elapsed = bench::time([&] { context.run(); });
+    auto cpu = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    CHECK(total == kPorts * kBytesPerPort);
+
+    // The CPU time includes the pty writers'.
+    std::ostringstream os;
+    os << bench::throughput(total, elapsed) << " aggregate, " << cpu * 1e9 / total
+        << " ns CPU per byte, " << double(total) / wakeUps << " bytes per wake-up";
+    bench::report(std::to_string(kPorts) + " multiplexed ports", os.str());
+}
+
+}  // <anonymous>
+
+#endif
@@ -0,0 +1,225 @@
+#include <util/doctest.h>
+
+#include <boost/predef.h>
+
+#if BOOST_OS_LINUX
+
+#include <usbcdc/linux/portmultiplexer.hpp>
+
+#include "pty.hpp"
+
+#include <boost/asio/write.hpp>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+using synthetic::AsyncPty;
+
+struct ScriptedMonitor {
+    // Stands in for a monitor in `PortMultiplexer::follow()`. Each receive completes with the next
+    // scripted event, or with operation_aborted once they run out, and `asyncDevices()` completes
+    // with `present`.
+    boost::asio::io_service& context;
+    std::deque<usbcdc::DeviceEvent> events;
+    usbcdc::DeviceSet present;
+    int receives = 0;
+
+    template <class Handler>
+    void asyncReceiveDeviceEvent (Handler handler) {
+        ++receives;
+        auto ec = boost::system::error_code{};
+        auto event = usbcdc::DeviceEvent{};
+        if (events.empty()) {
+            ec = boost::asio::error::operation_aborted;
+        }
+        else {
+            event = std::move(events.front());
+            events.pop_front();
+        }
+        context.post([handler, ec, event]() mutable { handler(ec, event); });
+    }
+
+    template <class Handler>
+    void asyncDevices (Handler handler) {
+        context.post([handler, present = present]() mutable { handler({}, present); });
+    }
+};
+
+usbcdc::DeviceEvent event (decltype(usbcdc::DeviceEvent::type) type, const usbcdc::Device& device,
+        std::shared_ptr<usbcdc::SerialStream> stream = nullptr) {
+    return usbcdc::DeviceEvent{type, device, {}, std::move(stream), {}};
+}
+
+// =======================================================================================
+// Test cases
+
+TEST_CASE("PortMultiplexer reports hangups") {
+    boost::asio::io_service context;
+    usbcdc::PortMultiplexer mux{context};
+    auto pty = std::make_unique<AsyncPty>(context);
+    boost::system::error_code ec;
+    mux.add(pty->device, ec);
+    REQUIRE(!ec);
+    CHECK(mux.size() == 1);
+
+    auto closed = false;
+    mux.onClose([&](const usbcdc::Device& d, boost::system::error_code ec) {
+        CHECK(d.path() == pty->device.path());
+        CHECK(ec);
+        closed = true;
+        mux.close();
+    });
+    mux.start();
+    pty->master.close();
+    context.run();
+    CHECK(closed);
+    CHECK(!mux.size());
+}
+
+TEST_CASE("PortMultiplexer handlers may add ports while a batch is delivered") {
+    // Each batch adds more ports than the multiplexer has ever held, which would reallocate the
+    // batch under the handler if ports reserved room as they were added.
+    const size_t kPorts = 4;
+    boost::asio::io_service context;
+    usbcdc::PortMultiplexer mux{context};
+    auto ptys = std::vector<std::unique_ptr<AsyncPty>>{};
+    auto addPty = [&] {
+        ptys.push_back(std::make_unique<AsyncPty>(context));
+        boost::system::error_code ec;
+        mux.add(ptys.back()->device, ec);
+        REQUIRE(!ec);
+    };
+    for (size_t i = 0; i < kPorts; ++i) {
+        addPty();
+    }
+
+    auto received = std::string{};
+    mux.onRead([&](const std::vector<usbcdc::PortMultiplexer::PortData>& batch) {
+        for (const auto& p: batch) {
+            for (int i = 0; i < 64; ++i) {
+                addPty();
+            }
+            received.append(boost::asio::buffer_cast<const char*>(p.data),
+                boost::asio::buffer_size(p.data));
+        }
+        if (received.size() == kPorts) {
+            mux.close();
+        }
+    });
+    mux.start();
+    for (auto& pty: ptys) {
+        boost::asio::write(pty->master, boost::asio::buffer("x", 1));
+    }
+    context.run();
+    CHECK(received == std::string(kPorts, 'x'));
+}
+
+TEST_CASE("PortMultiplexer delivers each port's data to the right device") {
+    const size_t kPorts = 4;
+    const size_t kBytesPerPort = 4 * 1024;
+
+    boost::asio::io_service context;
+    usbcdc::PortMultiplexer mux{context};
+    auto ptys = std::vector<std::unique_ptr<AsyncPty>>{};
+    for (size_t i = 0; i < kPorts; ++i) {
+        ptys.push_back(std::make_unique<AsyncPty>(context));
+        boost::system::error_code ec;
+        mux.add(ptys.back()->device, ec);
+        REQUIRE(!ec);
+    }
+
+    // Each robot sends its own letter, so that misrouted or reordered data shows.
+    auto received = std::map<std::string, std::string>{};
+    auto total = size_t(0);
+    mux.onRead([&](const std::vector<usbcdc::PortMultiplexer::PortData>& batch) {
+        for (const auto& p: batch) {
+            received[p.device.path()].append(boost::asio::buffer_cast<const char*>(p.data),
+                boost::asio::buffer_size(p.data));
+            total += boost::asio::buffer_size(p.data);
+        }
+        if (total == kPorts * kBytesPerPort) {
+            mux.close();
+        }
+    });
+    mux.start();
+
+    auto sources = std::vector<std::string>{};
+    for (size_t i = 0; i < kPorts; ++i) {
+        sources.push_back(std::string(kBytesPerPort, char('a' + i)));
+    }
+    for (size_t i = 0; i < kPorts; ++i) {
+        boost::asio::async_write(ptys[i]->master, boost::asio::buffer(sources[i]),
+            [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+    }
+    context.run();
+    REQUIRE(received.size() == kPorts);
+    for (size_t i = 0; i < kPorts; ++i) {
+        CHECK(received[ptys[i]->device.path()] == sources[i]);
+    }
+}
+
+TEST_CASE("PortMultiplexer follows a monitor's events") {
+    boost::asio::io_service context;
+    auto a = AsyncPty{context};
+    auto b = AsyncPty{context};
+    auto c = AsyncPty{context};
+
+    // `a` arrives pre-opened, holding what it sent before anyone was listening.
+    auto banner = std::string{"early"};
+    auto stream = usbcdc::preopen(context, a.device, {});
+    REQUIRE(stream);
+    boost::asio::write(a.master, boost::asio::buffer(banner));
+    while (stream->prebuffered() < banner.size() && context.run_one()) {}
+    context.reset();
+
+    // The RESYNC's enumeration no longer finds `b`, and finds `c`, whose ADD was lost.
+    ScriptedMonitor monitor{context};
+    monitor.events.push_back(event(usbcdc::DeviceEvent::ADD, a.device, stream));
+    monitor.events.push_back(event(usbcdc::DeviceEvent::ADD, b.device));
+    monitor.events.push_back(event(usbcdc::DeviceEvent::REMOVE, a.device));
+    monitor.events.push_back(event(usbcdc::DeviceEvent::RESYNC, {}));
+    monitor.present = {c.device};
+
+    usbcdc::PortMultiplexer mux{context};
+    auto received = std::map<std::string, std::string>{};
+    mux.onRead([&](const std::vector<usbcdc::PortMultiplexer::PortData>& batch) {
+        for (const auto& p: batch) {
+            received[p.device.path()].append(boost::asio::buffer_cast<const char*>(p.data),
+                boost::asio::buffer_size(p.data));
+        }
+    });
+    auto failures = 0;
+    mux.onClose([&](const usbcdc::Device&, boost::system::error_code) { ++failures; });
+    mux.follow(monitor);
+    context.run();
+
+    // Every event was applied, and following carried on after the RESYNC.
+    CHECK(monitor.receives == 5);
+    CHECK(!failures);
+    CHECK(!stream->is_open());
+    CHECK(received[a.device.path()] == banner);
+    CHECK(mux.size() == 1);
+    CHECK(mux.statistics(c.device.path()));
+}
+
+TEST_CASE("a PortMultiplexer destroyed while following a monitor stops following") {
+    boost::asio::io_service context;
+    auto pty = AsyncPty{context};
+    ScriptedMonitor monitor{context};
+    monitor.events.push_back(event(usbcdc::DeviceEvent::ADD, pty.device));
+
+    auto mux = std::make_unique<usbcdc::PortMultiplexer>(context);
+    mux->follow(monitor);
+    mux.reset();
+    context.run();
+    CHECK(monitor.receives == 1);
+}
+
+}  // <anonymous>
+
+#endif
@@ -0,0 +1,159 @@
+#include <util/doctest.h>
+#include <util/log.hpp>
+
+#include <usbcdc/portstatistics.hpp>
+#include <usbcdc/serialstream.hpp>
+#include <usbcdc/stalldetector.hpp>
+
+#include <boost/predef.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !BOOST_OS_WINDOWS
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include <fcntl.h>
+#endif
+
+namespace {
+
+using Clock = usbcdc::PortStatistics::Clock;
+using std::chrono::milliseconds;
+
+// =======================================================================================
+// Test cases
+
+TEST_CASE("StallDetector reports each stall once, and recovery") {
+    boost::asio::io_service context;
+    usbcdc::StallDetector detector{context, milliseconds{500}};
+    auto stalls = std::vector<std::string>{};
+    auto recoveries = std::vector<std::string>{};
+    detector.onStall([&](const std::string& path, Clock::duration idle) {
+        CHECK(idle > milliseconds{500});
+        stalls.push_back(path);
+    });
+    detector.onRecover([&](const std::string& path) { recoveries.push_back(path); });
+
+    auto now = Clock::time_point{} + std::chrono::hours{1};
+    auto quiet = std::make_shared<usbcdc::PortStatistics>();
+    auto chatty = std::make_shared<usbcdc::PortStatistics>();
+    auto closed = std::make_shared<usbcdc::PortStatistics>();
+    quiet->opened(now);
+    chatty->opened(now);
+    detector.watch("/dev/ttyACM0", quiet);
+    detector.watch("/dev/ttyACM1", chatty);
+    detector.watch("/dev/ttyACM2", closed);
+
+    CHECK(detector.check(now + milliseconds{400}) == 0);
+    chatty->received(1, now + milliseconds{400});
+    CHECK(detector.check(now + milliseconds{600}) == 1);
+    CHECK(detector.check(now + milliseconds{700}) == 1);
+    REQUIRE(stalls.size() == 1);
+    CHECK(stalls[0] == "/dev/ttyACM0");
+
+    // Input ends the stall; going quiet again starts a new one.
+    quiet->received(8, now + milliseconds{800});
+    CHECK(detector.check(now + milliseconds{800}) == 0);
+    REQUIRE(recoveries.size() == 1);
+    CHECK(recoveries[0] == "/dev/ttyACM0");
+    CHECK(detector.check(now + milliseconds{1400}) == 2);
+    CHECK(stalls.size() == 3);
+
+    // A closed port is never stalled.
+    quiet->closed();
+    CHECK(detector.check(now + milliseconds{2000}) == 1);
+    CHECK(recoveries.size() == 2);
+    CHECK(quiet->bytesIn == 8);
+    CHECK(quiet->readSizes.count(4) == 1);
+}
+
+TEST_CASE("recording port statistics is cheap") {
+    const int kOperations = 10000000;
+    usbcdc::PortStatistics statistics;
+    auto now = Clock::now();
+    statistics.opened(now);
+    auto start = Clock::now();
+    for (int i = 0; i < kOperations; ++i) {
+        statistics.received(size_t(i & 0xff) + 1, now);
+        statistics.handled(now, now);
+    }
+    auto perOperation = std::chrono::duration<double, std::nano>(Clock::now() - start).count()
+        / kOperations;
+    CHECK(statistics.readSizes.total() == uint64_t(kOperations));
+    CHECK(statistics.handlerLatency.count(0) == uint64_t(kOperations));
+
+    util::log::Logger lg;
+    BOOST_LOG(lg) << "recording a read: " << perOperation << "ns";
+    // A few nanoseconds in an optimized build. The bound only catches gross regressions, such as
+    // taking a lock, and leaves room for debug, sanitizer, and loaded builds.
+    CHECK(perOperation < 250);
+}
+
+#if !BOOST_OS_WINDOWS
+
+TEST_CASE("a SerialStream's statistics count its I/O, and can be read from another thread") {
+    boost::asio::io_service context;
+    auto master = ::posix_openpt(O_RDWR | O_NOCTTY);
+    REQUIRE(master >= 0);
+    REQUIRE(!::grantpt(master));
+    REQUIRE(!::unlockpt(master));
+    boost::asio::posix::stream_descriptor robot{context, master};
+    auto stream = std::make_unique<usbcdc::SerialStream>(context);
+    stream->open(usbcdc::Device{::ptsname(master), "pty"});
+    auto statistics = stream->statistics();
+    CHECK(statistics->open);
+
+    // A monitoring thread watches the port, with nothing but the statistics.
+    boost::asio::io_service monitorContext;
+    usbcdc::StallDetector detector{monitorContext, milliseconds{200}};
+    std::atomic<int> stalled{0};
+    detector.onStall([&](const std::string&, Clock::duration) { ++stalled; });
+    detector.watch("robot", statistics);
+    detector.start();
+    auto monitorThread = std::thread{[&] { monitorContext.run(); }};
+
+    auto hello = std::string{"hello"};
+    auto received = std::string(hello.size(), '\0');
+    auto reply = std::string(hello.size(), '\0');
+    boost::asio::async_write(robot, boost::asio::buffer(hello),
+        [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+    boost::asio::async_read(*stream, boost::asio::buffer(&received[0], received.size()),
+    [&](boost::system::error_code ec, size_t) {
+        CHECK(!ec);
+        boost::asio::async_write(*stream, boost::asio::buffer(received),
+            [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+        boost::asio::async_read(robot, boost::asio::buffer(&reply[0], reply.size()),
+            [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+    });
+    context.run();
+    CHECK(reply == hello);
+    CHECK(statistics->bytesIn == hello.size());
+    CHECK(statistics->bytesOut == hello.size());
+    CHECK(statistics->readSizes.total() >= 1);
+    CHECK(statistics->writeSizes.total() >= 1);
+    CHECK(statistics->handlerLatency.total() == statistics->readSizes.total());
+
+    // Now the robot falls silent.
+    auto deadline = Clock::now() + std::chrono::seconds{5};
+    while (!stalled && Clock::now() < deadline) {
+        std::this_thread::sleep_for(milliseconds{5});
+    }
+    CHECK(stalled == 1);
+    CHECK(statistics->sinceLastInput() > milliseconds{200});
+
+    stream.reset();
+    CHECK(!statistics->open);
+    monitorContext.post([&] { detector.stop(); });
+    monitorThread.join();
+}
+
+#endif
+
+} // <anonymous>
@@ -0,0 +1,72 @@
+#ifndef USBCDC_TESTS_PTY_HPP
+#define USBCDC_TESTS_PTY_HPP
+
+// Pseudoterminal pairs standing in for CDC-ACM devices, shared by the test and benchmark
+// programs. The slave side is a tty which usbcdc opens like any serial port; the test holds the
+// master side and plays the robot.
+
+#include <util/doctest.h>
+
+#include <usbcdc/devices.hpp>
+
+#include <boost/predef.h>
+
+#if !BOOST_OS_WINDOWS
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include <vector>
+
+#include <fcntl.h>
+#include <stdlib.h>
+
+namespace synthetic {
+
+struct Pty {
+    // A pty whose master side is a plain blocking descriptor, for tests which hand it to an
+    // io_service of their choosing.
+    int master = -1;
+    usbcdc::Device device;
+
+    Pty () {
+        master = ::posix_openpt(O_RDWR | O_NOCTTY);
+        REQUIRE(master >= 0);
+        REQUIRE(!::grantpt(master));
+        REQUIRE(!::unlockpt(master));
+        device = usbcdc::Device{::ptsname(master), "pty"};
+    }
+};
+
+struct AsyncPty {
+    // A pty whose master side is already a non-blocking stream_descriptor on `context`.
+    boost::asio::posix::stream_descriptor master;
+    usbcdc::Device device;
+
+    explicit AsyncPty (boost::asio::io_service& context)
+        : master(context, ::posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK))
+    {
+        REQUIRE(!::grantpt(master.native_handle()));
+        REQUIRE(!::unlockpt(master.native_handle()));
+        device = usbcdc::Device{::ptsname(master.native_handle()), "pty"};
+    }
+};
+
+inline void drain (AsyncPty& pty, std::vector<char>& buf, size_t& received, size_t total) {
+    // Read the master side into `buf`, each read overwriting the last, counting the bytes in
+    // `received` until `total` have arrived.
+    pty.master.async_read_some(boost::asio::buffer(buf),
+        [&pty, &buf, &received, total](boost::system::error_code ec, size_t n) {
+            REQUIRE(!ec);
+            received += n;
+            if (received < total) {
+                drain(pty, buf, received, total);
+            }
+        });
+}
+
+} // namespace synthetic
+
+#endif
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef USBCDC_TESTS_REFERENCEDECODER_HPP
+#define USBCDC_TESTS_REFERENCEDECODER_HPP
+
+// The original regex-based udev escape decoder, kept as the specification for the table-driven
+// `usbcdc::decodeProductString()`, which the test program checks against it and the benchmark
+// program times against it.
+
+#include <boost/algorithm/hex.hpp>
+#include <boost/algorithm/string/find_format.hpp>
+#include <boost/algorithm/string/regex_find_format.hpp>
+
+#include <string>
+
+namespace reference {
+
+inline std::string decodeProductString (std::string input) {
+    boost::algorithm::find_format_all(
+        input,
+        boost::algorithm::regex_finder(boost::regex(R"(\\x([0-9a-fA-F]{2}))")),
+        [](const auto& result) {
+            char c;
+            boost::algorithm::unhex(result.begin() + 2, result.end(), &c);
+            return std::string{c};
+        }
+    );
+    return input;
+}
+
+} // namespace reference
+
+#endif
@@ -0,0 +1,172 @@
+#include <util/doctest.h>
+
+#include <usbcdc/monitor.hpp>
+
+#if BOOST_OS_LINUX
+
+#include <usbcdc/linux/registry.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+std::string uevent (const std::string& action, int n) {
+    // A uevent for the `n`th CDC-ACM port on a hub, already carrying udev's properties so that the
+    // monitor need not look in sysfs.
+    auto name = "ttyACM" + std::to_string(n);
+    auto devPath = "/devices/usb1/1-1/1-1." + std::to_string(n) + "/1-1." + std::to_string(n)
+        + ":1.0/tty/" + name;
+    auto datagram = action + "@" + devPath + '\0';
+    for (auto& kv: std::vector<std::pair<std::string, std::string>>{
+            {"ACTION", action}, {"DEVPATH", devPath}, {"SUBSYSTEM", "tty"}, {"DEVNAME", name},
+            {"MAJOR", "166"}, {"MINOR", std::to_string(n)}, {"ID_USB_DRIVER", "cdc_acm"},
+            {"ID_MODEL_ENC", "Linkbot\\x20USB"}, {"ID_VENDOR_ID", "2341"},
+            {"ID_MODEL_ID", "0001"}}) {
+        datagram += kv.first + "=" + kv.second + '\0';
+    }
+    return datagram;
+}
+
+TEST_CASE("registry clients share one monitor's device table") {
+    // The enumeration reads sysfs, which `SYSFS_PATH` points at an empty fake of here; events are
+    // injected as uevents.
+    char dir[] = "/tmp/usbcdc-sysfs-XXXXXX";
+    REQUIRE(::mkdtemp(dir));
+    boost::filesystem::create_directories(boost::filesystem::path{dir} / "class/tty");
+    ::setenv("SYSFS_PATH", dir, 1);
+    auto table = "/usbcdc-test-" + std::to_string(::getpid());
+    auto socketPath = std::string{dir} + "/registry.sock";
+
+    int fds[2];
+    REQUIRE(!::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds));
+
+    boost::asio::io_service context;
+    usbcdc::MonitorImpl monitor{context, usbcdc::ueventEventSource(fds[0])};
+    usbcdc::RegistryServer server{context, monitor, table, socketPath};
+    server.start();
+    auto serverThread = std::thread{[&] { context.run(); }};
+
+    const int kClients = 4;
+    const int kDevices = 8;
+    // Every client waits until it sees the final table: ttyACM1 .. ttyACM7.
+    auto results = std::vector<usbcdc::DeviceSet>(kClients);
+    auto waits = std::vector<int>(kClients);
+    auto clients = std::vector<std::thread>{};
+    for (int i = 0; i < kClients; ++i) {
+        clients.emplace_back([&, i] {
+            boost::asio::io_service clientContext;
+            usbcdc::RegistryClient client{clientContext, table, socketPath};
+            auto generation = client.devices(results[i]);
+            while (results[i].size() != kDevices - 1
+                    || results[i].begin()->path() != "/dev/ttyACM1") {
+                client.asyncWaitForChange(generation,
+                [&](boost::system::error_code ec, uint64_t g) {
+                    REQUIRE(!ec);
+                    CHECK(g > generation);
+                });
+                clientContext.run();
+                clientContext.reset();
+                ++waits[i];
+                generation = client.devices(results[i]);
+            }
+        });
+    }
+
+    // Clients may connect before or after any of these; either way they must converge.
+    for (int n = 0; n < kDevices; ++n) {
+        auto datagram = uevent("add", n);
+        REQUIRE(::write(fds[1], datagram.data(), datagram.size()) == ssize_t(datagram.size()));
+    }
+    auto datagram = uevent("remove", 0);
+    REQUIRE(::write(fds[1], datagram.data(), datagram.size()) == ssize_t(datagram.size()));
+
+    for (auto& t: clients) {
+        t.join();
+    }
+    for (int i = 0; i < kClients; ++i) {
+        REQUIRE(results[i].size() == kDevices - 1);
+        auto d = results[i].begin();
+        for (int n = 1; n < kDevices; ++n, ++d) {
+            CHECK(d->path() == "/dev/ttyACM" + std::to_string(n));
+            CHECK(d->productString() == "Linkbot USB");
+            CHECK(d->vendorId() == 0x2341);
+        }
+        // Notices are coalesced, so a client never wakes more often than the table changes.
+        CHECK(waits[i] <= kDevices + 2);
+    }
+
+    context.post([&] {
+        auto ec = boost::system::error_code{};
+        monitor.close(ec);
+        server.close();
+    });
+    serverThread.join();
+    ::close(fds[1]);
+    boost::filesystem::remove_all(dir);
+    ::unsetenv("SYSFS_PATH");
+}
+
+TEST_CASE("a registry server refuses to run twice, and gives up on a failed monitor") {
+    char dir[] = "/tmp/usbcdc-sysfs-XXXXXX";
+    REQUIRE(::mkdtemp(dir));
+    boost::filesystem::create_directories(boost::filesystem::path{dir} / "class/tty");
+    ::setenv("SYSFS_PATH", dir, 1);
+    auto table = "/usbcdc-test-" + std::to_string(::getpid());
+    auto socketPath = std::string{dir} + "/registry.sock";
+
+    int fds[2];
+    REQUIRE(!::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds));
+
+    boost::asio::io_service context;
+    usbcdc::MonitorImpl monitor{context, usbcdc::ueventEventSource(fds[0])};
+    usbcdc::RegistryServer server{context, monitor, table, socketPath};
+    auto failure = boost::system::error_code{};
+    server.onMonitorFailure([&](boost::system::error_code ec) { failure = ec; });
+    server.start();
+
+    // A second server must leave the first one's socket and table alone.
+    CHECK_THROWS_AS(usbcdc::RegistryServer(context, monitor, table, socketPath),
+        boost::system::system_error);
+    boost::asio::io_service clientContext;
+    usbcdc::RegistryClient client{clientContext, table, socketPath};
+
+    // The monitor fails once its event source closes. The client must hear about it.
+    auto datagram = uevent("add", 0);
+    REQUIRE(::write(fds[1], datagram.data(), datagram.size()) == ssize_t(datagram.size()));
+    ::close(fds[1]);
+    auto serverThread = std::thread{[&] { context.run(); }};
+    auto waitError = boost::system::error_code{};
+    auto generation = client.generation();
+    for (;;) {
+        client.asyncWaitForChange(generation, [&](boost::system::error_code ec, uint64_t g) {
+            waitError = ec;
+            generation = g;
+        });
+        clientContext.run();
+        clientContext.reset();
+        if (waitError) {
+            break;
+        }
+    }
+    serverThread.join();
+    CHECK(waitError == boost::asio::error::eof);
+    CHECK(failure);
+    CHECK(!server.subscribers());
+    CHECK_THROWS_AS(usbcdc::RegistryClient(clientContext, table, socketPath),
+        boost::system::system_error);
+
+    boost::filesystem::remove_all(dir);
+    ::unsetenv("SYSFS_PATH");
+}
+
+} // <anonymous>
+
+#endif
@@ -0,0 +1,165 @@
+#include <util/doctest.h>
+
+#include <usbcdc/serialstream.hpp>
+
+#include "benchmark.hpp"
+#include "pty.hpp"
+
+#include <boost/predef.h>
+
+#if !BOOST_OS_WINDOWS
+
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace {
+
+using synthetic::Pty;
+
+// =======================================================================================
+// Benchmarks
+
+TEST_CASE("SerialStream throughput over a pty") {
+    boost::asio::io_service context;
+    Pty pty;
+    boost::asio::posix::stream_descriptor robot{context, pty.master};
+    usbcdc::SerialStream stream{context};
+    stream.open(pty.device);
+
+    const size_t kTotal = 16 * 1024 * 1024;
+    auto source = std::vector<char>(kTotal, 'x');
+    auto sink = std::vector<char>(64 * 1024);
+    auto nRead = size_t(0);
+
+    auto elapsed = bench::time([&] {
+        boost::asio::async_write(robot, boost::asio::buffer(source),
+            [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+        std::function<void(boost::system::error_code, size_t)> onRead;
+        onRead = [&](boost::system::error_code ec, size_t n) {
+            nRead += n;
+            if (!ec && nRead < kTotal) {
+                stream.async_read_some(boost::asio::buffer(sink), onRead);
+            }
+        };
+        stream.async_read_some(boost::asio::buffer(sink), onRead);
+        context.run();
+    });
+    CHECK(nRead == kTotal);
+    bench::report("pty -> SerialStream", bench::throughput(nRead, elapsed));
+}
+
+TEST_CASE("SerialStream round-trip latency by profile over a pty") {
+    auto measure = [](const usbcdc::SerialProfile& profile) {
+        boost::asio::io_service context;
+        Pty pty;
+        boost::asio::posix::stream_descriptor robot{context, pty.master};
+        usbcdc::SerialStream stream{context};
+        stream.open(pty.device, profile);
+
+        const size_t kRoundTrips = 10000;
+        auto samples = bench::Latencies{kRoundTrips};
+        auto ping = char(0x55);
+        auto pong = char(0);
+        auto echo = char(0);
+        auto start = bench::Clock::now();
+        std::function<void()> roundTrip;
+        roundTrip = [&] {
+            start = bench::Clock::now();
+            boost::asio::async_write(robot, boost::asio::buffer(&ping, 1),
+                [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+            stream.async_read_some(boost::asio::buffer(&echo, 1),
+                [&](boost::system::error_code ec, size_t) {
+                    REQUIRE(!ec);
+                    boost::asio::async_write(stream, boost::asio::buffer(&echo, 1),
+                        [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+                });
+            boost::asio::async_read(robot, boost::asio::buffer(&pong, 1),
+                [&](boost::system::error_code ec, size_t) {
+                    REQUIRE(!ec);
+                    samples.add(bench::Clock::now() - start);
+                    if (samples.size() < kRoundTrips) {
+                        roundTrip();
+                    }
+                });
+        };
+        roundTrip();
+        context.run();
+        CHECK(samples.size() == kRoundTrips);
+        return samples.summary();
+    };
+
+    bench::report("round trip, default profile", measure(usbcdc::SerialProfile{}));
+    bench::report("round trip, low-latency profile",
+        measure(usbcdc::SerialProfile::lowLatencyProfile()));
+}
+
+TEST_CASE("time to first byte, cold open versus pre-opened") {
+    // The simulated robot sends a banner when it appears, and again whenever it is poked. A
+    // consumer which opens the port only once it is ready to talk has missed the first banner
+    // and must poke the robot; a consumer handed a pre-opened port reads it from the prebuffer.
+    // Each sample runs from the moment the consumer is ready until it holds the banner.
+    const size_t kSamples = 200;
+    const auto banner = std::string{"Linkbot ready\r\n"};
+
+    auto cold = bench::Latencies{kSamples};
+    auto warm = bench::Latencies{kSamples};
+    for (size_t i = 0; i < kSamples; ++i) {
+        boost::asio::io_service context;
+        Pty pty;
+        boost::asio::posix::stream_descriptor robot{context, pty.master};
+        auto received = std::string(banner.size(), '\0');
+        auto poke = char(0);
+
+        auto start = bench::Clock::now();
+        usbcdc::SerialStream stream{context};
+        stream.open(pty.device);
+        boost::asio::async_write(stream, boost::asio::buffer(&poke, 1),
+            [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+        boost::asio::async_read(robot, boost::asio::buffer(&poke, 1),
+            [&](boost::system::error_code ec, size_t) {
+                REQUIRE(!ec);
+                boost::asio::write(robot, boost::asio::buffer(banner));
+            });
+        boost::asio::async_read(stream, boost::asio::buffer(&received[0], received.size()),
+            [&](boost::system::error_code ec, size_t) {
+                REQUIRE(!ec);
+                cold.add(bench::Clock::now() - start);
+            });
+        context.run();
+        CHECK(received == banner);
+    }
+    for (size_t i = 0; i < kSamples; ++i) {
+        boost::asio::io_service context;
+        Pty pty;
+        boost::asio::posix::stream_descriptor robot{context, pty.master};
+        auto received = std::string(banner.size(), '\0');
+
+        auto stream = usbcdc::preopen(context, pty.device, {});
+        REQUIRE(stream);
+        boost::asio::write(robot, boost::asio::buffer(banner));
+        while (stream->prebuffered() < banner.size() && context.run_one()) {}
+        context.reset();
+
+        auto start = bench::Clock::now();
+        boost::asio::async_read(*stream, boost::asio::buffer(&received[0], received.size()),
+            [&](boost::system::error_code ec, size_t) {
+                REQUIRE(!ec);
+                warm.add(bench::Clock::now() - start);
+            });
+        context.run();
+        CHECK(received == banner);
+    }
+    REQUIRE(cold.size() == kSamples);
+    REQUIRE(warm.size() == kSamples);
+    bench::report("time to first byte, cold open", cold.summary());
+    bench::report("time to first byte, pre-opened", warm.summary());
+}
+
+}  // <anonymous>
+
+#endif
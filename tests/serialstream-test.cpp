@@ -0,0 +1,165 @@
+#include <util/doctest.h>
+
+#include <usbcdc/serialstream.hpp>
+
+#include "pty.hpp"
+
+#include <boost/predef.h>
+
+#if !BOOST_OS_WINDOWS
+
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+using synthetic::Pty;
+
+// =======================================================================================
+// Test cases
+
+TEST_CASE("can read and write through a SerialStream") {
+    boost::asio::io_service context;
+    Pty pty;
+    boost::asio::posix::stream_descriptor robot{context, pty.master};
+    usbcdc::SerialStream stream{context};
+    stream.open(pty.device);
+
+    auto hello = std::string{"hello\r\n\x03\x00\xff", 10};
+    auto received = std::string(hello.size(), '\0');
+    boost::asio::async_write(robot, boost::asio::buffer(hello),
+        [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+    boost::asio::async_read(stream, boost::asio::buffer(&received[0], received.size()),
+        [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+    context.run();
+
+    // Raw mode: no CR/LF translation, no signal characters, and 8-bit clean.
+    CHECK(received == hello);
+}
+
+TEST_CASE("a spinning SerialStream still blocks in synchronous reads") {
+    // A spin budget puts the descriptor in non-blocking mode, which must not leak into
+    // `read_some()`: a read issued before the robot answers waits for the answer.
+    boost::asio::io_service context;
+    Pty pty;
+    usbcdc::SerialStream stream{context};
+    stream.open(pty.device, usbcdc::SerialProfile::lowLatencyProfile());
+
+    auto reply = std::string{"pong"};
+    auto robot = std::thread{[&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        CHECK(::write(pty.master, reply.data(), reply.size()) == ssize_t(reply.size()));
+    }};
+    auto received = std::string(reply.size(), '\0');
+    boost::system::error_code ec;
+    boost::asio::read(stream, boost::asio::buffer(&received[0], received.size()), ec);
+    robot.join();
+    CHECK(!ec);
+    CHECK(received == reply);
+    ::close(pty.master);
+}
+
+TEST_CASE("a low-latency SerialStream echoes through its spinning reads") {
+    // The robot replies at once, within the spin budget, and long after the read has given up
+    // spinning and parked on the reactor, so that both the spin and the reactor deliver data.
+    boost::asio::io_service context;
+    Pty pty;
+    boost::asio::posix::stream_descriptor robot{context, pty.master};
+    usbcdc::SerialStream stream{context};
+    stream.open(pty.device, usbcdc::SerialProfile::lowLatencyProfile());
+
+    const auto delays = std::vector<std::chrono::microseconds>{
+        std::chrono::microseconds{0}, std::chrono::microseconds{10},
+        std::chrono::microseconds{20000}};
+    for (size_t i = 0; i < delays.size(); ++i) {
+        auto ping = char('a' + i);
+        auto echo = char(0);
+        auto robotThread = std::thread{[&] {
+            std::this_thread::sleep_for(delays[i]);
+            boost::asio::write(robot, boost::asio::buffer(&ping, 1));
+        }};
+        stream.async_read_some(boost::asio::buffer(&echo, 1),
+            [](boost::system::error_code ec, size_t n) {
+                CHECK(!ec);
+                CHECK(n == 1);
+            });
+        context.run();
+        context.reset();
+        robotThread.join();
+        CHECK(echo == ping);
+    }
+}
+
+TEST_CASE("a prebuffered SerialStream keeps early bytes in order") {
+    boost::asio::io_service context;
+    Pty pty;
+    boost::asio::posix::stream_descriptor robot{context, pty.master};
+    auto stream = usbcdc::preopen(context, pty.device, {}, 16);
+    REQUIRE(stream);
+
+    // The robot's banner arrives before anyone reads the stream. Only the first 16 bytes fit in
+    // the prebuffer; the rest must wait in the driver and still arrive in order.
+    auto banner = std::string(100, '\0');
+    for (size_t i = 0; i < banner.size(); ++i) {
+        banner[i] = char(i);
+    }
+    boost::asio::write(robot, boost::asio::buffer(banner));
+    while (stream->prebuffered() < 16 && context.run_one()) {}
+    CHECK(stream->prebuffered() == 16);
+    context.reset();
+
+    auto received = std::string(banner.size(), '\0');
+    boost::asio::async_read(*stream, boost::asio::buffer(&received[0], received.size()),
+        [](boost::system::error_code ec, size_t) { CHECK(!ec); });
+    context.run();
+    CHECK(received == banner);
+    CHECK(stream->prebuffered() == 0);
+}
+
+TEST_CASE("a SerialStream may be read while its prebuffer fills on another thread") {
+    // The prebuffer's wait completes on the io_service's thread while the owner reads on its own,
+    // so the two race to take each byte. Every byte must arrive exactly once, in order.
+    const int kRounds = 50;
+    boost::asio::io_service context;
+    auto work = std::make_unique<boost::asio::io_service::work>(context);
+    auto ioThread = std::thread{[&] { context.run(); }};
+
+    auto banner = std::string(256, '\0');
+    for (size_t i = 0; i < banner.size(); ++i) {
+        banner[i] = char(i);
+    }
+    for (int round = 0; round < kRounds; ++round) {
+        Pty pty;
+        boost::asio::io_service writerContext;
+        boost::asio::posix::stream_descriptor robot{writerContext, pty.master};
+        auto stream = usbcdc::preopen(context, pty.device, {}, 64);
+        REQUIRE(stream);
+
+        auto received = std::string(banner.size(), '\0');
+        auto nRead = size_t(0);
+        for (size_t sent = 0; sent < banner.size(); sent += 16) {
+            boost::asio::write(robot, boost::asio::buffer(&banner[sent], 16));
+            if (sent >= 128) {
+                nRead += boost::asio::read(*stream, boost::asio::buffer(&received[nRead], 16));
+            }
+        }
+        boost::asio::read(*stream,
+            boost::asio::buffer(&received[nRead], received.size() - nRead));
+        CHECK(received == banner);
+    }
+    work.reset();
+    ioThread.join();
+}
+
+}  // <anonymous>
+
+#endif
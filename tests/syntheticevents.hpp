@@ -0,0 +1,286 @@
+#ifndef USBCDC_TESTS_SYNTHETICEVENTS_HPP
+#define USBCDC_TESTS_SYNTHETICEVENTS_HPP
+
+// Event records and uevent datagrams for feeding a Linux monitor without udev or hardware, and a
+// load generator built on them, shared by the test and benchmark programs.
+
+#include <util/doctest.h>
+#include <util/log.hpp>
+
+#include <usbcdc/coroutine.hpp>
+#include <usbcdc/monitor.hpp>
+
+#include <boost/predef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if BOOST_OS_LINUX
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace synthetic {
+
+#if USBCDC_HAS_COROUTINES
+
+struct Detached {
+    // A coroutine which starts immediately and which nobody waits for.
+    struct promise_type {
+        Detached get_return_object () { return {}; }
+        std::suspend_never initial_suspend () noexcept { return {}; }
+        std::suspend_never final_suspend () noexcept { return {}; }
+        void return_void () {}
+        void unhandled_exception () { std::terminate(); }
+    };
+};
+
+#endif
+
+
+using Properties = std::vector<std::pair<std::string, std::string>>;
+
+enum class Wire {
+    UDEVADM,
+    // `udevadm monitor --property` records, as read from a pipe.
+    UEVENT
+    // Netlink uevent datagrams, as read by `usbcdc::ueventEventSource()`.
+};
+
+inline std::string encodeEvent (Wire wire, const Properties& properties) {
+    // `properties` must start with ACTION, DEVPATH, and SUBSYSTEM.
+    auto& action = properties[0].second;
+    auto& devPath = properties[1].second;
+    auto& subsystem = properties[2].second;
+    if (wire == Wire::UDEVADM) {
+        auto record = "UDEV  [1000.000000] " + action + " " + devPath + " (" + subsystem + ")\n";
+        for (auto& kv: properties) {
+            record += kv.first + "=" + kv.second + "\n";
+        }
+        return record + "\n";
+    }
+    auto datagram = action + "@" + devPath + '\0';
+    for (auto& kv: properties) {
+        // The kernel's DEVNAME is relative to /dev.
+        auto value = kv.first == "DEVNAME" ? kv.second.substr(5) : kv.second;
+        datagram += kv.first + "=" + value + '\0';
+    }
+    return datagram;
+}
+
+inline std::string usbDevPath (int n) {
+    return "/devices/pci0000:00/0000:00:14.0/usb1/1-1/1-1." + std::to_string(n);
+}
+
+inline Properties ttyProperties (const std::string& action, int n,
+        const std::string& driver = "cdc_acm") {
+    // A tty on the `n`th port of a hub, bound to `driver`.
+    auto acm = driver == "cdc_acm";
+    auto name = (acm ? "ttyACM" : "ttyUSB") + std::to_string(n);
+    return {
+        {"ACTION", action},
+        {"DEVPATH", usbDevPath(n) + "/1-1." + std::to_string(n) + ":1.0/tty/" + name},
+        {"SUBSYSTEM", "tty"},
+        {"DEVNAME", "/dev/" + name},
+        {"MAJOR", acm ? "166" : "188"},
+        {"MINOR", std::to_string(n)},
+        {"ID_USB_DRIVER", driver},
+        {"ID_MODEL_ENC", "Linkbot\\x20USB"},
+        {"ID_VENDOR_ID", "2341"},
+        {"ID_MODEL_ID", "0001"},
+    };
+}
+
+inline std::string udevRecord (const std::string& action, int n) {
+    // A `udevadm monitor --property` record for the `n`th CDC-ACM port on a hub.
+    return encodeEvent(Wire::UDEVADM, ttyProperties(action, n));
+}
+
+#if BOOST_OS_LINUX
+
+struct SyntheticEvent {
+    int event;
+    // The index of the `DeviceEvent` this produces, or -1 for noise which the monitor ignores.
+    std::string data;
+};
+
+inline std::vector<SyntheticEvent> syntheticStream (Wire wire, int devices, double noise) {
+    // `devices` CDC-ACM ports which each arrive and leave, so event `2n` is ttyACM`n`'s ADD and
+    // event `2n + 1` its REMOVE. About `noise` of the stream is traffic a busy host would also
+    // produce: USB interfaces binding, `change` events, and ttys from other drivers.
+    std::mt19937 rng{1234};
+    std::bernoulli_distribution isNoise{noise};
+    std::uniform_int_distribution<int> kind{0, 2};
+    auto stream = std::vector<SyntheticEvent>{};
+    auto addNoise = [&](int n) {
+        while (isNoise(rng)) {
+            switch (kind(rng)) {
+                case 0:
+                    stream.push_back({-1, encodeEvent(wire, {{"ACTION", "bind"},
+                        {"DEVPATH", usbDevPath(n)}, {"SUBSYSTEM", "usb"}, {"DRIVER", "usb"}})});
+                    break;
+                case 1:
+                    stream.push_back({-1, encodeEvent(wire, ttyProperties("change", n))});
+                    break;
+                case 2:
+                    stream.push_back({-1, encodeEvent(wire, ttyProperties("add", n, "ftdi_sio"))});
+                    break;
+            }
+        }
+    };
+    for (int n = 0; n < devices; ++n) {
+        addNoise(n);
+        stream.push_back({2 * n, encodeEvent(wire, ttyProperties("add", n))});
+        addNoise(n);
+        stream.push_back({2 * n + 1, encodeEvent(wire, ttyProperties("remove", n))});
+    }
+    return stream;
+}
+
+class EventGenerator {
+    // Feeds a stream of synthetic events to a monitor from its own thread, at `rate` events per
+    // second, or as fast as the monitor takes them if `rate` is zero, and records when each
+    // `DeviceEvent`'s record was sent.
+public:
+    EventGenerator (Wire wire, std::vector<SyntheticEvent> stream, double rate)
+        : mStream(std::move(stream))
+        , mRate(rate)
+        , mSentAt(new std::atomic<int64_t>[mStream.size()])
+    {
+        auto ok = wire == Wire::UDEVADM
+            ? !::pipe(mFds)
+            : !::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, mFds);
+        REQUIRE(ok);
+    }
+
+    ~EventGenerator () {
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+        ::close(mFds[1]);
+    }
+
+    int monitorDescriptor () const { return mFds[0]; }
+
+    void start () {
+        mThread = std::thread{[this] {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < mStream.size(); ++i) {
+                if (mRate) {
+                    std::this_thread::sleep_until(start + std::chrono::duration_cast<
+                        std::chrono::steady_clock::duration>(std::chrono::duration<double>(i / mRate)));
+                }
+                auto& e = mStream[i];
+                if (e.event >= 0) {
+                    mSentAt[e.event] = std::chrono::steady_clock::now().time_since_epoch().count();
+                }
+                if (::write(mFds[1], e.data.data(), e.data.size()) != ssize_t(e.data.size())) {
+                    return;
+                }
+            }
+        }};
+    }
+
+    std::chrono::steady_clock::time_point sentAt (int event) const {
+        return std::chrono::steady_clock::time_point{
+            std::chrono::steady_clock::duration{mSentAt[event].load()}};
+    }
+
+private:
+    std::vector<SyntheticEvent> mStream;
+    double mRate;
+    std::unique_ptr<std::atomic<int64_t>[]> mSentAt;
+    int mFds[2];
+    std::thread mThread;
+};
+
+inline double threadCpuSeconds () {
+    timespec ts;
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct LoadRecorder {
+    // Checks each event against the synthetic stream and records its latency.
+    const EventGenerator& generator;
+    std::vector<double> latencies;
+    int received = 0;
+    bool ordered = true;
+
+    void operator() (const usbcdc::DeviceEvent& event) {
+        auto now = std::chrono::steady_clock::now();
+        auto n = std::stoi(event.device.path().substr(std::strlen("/dev/ttyACM")));
+        auto index = 2 * n + (event.type == usbcdc::DeviceEvent::REMOVE);
+        ordered = ordered && index == received;
+        latencies.push_back(std::chrono::duration<double, std::micro>(
+            now - generator.sentAt(index)).count());
+        ++received;
+    }
+};
+
+template <class Consume>
+void runLoad (const char* name, Wire wire, int devices, double rate, Consume&& consume) {
+    // Push a synthetic stream of `devices` arrivals and departures through a monitor, check that
+    // every event arrives in order, and report throughput, latency from the generator's `write()`
+    // to the handler, and the CPU time of the thread running the monitor.
+    util::log::Logger lg;
+    EventGenerator generator{wire, syntheticStream(wire, devices, 0.2), rate};
+    boost::asio::io_service context;
+    usbcdc::MonitorImpl monitor{context, wire == Wire::UDEVADM
+        ? std::make_unique<usbcdc::RecordEventSource>(generator.monitorDescriptor())
+        : usbcdc::ueventEventSource(generator.monitorDescriptor())};
+    LoadRecorder recorder{generator, {}};
+    recorder.latencies.reserve(2 * devices);
+
+    consume(monitor, recorder, 2 * devices);
+    auto start = std::chrono::steady_clock::now();
+    auto cpuStart = threadCpuSeconds();
+    generator.start();
+    context.run();
+    auto cpu = threadCpuSeconds() - cpuStart;
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    CHECK(recorder.received == 2 * devices);
+    CHECK(recorder.ordered);
+    REQUIRE(recorder.latencies.size());
+    auto& l = recorder.latencies;
+    std::sort(l.begin(), l.end());
+    BOOST_LOG(lg) << name << ": " << recorder.received / elapsed << " events/s, latency p50 "
+        << l[l.size() / 2] << "us p99 " << l[l.size() * 99 / 100] << "us max " << l.back()
+        << "us, CPU " << cpu / recorder.received * 1e6 << "us/event ("
+        << 100 * cpu / elapsed << "%)";
+
+    boost::system::error_code ec;
+    monitor.close(ec);
+}
+
+struct ReceiveLoop {
+    // Receives `remaining` events with `asyncReceiveDeviceEvent()`.
+    usbcdc::MonitorImpl& monitor;
+    LoadRecorder& recorder;
+    int remaining;
+
+    void operator() (boost::system::error_code ec, usbcdc::DeviceEvent event) {
+        REQUIRE(!ec);
+        recorder(event);
+        if (--remaining) {
+            monitor.asyncReceiveDeviceEvent(*this);
+        }
+    }
+};
+
+#endif
+
+} // namespace synthetic
+
+#endif
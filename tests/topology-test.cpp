@@ -0,0 +1,52 @@
+#include <util/doctest.h>
+
+#include <usbcdc/topology.hpp>
+
+namespace {
+
+usbcdc::Device makeDevice (const std::string& path, const std::string& portPath) {
+    auto d = usbcdc::Device{path, "Linkbot"};
+    d.portPath(portPath);
+    return d;
+}
+
+// =======================================================================================
+// Test cases
+
+TEST_CASE("can extract USB port paths from sysfs paths") {
+    CHECK(usbcdc::usbPortPath(
+        "/devices/pci0000:00/0000:00:14.0/usb1/1-1/1-1.4/1-1.4:1.0/tty/ttyACM0") == "1-1.4");
+    CHECK(usbcdc::usbPortPath("/devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0") == "1-2");
+    CHECK(usbcdc::usbPortPath("/devices/virtual/tty/tty0") == "");
+
+    CHECK(usbcdc::parentPortPath("1-1.4.2") == "1-1.4");
+    CHECK(usbcdc::parentPortPath("1-1") == "usb1");
+}
+
+TEST_CASE("TopologyIndex answers subtree queries") {
+    auto index = usbcdc::TopologyIndex{usbcdc::DeviceSet{
+        makeDevice("/dev/ttyACM0", "1-1.4.2"),
+        makeDevice("/dev/ttyACM1", "1-1.4.3"),
+        makeDevice("/dev/ttyACM2", "1-1.1"),
+        makeDevice("/dev/ttyACM3", "1-10"),
+        makeDevice("/dev/ttyACM4", "2-1"),
+    }};
+
+    CHECK(index.devicesUnder("1-1.4").size() == 2);
+    CHECK(index.devicesUnder("1-1").size() == 3);
+    CHECK(index.devicesUnder("usb1").size() == 4);
+    CHECK(index.devicesUnder("usb2").size() == 1);
+    CHECK(index.children("1-1").size() == 1);
+    CHECK(index.children("1-1.4").size() == 2);
+
+    auto diff = index.replaceSubtree("1-1.4", usbcdc::DeviceSet{
+        makeDevice("/dev/ttyACM1", "1-1.4.3"),
+        makeDevice("/dev/ttyACM5", "1-1.4.1"),
+    });
+    CHECK(diff.added.size() == 1);
+    CHECK(diff.removed.size() == 1);
+    CHECK(index.size() == 5);
+    CHECK(index.devicesUnder("1-1.4").count(makeDevice("/dev/ttyACM5", "1-1.4.1")));
+}
+
+}  // <anonymous>
@@ -0,0 +1,109 @@
+#include <util/doctest.h>
+#include <util/log.hpp>
+
+#include <usbcdc/trace.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace {
+
+size_t count (const std::string& haystack, const std::string& needle) {
+    auto n = size_t(0);
+    for (auto p = haystack.find(needle); p != std::string::npos; p = haystack.find(needle, p + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+std::string dump () {
+    auto os = std::ostringstream{};
+    usbcdc::trace::writeChromeTrace(os);
+    return os.str();
+}
+
+// =======================================================================================
+// Test cases
+
+TEST_CASE("trace spans are recorded per thread only while enabled") {
+    usbcdc::trace::clear();
+    {
+        USBCDC_TRACE_SCOPE("disabled");
+    }
+    usbcdc::trace::enable(true);
+    auto work = [] {
+        for (int i = 0; i < 10; ++i) {
+            USBCDC_TRACE_SCOPE("outer");
+            USBCDC_TRACE_SCOPE("inner \"quoted\"");
+        }
+    };
+    work();
+    std::thread{work}.join();
+    usbcdc::trace::enable(false);
+
+    auto json = dump();
+    CHECK(json.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[") == 0);
+    CHECK(count(json, "\"name\":\"disabled\"") == 0);
+    CHECK(count(json, "\"name\":\"outer\"") == 20);
+    CHECK(count(json, R"("name":"inner \"quoted\"")") == 20);
+    CHECK(count(json, "\"ph\":\"X\"") == 40);
+
+    usbcdc::trace::clear();
+    CHECK(count(dump(), "\"ph\":\"X\"") == 0);
+}
+
+TEST_CASE("a thread's trace buffer keeps its most recent spans") {
+    usbcdc::trace::clear();
+    usbcdc::trace::enable(true);
+    std::thread{[] {
+        for (size_t i = 0; i < usbcdc::trace::kSpansPerThread + 100; ++i) {
+            USBCDC_TRACE_SCOPE("span");
+        }
+    }}.join();
+    usbcdc::trace::enable(false);
+    CHECK(count(dump(), "\"name\":\"span\"") == usbcdc::trace::kSpansPerThread);
+    usbcdc::trace::clear();
+}
+
+TEST_CASE("a trace can be dumped while its threads record spans") {
+    // Dumps race with a thread which keeps wrapping its buffer. Each dump must still hold only
+    // whole spans. Meant to be run under ThreadSanitizer as well.
+    usbcdc::trace::clear();
+    usbcdc::trace::enable(true);
+    std::atomic<bool> done{false};
+    auto writer = std::thread{[&] {
+        while (!done) {
+            USBCDC_TRACE_SCOPE("span");
+        }
+    }};
+    for (int i = 0; i < 20; ++i) {
+        auto json = dump();
+        CHECK(count(json, "\"name\":\"span\"") == count(json, "\"ph\":\"X\""));
+        CHECK(count(json, "\"ph\":\"X\"") <= usbcdc::trace::kSpansPerThread);
+    }
+    done = true;
+    writer.join();
+    usbcdc::trace::enable(false);
+    usbcdc::trace::clear();
+}
+
+TEST_CASE("disabled trace spans are cheap") {
+    const int kSpans = 10000000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kSpans; ++i) {
+        USBCDC_TRACE_SCOPE("disabled");
+    }
+    auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start)
+        .count() / kSpans;
+    util::log::Logger lg;
+    BOOST_LOG(lg) << "disabled trace span: " << ns << "ns";
+    // A relaxed load and a branch take about a nanosecond. The bound only catches gross
+    // regressions, such as taking a lock or reading the clock, and leaves room for debug,
+    // sanitizer, and loaded builds.
+    CHECK(ns < 250);
+}
+
+} // <anonymous>
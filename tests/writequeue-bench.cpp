@@ -0,0 +1,89 @@
+#include <util/doctest.h>
+
+#include "benchmark.hpp"
+#include "pty.hpp"
+
+#include <boost/predef.h>
+
+#if !BOOST_OS_WINDOWS
+
+#include <usbcdc/serialstream.hpp>
+#include <usbcdc/writequeue.hpp>
+
+#include <boost/asio/write.hpp>
+
+#include <functional>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+using synthetic::AsyncPty;
+using synthetic::drain;
+
+const size_t kFrameSize = 24;
+const size_t kFramesPerTick = 16;
+const size_t kTicks = 4096;
+
+// Emit `kFramesPerTick` frames per io_service turn, as a control loop would, using `write`, and
+// return the rate at which they reach the other end.
+template <class Write>
+std::string frameRate (Write write, boost::asio::io_service& context, AsyncPty& pty) {
+    auto frames = std::vector<char>(kFrameSize * kFramesPerTick, 'f');
+    auto buf = std::vector<char>(64 * 1024);
+    auto received = size_t(0);
+    auto total = kFrameSize * kFramesPerTick * kTicks;
+    drain(pty, buf, received, total);
+
+    auto ticks = size_t(0);
+    std::function<void()> tick;
+    tick = [&] {
+        for (size_t i = 0; i < kFramesPerTick; ++i) {
+            write(boost::asio::buffer(&frames[i * kFrameSize], kFrameSize));
+        }
+        if (++ticks < kTicks) {
+            context.post(tick);
+        }
+    };
+    auto elapsed = bench::time([&] {
+        context.post(tick);
+        context.run();
+    });
+    CHECK(received == total);
+    return bench::rate(kFramesPerTick * kTicks, elapsed, "frames");
+}
+
+// =======================================================================================
+// Benchmarks
+
+TEST_CASE("WriteQueue frames/sec versus per-frame writes over a pty") {
+    {
+        boost::asio::io_service context;
+        AsyncPty pty{context};
+        usbcdc::SerialStream stream{context};
+        stream.open(pty.device);
+        bench::report("per-frame write(2)", frameRate([&stream](boost::asio::const_buffer frame) {
+            boost::system::error_code ec;
+            boost::asio::write(stream.next_layer(), boost::asio::buffer(frame), ec);
+            REQUIRE(!ec);
+        }, context, pty));
+    }
+    {
+        boost::asio::io_service context;
+        AsyncPty pty{context};
+        usbcdc::SerialStream stream{context};
+        stream.open(pty.device);
+        usbcdc::WriteQueue<usbcdc::SerialStream> queue{stream};
+        auto rate = frameRate([&queue](boost::asio::const_buffer frame) {
+            queue.asyncWrite(frame, [](boost::system::error_code ec) { REQUIRE(!ec); });
+        }, context, pty);
+        std::ostringstream os;
+        os << rate << ", " << double(queue.statistics().frames) / queue.statistics().batches
+            << " frames per batch";
+        bench::report("WriteQueue writev(2)", os.str());
+    }
+}
+
+}  // <anonymous>
+
+#endif
@@ -0,0 +1,51 @@
+#include <util/doctest.h>
+
+#include <boost/predef.h>
+
+#if !BOOST_OS_WINDOWS
+
+#include <usbcdc/serialstream.hpp>
+#include <usbcdc/writequeue.hpp>
+
+#include "pty.hpp"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+using synthetic::AsyncPty;
+using synthetic::drain;
+
+// =======================================================================================
+// Test cases
+
+TEST_CASE("WriteQueue coalesces the frames of one turn into one batch") {
+    boost::asio::io_service context;
+    AsyncPty pty{context};
+    usbcdc::SerialStream stream{context};
+    stream.open(pty.device);
+    usbcdc::WriteQueue<usbcdc::SerialStream> queue{stream};
+
+    auto completed = 0;
+    const char frames[] = "abcdefghij";
+    for (int i = 0; i < 10; ++i) {
+        queue.asyncWrite(boost::asio::buffer(frames + i, 1), [&](boost::system::error_code ec) {
+            CHECK(!ec);
+            ++completed;
+        });
+    }
+    auto buf = std::vector<char>(64);
+    auto received = size_t(0);
+    drain(pty, buf, received, 10);
+    context.run();
+
+    CHECK(completed == 10);
+    CHECK(std::string(buf.data(), 10) == "abcdefghij");
+    CHECK(queue.statistics().batches == 1);
+    CHECK(queue.statistics().maxFramesPerBatch == 10);
+}
+
+}  // <anonymous>
+
+#endif
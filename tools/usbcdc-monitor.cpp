@@ -0,0 +1,379 @@
+// usbcdc-monitor: print the devices usbcdc sees, then each device event, as JSON lines. Every line
+// has a `time` (wall clock, seconds since the epoch) and a `type`: DEVICES for the initial device
+// set, then ADD, REMOVE, RECONNECT, or RESYNC per event. Event lines carry `latencyUs`, the time
+// between the monitor reading the event and the line being formatted.
+//
+// With `--bench`, read synthetic uevents instead of the system's (Linux only), discard the lines,
+// and print one BENCH line with the sustained event rate.
+
+#include <usbcdc/monitor.hpp>
+
+#include <util/log.hpp>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+
+#if BOOST_OS_LINUX
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace po = boost::program_options;
+
+namespace {
+
+class JsonLines {
+    // Formats lines into a buffer allocated once, and writes it out in batches: whenever it fills,
+    // and otherwise `interval` after the first line still unwritten. A line longer than the buffer
+    // is simply written in pieces.
+public:
+    JsonLines (boost::asio::io_service& context, FILE* out, size_t capacity,
+            std::chrono::milliseconds interval)
+        : mOut(out)
+        , mBuf(capacity)
+        , mTimer(context)
+        , mInterval(interval)
+    {}
+
+    void devices (const usbcdc::DeviceSet& devices) {
+        beginLine("DEVICES");
+        append(",\"devices\":[");
+        auto first = true;
+        for (auto& d: devices) {
+            if (!first) { append(","); }
+            first = false;
+            appendDevice(d);
+        }
+        append("]");
+        endLine();
+    }
+
+    double event (const usbcdc::DeviceEvent& event) {
+        // Return the event's latency in microseconds, or zero if the monitor did not stamp it.
+        static const char* const kTypes[] = { "ADD", "REMOVE", "RECONNECT", "RESYNC" };
+        auto latency = event.detected == std::chrono::steady_clock::time_point{}
+            ? 0.0
+            : std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - event.detected).count();
+        beginLine(kTypes[event.type]);
+        if (event.type != usbcdc::DeviceEvent::RESYNC) {
+            append(",\"device\":");
+            appendDevice(event.device);
+        }
+        if (event.type == usbcdc::DeviceEvent::RECONNECT) {
+            append(",\"previousPath\":");
+            appendString(event.previousPath);
+        }
+        char number[32];
+        append(number, std::snprintf(number, sizeof(number), ",\"latencyUs\":%.1f", latency));
+        endLine();
+        return latency;
+    }
+
+    void flush () {
+        mTimer.cancel();
+        mTimerArmed = false;
+        std::fwrite(mBuf.data(), 1, mSize, mOut);
+        std::fflush(mOut);
+        mSize = 0;
+    }
+
+private:
+    void beginLine (const char* type) {
+        using namespace std::chrono;
+        auto us = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+        char number[48];
+        append(number, std::snprintf(number, sizeof(number), "{\"time\":%lld.%06lld,\"type\":",
+            static_cast<long long>(us / 1000000), static_cast<long long>(us % 1000000)));
+        appendString(type);
+    }
+
+    void endLine () {
+        append("}\n");
+        if (!mTimerArmed && mSize) {
+            mTimerArmed = true;
+            mTimer.expires_from_now(mInterval);
+            mTimer.async_wait([this](boost::system::error_code ec) {
+                if (!ec) { flush(); }
+            });
+        }
+    }
+
+    void append (const char* s) { append(s, std::strlen(s)); }
+
+    void append (const char* s, size_t n) {
+        while (n) {
+            if (mSize == mBuf.size()) {
+                flush();
+            }
+            auto k = std::min(n, mBuf.size() - mSize);
+            std::memcpy(mBuf.data() + mSize, s, k);
+            mSize += k;
+            s += k;
+            n -= k;
+        }
+    }
+
+    void appendString (const std::string& s) { appendString(s.data(), s.size()); }
+    void appendString (const char* s) { appendString(s, std::strlen(s)); }
+
+    void appendString (const char* s, size_t n) {
+        append("\"");
+        auto run = s;
+        for (auto end = s + n; s != end; ++s) {
+            auto c = static_cast<unsigned char>(*s);
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+            append(run, s - run);
+            run = s + 1;
+            char escape[8];
+            append(escape, c == '"' || c == '\\'
+                ? std::snprintf(escape, sizeof(escape), "\\%c", c)
+                : std::snprintf(escape, sizeof(escape), "\\u%04x", c));
+        }
+        append(run, s - run);
+        append("\"");
+    }
+
+    void appendDevice (const usbcdc::Device& d) {
+        append("{\"path\":");
+        appendString(d.path());
+        append(",\"productString\":");
+        appendString(d.productString());
+        append(",\"portPath\":");
+        appendString(d.portPath());
+        append(",\"serialNumber\":");
+        appendString(d.serialNumber());
+        char ids[48];
+        append(ids, std::snprintf(ids, sizeof(ids), ",\"vendorId\":\"%04x\",\"productId\":\"%04x\"}",
+            d.vendorId(), d.productId()));
+    }
+
+    FILE* mOut;
+    std::vector<char> mBuf;
+    size_t mSize = 0;
+    boost::asio::steady_timer mTimer;
+    std::chrono::milliseconds mInterval;
+    bool mTimerArmed = false;
+};
+
+template <class MonitorType>
+class Session {
+    // Print the initial device set, then events until `limit` have been received (0 for no limit).
+    // A RESYNC is followed by a fresh device set.
+public:
+    Session (boost::asio::io_service& context, MonitorType& monitor, JsonLines& out,
+            uint64_t limit)
+        : mContext(context), mMonitor(monitor), mOut(out), mLimit(limit)
+    {}
+
+    void start () { enumerate(); }
+
+    bool failed () const { return mFailed; }
+    uint64_t events () const { return mEvents; }
+    double meanLatency () const { return mEvents ? mLatencySum / mEvents : 0; }
+    double maxLatency () const { return mLatencyMax; }
+    std::chrono::steady_clock::time_point firstEventTime () const { return mFirstEventTime; }
+
+private:
+    void enumerate () {
+        mMonitor.asyncDevices([this](boost::system::error_code ec, usbcdc::DeviceSet devices) {
+            if (ec) {
+                fail("enumerating devices", ec);
+                return;
+            }
+            mOut.devices(devices);
+            receive();
+        });
+    }
+
+    void receive () {
+        mMonitor.asyncReceiveDeviceEvent([this](boost::system::error_code ec,
+                usbcdc::DeviceEvent event) {
+            if (ec) {
+                fail("receiving events", ec);
+                return;
+            }
+            if (!mEvents++) {
+                mFirstEventTime = std::chrono::steady_clock::now();
+            }
+            auto latency = mOut.event(event);
+            mLatencySum += latency;
+            mLatencyMax = std::max(mLatencyMax, latency);
+            if (mLimit && mEvents == mLimit) {
+                mOut.flush();
+                mContext.stop();
+            }
+            else if (event.type == usbcdc::DeviceEvent::RESYNC) {
+                enumerate();
+            }
+            else {
+                receive();
+            }
+        });
+    }
+
+    void fail (const char* what, boost::system::error_code ec) {
+        mOut.flush();
+        std::cerr << "usbcdc-monitor: " << what << ": " << ec.message() << '\n';
+        mFailed = true;
+        mContext.stop();
+    }
+
+    boost::asio::io_service& mContext;
+    MonitorType& mMonitor;
+    JsonLines& mOut;
+    uint64_t mLimit;
+    uint64_t mEvents = 0;
+    double mLatencySum = 0;
+    double mLatencyMax = 0;
+    std::chrono::steady_clock::time_point mFirstEventTime;
+    bool mFailed = false;
+};
+
+#if BOOST_OS_LINUX
+
+std::string uevent (const std::string& action, int n) {
+    // A uevent for the `n`th port of a hub with a CDC-ACM device, carrying udev's properties so
+    // that the monitor need not look in sysfs.
+    auto name = "ttyACM" + std::to_string(n);
+    auto devPath = "/devices/usb1/1-1/1-1." + std::to_string(n) + "/1-1." + std::to_string(n)
+        + ":1.0/tty/" + name;
+    auto datagram = action + "@" + devPath + '\0';
+    for (auto& kv: std::vector<std::pair<std::string, std::string>>{
+            {"ACTION", action}, {"DEVPATH", devPath}, {"SUBSYSTEM", "tty"}, {"DEVNAME", name},
+            {"MAJOR", "166"}, {"MINOR", std::to_string(n)}, {"ID_USB_DRIVER", "cdc_acm"},
+            {"ID_MODEL_ENC", "Linkbot\\x20USB"}, {"ID_VENDOR_ID", "2341"},
+            {"ID_MODEL_ID", "0001"}, {"ID_SERIAL_SHORT", "SN" + std::to_string(n)}}) {
+        datagram += kv.first + "=" + kv.second + '\0';
+    }
+    return datagram;
+}
+
+int bench (uint64_t events, size_t bufferSize, std::chrono::milliseconds interval) {
+    // Feed `events` synthetic uevents, alternately adding and removing 64 devices, through a
+    // socketpair as fast as the monitor will take them.
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds)) {
+        std::perror("usbcdc-monitor: socketpair");
+        return 1;
+    }
+    auto datagrams = std::vector<std::string>{};
+    for (int n = 0; n < 64; ++n) {
+        datagrams.push_back(uevent("add", n));
+        datagrams.push_back(uevent("remove", n));
+    }
+
+    boost::asio::io_service context;
+    usbcdc::MonitorImpl monitor{context, usbcdc::ueventEventSource(fds[0])};
+    auto devNull = std::fopen("/dev/null", "w");
+    JsonLines out{context, devNull, bufferSize, interval};
+    auto session = Session<usbcdc::MonitorImpl>{context, monitor, out, events};
+    session.start();
+
+    std::thread generator{[&] {
+        for (uint64_t i = 0; i < events; ++i) {
+            auto& d = datagrams[i % datagrams.size()];
+            if (::send(fds[1], d.data(), d.size(), MSG_NOSIGNAL) < 0) {
+                break;
+            }
+        }
+    }};
+    context.run();
+    auto end = std::chrono::steady_clock::now();
+    ::shutdown(fds[1], SHUT_RDWR);
+    generator.join();
+    ::close(fds[1]);
+    std::fclose(devNull);
+    if (session.failed()) {
+        return 1;
+    }
+
+    auto seconds = std::chrono::duration<double>(end - session.firstEventTime()).count();
+    std::printf("{\"type\":\"BENCH\",\"events\":%llu,\"seconds\":%.3f,\"eventsPerSecond\":%.0f,"
+        "\"meanLatencyUs\":%.1f,\"maxLatencyUs\":%.1f}\n",
+        static_cast<unsigned long long>(session.events()), seconds,
+        seconds > 0 ? (session.events() - 1) / seconds : 0.0,
+        session.meanLatency(), session.maxLatency());
+    return 0;
+}
+
+#endif
+
+} // <anonymous>
+
+int main (int argc, char** argv) try {
+    auto options = util::log::optionsDescription();
+    options.add_options()
+        ("help", "show this message")
+        ("count", po::value<uint64_t>()->default_value(0),
+            "exit after this many events (0: run until interrupted)")
+        ("buffer-size", po::value<size_t>()->default_value(64 * 1024),
+            "bytes of output to batch into one write")
+        ("flush-interval", po::value<unsigned>()->default_value(10),
+            "milliseconds a line may wait in the output buffer")
+#if BOOST_OS_LINUX
+        ("bench", "measure the sustained event rate with synthetic events")
+        ("bench-events", po::value<uint64_t>()->default_value(1000000),
+            "how many synthetic events to send with --bench")
+#endif
+    ;
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, options), vm);
+    po::notify(vm);
+    if (vm.count("help")) {
+        std::cout << options << '\n';
+        return 0;
+    }
+    auto bufferSize = std::max<size_t>(vm["buffer-size"].as<size_t>(), 1);
+    auto interval = std::chrono::milliseconds{vm["flush-interval"].as<unsigned>()};
+
+#if BOOST_OS_LINUX
+    if (vm.count("bench")) {
+        return bench(vm["bench-events"].as<uint64_t>(), bufferSize, interval);
+    }
+#endif
+
+    // Our buffer is the only one, so a batch goes out in one write.
+    std::setvbuf(stdout, nullptr, _IONBF, 0);
+
+    boost::asio::io_service context;
+    usbcdc::Monitor monitor{context};
+    JsonLines out{context, stdout, bufferSize, interval};
+    auto session = Session<usbcdc::Monitor>{context, monitor, out, vm["count"].as<uint64_t>()};
+    session.start();
+
+    boost::asio::signal_set signals{context, SIGINT, SIGTERM};
+    signals.async_wait([&](boost::system::error_code ec, int) {
+        if (!ec) {
+            out.flush();
+            context.stop();
+        }
+    });
+
+    context.run();
+    return session.failed() ? 1 : 0;
+}
+catch (std::exception& e) {
+    std::cerr << "usbcdc-monitor: " << e.what() << '\n';
+    return 1;
+}
@@ -0,0 +1,74 @@
+// usbcdcd: run one device monitor for the whole system, and publish what it sees in a
+// shared-memory device table. Library users read the table with `usbcdc::RegistryClient`.
+
+#include <usbcdc/linux/registry.hpp>
+
+#include <util/log.hpp>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/signal_set.hpp>
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include <signal.h>
+
+namespace po = boost::program_options;
+
+int main (int argc, char** argv) try {
+    auto options = util::log::optionsDescription();
+    options.add_options()
+        ("help", "show this message")
+        ("table", po::value<std::string>()->default_value(usbcdc::kDefaultRegistryTable),
+            "shared-memory name of the device table")
+        ("socket", po::value<std::string>()->default_value(usbcdc::kDefaultRegistrySocket),
+            "unix socket path to notify subscribers on")
+    ;
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, options), vm);
+    po::notify(vm);
+    if (vm.count("help")) {
+        std::cout << options << '\n';
+        return 0;
+    }
+
+    util::log::Logger lg;
+    boost::asio::io_service context;
+    usbcdc::MonitorImpl monitor{context};
+    BOOST_LOG(lg) << "Monitoring devices with the " << monitor.backend() << " backend";
+
+    usbcdc::RegistryServer server{context, monitor,
+        vm["table"].as<std::string>(), vm["socket"].as<std::string>()};
+    server.start();
+
+    boost::asio::signal_set signals{context, SIGINT, SIGTERM};
+    signals.async_wait([&](boost::system::error_code ec, int) {
+        if (!ec) {
+            BOOST_LOG(lg) << "Shutting down";
+            auto ignored = boost::system::error_code{};
+            monitor.close(ignored);
+            server.close();
+        }
+    });
+
+    // A stale table is worse than none: exit, and leave restarting to the supervisor.
+    auto status = 0;
+    server.onMonitorFailure([&](boost::system::error_code) {
+        status = 1;
+        auto ignored = boost::system::error_code{};
+        monitor.close(ignored);
+        signals.cancel(ignored);
+    });
+
+    context.run();
+    return status;
+}
+catch (std::exception& e) {
+    std::cerr << "usbcdcd: " << e.what() << '\n';
+    return 1;
+}